@@ -10,6 +10,22 @@
             "cflags_cc!": [ "-fno-exceptions"],
             "sources": [
                 "src/utils.cc",
+                "src/trace.cc",
+                "src/json.cc",
+                "src/render_options.cc",
+                "src/drawing.cc",
+                "src/blend.cc",
+                "src/render_scheduler.cc",
+                "src/gif_encoder.cc",
+                "src/quantizer.cc",
+                "src/buffer_pool.cc",
+                "src/image_cache.cc",
+                "src/disk_cache.cc",
+                "src/flat_countdown.cc",
+                "src/indexed_countdown.cc",
+                "src/countdown_renderer.cc",
+                "src/layered_template.cc",
+                "src/render_daemon.cc",
                 "src/native_image.cc",
                 "src/main.cc",
             ],
@@ -48,12 +48,15 @@ export type CountdownComponentStyle = {
 
 export type CountdownComponent = CountdownComponentPosition & CountdownComponentStyle & {
     text: string;
+    // Text per language, `text` is used for the other languages
+    texts?: Record<string, string>;
     paddingTop?: number;
     paddingBottom?: number;
 };
 
 export type CountdownOptions = CreationOptions & {
     name: string;
+    // Label languages, the first one is the default
     langs: string[];
     labels: Record<string, CountdownComponent>;
     digits: {
@@ -61,6 +64,201 @@ export type CountdownOptions = CreationOptions & {
       style: CountdownComponentStyle;
       textTemplate?: string;
     };
+    // Image or animation covering the canvas instead of bgColor, a path or the
+    // encoded file. Animations loop, one background frame per second.
+    background?: string | Buffer;
+    // Pixel densities compiled with the template, geometry is in 1x units.
+    // Defaults to [1]
+    scales?: number[];
+};
+
+export type TemplateSlot = CountdownComponentStyle & {
+    // Box of the slot, width and height are required
+    position: Required<Position2D>;
+    paddingTop?: number;
+    paddingBottom?: number;
+    // Pango markup, %s is replaced by the value
+    textTemplate?: string;
+    // Allowed values, pre-rendered when the template is created. Any text is
+    // accepted when missing, and rendered on first use.
+    values?: (string | number)[];
+};
+
+export type TemplateOptions = CreationOptions & {
+    // Static text, flattened into the background
+    layers?: CountdownComponent[];
+    slots: Record<string, TemplateSlot>;
+    // Free text values kept rendered, defaults to 256
+    cacheSize?: number;
+};
+
+// Slots without a value show the background
+export type TemplateValues = Record<string, string | number>;
+
+export type TemplateRenderOptions = {
+  toFile?: string;
+  // Format of the returned buffer, defaults to png
+  format?: "png" | "jpg" | "webp" | "gif";
+  // Largest RGB distance a GIF pixel may be off by, 0 (default) is lossless
+  lossy?: number;
+};
+
+export type TemplateStats = {
+  // Pre-rendered values
+  tiles: number;
+  // Free text values in the cache
+  cached: number;
+  cacheHits: number;
+  cacheMisses: number;
+};
+
+export type FramePoolStats = {
+  acquired: number;
+  // Acquisitions served by a buffer of an earlier render
+  reused: number;
+  allocated: number;
+  released: number;
+  // Buffers freed because the pool was full
+  dropped: number;
+  // Free buffers held by the pool
+  pooled: number;
+  pooledBytes: number;
+};
+
+export type JobPriority = "interactive" | "normal" | "bulk";
+
+export type JobOptions = {
+  priority?: JobPriority;
+  // Milliseconds after submission when the job is abandoned
+  timeout?: number;
+  // Cancels the job, a running libvips pipeline is killed
+  signal?: AbortSignal;
+};
+
+export type CountdownOutputFormat = "gif" | "webp" | "poster";
+
+export type CountdownRenderOptions = {
+  toFile?: string;
+  // One of the template langs, defaults to the first one
+  lang?: string;
+  // Encode several formats from one composition, the render then returns
+  // CountdownOutputs. Cannot be combined with toFile.
+  outputs?: CountdownOutputFormat[];
+  // Format of the poster, the first frame. Defaults to png
+  posterFormat?: "png" | "jpg";
+  // Largest RGB distance a GIF pixel may be off by, 0 (default) is lossless
+  lossy?: number;
+  // One of the template scales, defaults to 1
+  scale?: number;
+  // Render several template scales at once, the render then returns an
+  // object keyed by density ("1x", "2x"). Cannot be combined with toFile.
+  scales?: number[];
+};
+
+export type CountdownOutputs = Partial<Record<CountdownOutputFormat, Buffer>>;
+
+export type RenderOptions = JobOptions & CountdownRenderOptions;
+
+export type SchedulerOptions = {
+  // Worker threads, defaults to one per hardware thread
+  workers?: number;
+  // Queue bound per priority class
+  queueSize?: number;
+  whenFull?: "reject" | "wait";
+};
+
+export type SchedulerStats = {
+  workers: number;
+  running: number;
+  queued: Record<JobPriority, number>;
+  waiting: number;
+  completed: number;
+  failed: number;
+  cancelled: number;
+  timedOut: number;
+  rejected: number;
+};
+
+export type MemoryStats = {
+  // Bytes currently allocated through libvips' tracked allocator
+  memory: number;
+  memoryHighwater: number;
+  allocations: number;
+  files: number;
+};
+
+export type ImageCacheOptions = {
+  // Budget of decoded pixels, 0 turns the cache off
+  maxBytes: number;
+};
+
+export type ImageCacheStats = {
+  entries: number;
+  bytes: number;
+  maxBytes: number;
+  hits: number;
+  misses: number;
+  evictions: number;
+};
+
+export type DiskCacheOptions = {
+  // Shared by the processes of the host, an empty string turns the cache off
+  directory: string;
+  // Size cap of the directory, defaults to 1 GB, 0 stores nothing
+  maxBytes?: number;
+};
+
+export type DiskCacheStats = {
+  hits: number;
+  misses: number;
+  writes: number;
+  evictions: number;
+  bytes: number;
+  maxBytes: number;
+};
+
+export type SaveOptions = {
+  // Largest RGB distance a GIF pixel may be off by, 0 (default) is lossless
+  lossy?: number;
+};
+
+export type GifStats = {
+  files: number;
+  lossyFiles: number;
+  frames: number;
+  // Palette indices encoded, one per pixel of each frame rectangle
+  pixels: number;
+  bytes: number;
+  // pixels / bytes
+  compressionRatio: number;
+};
+
+// vips is the generic libvips composite
+export type BlendKernel = "auto" | "vips" | "scalar" | "sse4" | "avx2" | "neon";
+
+export type BlendKernelInfo = {
+  kernel: BlendKernel;
+  // Kernels this CPU runs, best last
+  available: BlendKernel[];
+};
+
+export type CountdownCreateOptions = {
+  // Socket path of a vips-render-daemon: the daemon compiles and renders the
+  // template, renders resolve with buffers mapped from its shared memory.
+  // Linux only.
+  daemon?: string;
+  // Milliseconds a request waits for the daemon, 60000 by default. Past it
+  // the request fails with code ETIMEDOUT. Creating the template waits for
+  // the daemon to compile it.
+  daemonTimeout?: number;
+};
+
+export type RenderDaemonStats = {
+  // Templates compiled by the daemon, one per distinct document
+  templates: number;
+  renders: number;
+  failures: number;
+  connections: number;
 };
 
 export declare class NativeImage {
@@ -71,13 +269,83 @@ export declare class NativeImage {
   //
   // Countdown banner functions
   //
-  static createCountdownAnimation(opts: CountdownOptions): NativeImage;
-  renderCountdownAnimation(start: CountdownMoment<number>, frames: number, toFile?: string): Buffer | string;
+  static createCountdownAnimation(opts: CountdownOptions, createOpts?: CountdownCreateOptions): NativeImage;
+  // start is the time left: days 0-99, hours 0-23, minutes and seconds 0-59.
+  // frames is at most 3600, one per second.
+  renderCountdownAnimation(start: CountdownMoment<number>, frames: number, opts: CountdownRenderOptions & {scales: number[], outputs: CountdownOutputFormat[]}): Record<string, CountdownOutputs>;
+  renderCountdownAnimation(start: CountdownMoment<number>, frames: number, opts: CountdownRenderOptions & {scales: number[]}): Record<string, Buffer>;
+  renderCountdownAnimation(start: CountdownMoment<number>, frames: number, opts: CountdownRenderOptions & {outputs: CountdownOutputFormat[]}): CountdownOutputs;
+  renderCountdownAnimation(start: CountdownMoment<number>, frames: number, toFile?: string | CountdownRenderOptions): Buffer | string;
+  renderCountdownAnimationAsync(start: CountdownMoment<number>, frames: number, opts: RenderOptions & {scales: number[], outputs: CountdownOutputFormat[]}): Promise<Record<string, CountdownOutputs>>;
+  renderCountdownAnimationAsync(start: CountdownMoment<number>, frames: number, opts: RenderOptions & {scales: number[]}): Promise<Record<string, Buffer>>;
+  renderCountdownAnimationAsync(start: CountdownMoment<number>, frames: number, opts: RenderOptions & {outputs: CountdownOutputFormat[]}): Promise<CountdownOutputs>;
+  renderCountdownAnimationAsync(start: CountdownMoment<number>, frames: number, opts?: RenderOptions): Promise<Buffer | string>;
 
   static countdown(opts: CountdownOptions): number;
+  framePoolStats(): FramePoolStats;
+
+  //
+  // Layered templates with text slots
+  //
+  static createTemplate(opts: TemplateOptions): NativeImage;
+  render(values: TemplateValues, opts?: TemplateRenderOptions): Buffer | string;
+  renderAsync(values: TemplateValues, opts?: TemplateRenderOptions & JobOptions): Promise<Buffer | string>;
+  templateStats(): TemplateStats;
+
+  // Compile a new version of the countdown or layered template off-thread and
+  // swap it in. Renders in flight finish on the version they started with.
+  updateTemplate(opts: CountdownOptions | TemplateOptions, jobOpts?: JobOptions): Promise<number>;
+  // Replace or add one label, or the digit style, of a countdown template.
+  // Only that part is rendered again.
+  updateLabel(key: string, label: CountdownComponent, jobOpts?: JobOptions): Promise<number>;
+  updateDigitStyle(style: CountdownComponentStyle, jobOpts?: JobOptions): Promise<number>;
+
+  // On a countdown template a job draws the text on every frame of the
+  // background, under the labels and the digits, and the promise settles
+  // once the renders show it. Not supported on a countdown of the render
+  // daemon.
+  drawText(text: string, topX: number, topY: number, opts?: DrawTextOptions): number | Promise<number>;
+
+  // A new instance sharing the pixels of this one copy-on-write, the image is
+  // decoded into memory once. Templates are shared too, updateTemplate on a
+  // clone only affects that clone.
+  clone(): NativeImage;
+
+  save(outFilePath: string, opts?: SaveOptions): number;
+  saveAsync(outFilePath: string, opts?: JobOptions & SaveOptions): Promise<number>;
+
+  //
+  // Native job scheduler shared by all instances of the process
+  //
+  static configureScheduler(opts: SchedulerOptions): number;
+  static schedulerStats(): SchedulerStats;
+
+  static memoryStats(): MemoryStats;
+
+  // Images opened by path are decoded once and shared while the file keeps
+  // its size and mtime
+  static configureImageCache(opts: ImageCacheOptions): number;
+  static imageCacheStats(): ImageCacheStats;
+  static invalidateImageCache(path?: string): number;
+
+  // Countdown buffers cached on disk by what was rendered, read back as
+  // mapped files. Renders to a file do not use the cache.
+  static configureDiskCache(opts: DiskCacheOptions): number;
+  static diskCacheStats(): DiskCacheStats;
+
+  // GIF files written by the encoder of this library: palette-indexed
+  // countdowns and lossy GIFs. Files written by libvips are not counted.
+  static gifStats(): GifStats;
+
+  // Kernel drawText blends with, the best SIMD one by default. Throws for a
+  // kernel the CPU lacks, without a name only reports the selection.
+  static setBlendKernel(kernel?: BlendKernel): BlendKernelInfo;
 
-  drawText(text: string, topX: number, topY: number, opts?: DrawTextOptions): number;
+  // Chrome trace / Perfetto JSON of the rendering stages and libvips
+  // operations, stopTrace returns the number of events written
+  static startTrace(): void;
+  static stopTrace(path: string): number;
 
-  save(outFilePath: string): number;
+  static renderDaemonStats(socketPath: string): RenderDaemonStats;
 
 }
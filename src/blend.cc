@@ -0,0 +1,330 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+#include "blend.h"
+#include "trace.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define JSVIPS_BLEND_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define JSVIPS_BLEND_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace vips;
+
+namespace jsvips {
+
+namespace {
+
+using BlendRow = void (*)(uint8_t* dst, int bands, const uint8_t* mask, int width, const uint8_t colour[3]);
+
+// x / 255 rounded, exact for the products of two bytes
+inline unsigned div255(unsigned x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+void blend_scalar(uint8_t* dst, int bands, const uint8_t* mask, int width, const uint8_t colour[3]) {
+    for (int i = 0; i < width; i++, dst += bands) {
+        const unsigned a = mask[i];
+        if (a == 0) {
+            continue;
+        }
+
+        if (bands == 4 && dst[3] != 255) {
+            // Translucent destination: OVER with straight alpha
+            const unsigned under = div255(dst[3] * (255 - a));
+            const unsigned alpha = a + under;
+            for (int c = 0; c < 3; c++) {
+                dst[c] = static_cast<uint8_t>((colour[c] * a + dst[c] * under + alpha / 2) / alpha);
+            }
+            dst[3] = static_cast<uint8_t>(alpha);
+        } else {
+            for (int c = 0; c < 3; c++) {
+                dst[c] = static_cast<uint8_t>(div255(colour[c] * a + dst[c] * (255 - a)));
+            }
+        }
+    }
+}
+
+#if defined(JSVIPS_BLEND_X86) || defined(JSVIPS_BLEND_NEON)
+
+// The kernels blend 16 pixels per step, 16 * bands bytes. spread[bands][k]
+// picks the mask byte of every byte of the k-th 16 byte chunk.
+struct Spread {
+    alignas(16) uint8_t bytes[5][4][16];
+
+    Spread() {
+        for (int bands = 3; bands <= 4; bands++) {
+            for (int k = 0; k < bands; k++) {
+                for (int j = 0; j < 16; j++) {
+                    bytes[bands][k][j] = static_cast<uint8_t>((16 * k + j) / bands);
+                }
+            }
+        }
+    }
+};
+
+const Spread spread;
+
+// Colour of every byte of the 16 pixels. The alpha of opaque sRGBA blends with 255 and stays 255.
+void fill_pattern(uint8_t* pattern, int bands, const uint8_t colour[3]) {
+    for (int j = 0; j < 16 * bands; j++) {
+        pattern[j] = bands == 4 && j % 4 == 3 ? 255 : colour[j % bands];
+    }
+}
+
+// Translucent pixels take the scalar path
+bool opaque(const uint8_t* dst, int bands) {
+    if (bands == 3) {
+        return true;
+    }
+    uint8_t all = 255;
+    for (int i = 0; i < 16; i++) {
+        all &= dst[i * 4 + 3];
+    }
+    return all == 255;
+}
+
+#endif
+
+#if defined(JSVIPS_BLEND_X86)
+
+__attribute__((target("sse4.1")))
+void blend_sse4(uint8_t* dst, int bands, const uint8_t* mask, int width, const uint8_t colour[3]) {
+    alignas(16) uint8_t pattern[64];
+    fill_pattern(pattern, bands, colour);
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+        uint8_t* p = dst + i * bands;
+        const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i));
+        if (_mm_testz_si128(m, m)) {
+            continue;
+        }
+        if (!opaque(p, bands)) {
+            blend_scalar(p, bands, mask + i, 16, colour);
+            continue;
+        }
+
+        for (int k = 0; k < bands; k++) {
+            const __m128i a = _mm_shuffle_epi8(m, _mm_load_si128(reinterpret_cast<const __m128i*>(spread.bytes[bands][k])));
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * k));
+            const __m128i c = _mm_load_si128(reinterpret_cast<const __m128i*>(pattern + 16 * k));
+
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_cvtepu8_epi16(c), _mm_cvtepu8_epi16(a)),
+                                       _mm_mullo_epi16(_mm_cvtepu8_epi16(d), _mm_sub_epi16(full, _mm_cvtepu8_epi16(a))));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(a, zero)),
+                                       _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, _mm_unpackhi_epi8(a, zero))));
+            lo = _mm_add_epi16(lo, half);
+            hi = _mm_add_epi16(hi, half);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16 * k), _mm_packus_epi16(lo, hi));
+        }
+    }
+    blend_scalar(dst + i * bands, bands, mask + i, width - i, colour);
+}
+
+__attribute__((target("avx2")))
+void blend_avx2(uint8_t* dst, int bands, const uint8_t* mask, int width, const uint8_t colour[3]) {
+    alignas(16) uint8_t pattern[64];
+    fill_pattern(pattern, bands, colour);
+
+    const __m256i full = _mm256_set1_epi16(255);
+    const __m256i half = _mm256_set1_epi16(128);
+
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+        uint8_t* p = dst + i * bands;
+        const __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i));
+        if (_mm_testz_si128(m, m)) {
+            continue;
+        }
+        if (!opaque(p, bands)) {
+            blend_scalar(p, bands, mask + i, 16, colour);
+            continue;
+        }
+
+        // 16 bytes widened to one register of 16-bit lanes
+        for (int k = 0; k < bands; k++) {
+            const __m256i a = _mm256_cvtepu8_epi16(_mm_shuffle_epi8(m, _mm_load_si128(reinterpret_cast<const __m128i*>(spread.bytes[bands][k]))));
+            const __m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * k)));
+            const __m256i c = _mm256_cvtepu8_epi16(_mm_load_si128(reinterpret_cast<const __m128i*>(pattern + 16 * k)));
+
+            __m256i x = _mm256_add_epi16(_mm256_mullo_epi16(c, a), _mm256_mullo_epi16(d, _mm256_sub_epi16(full, a)));
+            x = _mm256_add_epi16(x, half);
+            x = _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+            const __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p + 16 * k), packed);
+        }
+    }
+    blend_scalar(dst + i * bands, bands, mask + i, width - i, colour);
+}
+
+#endif
+
+#if defined(JSVIPS_BLEND_NEON)
+
+void blend_neon(uint8_t* dst, int bands, const uint8_t* mask, int width, const uint8_t colour[3]) {
+    alignas(16) uint8_t pattern[64];
+    fill_pattern(pattern, bands, colour);
+
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+        uint8_t* p = dst + i * bands;
+        const uint8x16_t m = vld1q_u8(mask + i);
+        if (vmaxvq_u8(m) == 0) {
+            continue;
+        }
+        if (!opaque(p, bands)) {
+            blend_scalar(p, bands, mask + i, 16, colour);
+            continue;
+        }
+
+        for (int k = 0; k < bands; k++) {
+            const uint8x16_t a = vqtbl1q_u8(m, vld1q_u8(spread.bytes[bands][k]));
+            const uint8x16_t inverse = vmvnq_u8(a);
+            const uint8x16_t d = vld1q_u8(p + 16 * k);
+            const uint8x16_t c = vld1q_u8(pattern + 16 * k);
+
+            uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(c), vget_low_u8(a)), vget_low_u8(d), vget_low_u8(inverse));
+            uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(c), vget_high_u8(a)), vget_high_u8(d), vget_high_u8(inverse));
+            // (x + ((x + 128) >> 8) + 128) >> 8, the same rounding as div255
+            vst1q_u8(p + 16 * k, vcombine_u8(vrshrn_n_u16(vrsraq_n_u16(lo, lo, 8), 8), vrshrn_n_u16(vrsraq_n_u16(hi, hi, 8), 8)));
+        }
+    }
+    blend_scalar(dst + i * bands, bands, mask + i, width - i, colour);
+}
+
+#endif
+
+struct Kernel {
+    const char* name;
+    BlendRow row;
+};
+
+// Kernels of this CPU, best last
+std::vector<Kernel> supported_kernels() {
+    std::vector<Kernel> kernels = {{"scalar", blend_scalar}};
+#if defined(JSVIPS_BLEND_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        kernels.push_back({"sse4", blend_sse4});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", blend_avx2});
+    }
+#elif defined(JSVIPS_BLEND_NEON)
+    kernels.push_back({"neon", blend_neon});
+#endif
+    return kernels;
+}
+
+const std::vector<Kernel>& kernels() {
+    static const std::vector<Kernel> supported = supported_kernels();
+    return supported;
+}
+
+// Index into kernels(), -1 for the generic composite
+std::atomic<int> selected {-2};
+
+int current_kernel() {
+    int index = selected.load(std::memory_order_relaxed);
+    if (index == -2) {
+        index = static_cast<int>(kernels().size()) - 1;
+        selected.store(index, std::memory_order_relaxed);
+    }
+    return index;
+}
+
+}
+
+void set_blend_kernel(const std::string& name) {
+    if (name == "auto") {
+        selected = static_cast<int>(kernels().size()) - 1;
+        return;
+    }
+    if (name == "vips") {
+        selected = -1;
+        return;
+    }
+    for (size_t i = 0; i < kernels().size(); i++) {
+        if (name == kernels()[i].name) {
+            selected = static_cast<int>(i);
+            return;
+        }
+    }
+    throw std::invalid_argument("The blend kernel " + name + " is not available on this CPU");
+}
+
+std::string blend_kernel() {
+    int index = current_kernel();
+    return index < 0 ? "vips" : kernels()[index].name;
+}
+
+std::vector<std::string> blend_kernels() {
+    std::vector<std::string> names = {"vips"};
+    for (const Kernel& kernel: kernels()) {
+        names.push_back(kernel.name);
+    }
+    return names;
+}
+
+void blend_row(uint8_t* dst, int bands, const uint8_t* mask, int width, const uint8_t colour[3]) {
+    int index = current_kernel();
+    (index < 0 ? blend_scalar : kernels()[index].row)(dst, bands, mask, width, colour);
+}
+
+VImage draw_text(const VImage& image, const VImage& mask, int x, int y, const std::vector<u_char>& colour) {
+    const int kernel = current_kernel();
+    TraceSpan span("draw text");
+    span.arg("width", mask.width()).arg("height", mask.height());
+
+    // The patch under the text is read before the rest of the image: an image
+    // loaded for sequential access could not be read from the top again
+    const bool sequential = image.get_typeof(VIPS_META_SEQUENTIAL) != 0;
+    const bool direct = kernel >= 0 && !sequential && image.format() == VIPS_FORMAT_UCHAR && (image.bands() == 3 || image.bands() == 4) &&
+                        image.interpretation() == VIPS_INTERPRETATION_sRGB && mask.bands() == 1 && mask.format() == VIPS_FORMAT_UCHAR;
+    if (!direct) {
+        // A constant image of the colour with the mask as its alpha
+        const std::vector<double> rgb = {double(colour[0]), double(colour[1]), double(colour[2])};
+        VImage overlay = mask.new_from_image(rgb).copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB)).bandjoin(mask);
+        return image.composite(overlay, VIPS_BLEND_MODE_OVER, VImage::option()->set("x", x)->set("y", y));
+    }
+
+    // Area of the image under the text
+    const int left = std::max(0, x);
+    const int top = std::max(0, y);
+    const int width = std::min(image.width(), x + mask.width()) - left;
+    const int height = std::min(image.height(), y + mask.height()) - top;
+    if (width <= 0 || height <= 0) {
+        return image;
+    }
+
+    const int bands = image.bands();
+    const uint8_t rgb[3] = {colour[0], colour[1], colour[2]};
+    size_t size;
+    auto* pixels = static_cast<uint8_t*>(image.extract_area(left, top, width, height).write_to_memory(&size));
+    std::unique_ptr<uint8_t, decltype(&g_free)> coverage(static_cast<uint8_t*>(mask.extract_area(left - x, top - y, width, height).write_to_memory(&size)), &g_free);
+    for (int row = 0; row < height; row++) {
+        blend_row(pixels + static_cast<size_t>(row) * width * bands, bands, coverage.get() + static_cast<size_t>(row) * width, width, rgb);
+    }
+
+    VImage patch = VImage::new_from_memory(pixels, static_cast<size_t>(width) * height * bands, width, height, bands, VIPS_FORMAT_UCHAR);
+    g_signal_connect(patch.get_image(), "postclose", G_CALLBACK(+[](VipsImage*, gpointer data) {
+        g_free(data);
+    }), pixels);
+
+    return image.insert(patch.copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB)), left, top);
+}
+
+}
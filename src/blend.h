@@ -0,0 +1,44 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <vips/vips8>
+
+namespace jsvips {
+
+    //
+    // Text drawn over 8-bit sRGB images without the generic composite.
+    //
+    // vips composite converts both images to float and supports every blend
+    // mode. Text is a single colour through an 8-bit coverage mask blended
+    // OVER, which is a multiply-add per byte in 16-bit integers. The kernels
+    // blend 16 pixels per step with SSE4.1, AVX2 or NEON, the best one the
+    // CPU runs is picked at startup; the scalar one handles the row ends and
+    // translucent sRGBA pixels.
+    //
+
+    // Select a kernel by name: auto, scalar, sse4, avx2, neon, or vips for the
+    // generic composite. Throws std::invalid_argument when the CPU lacks it.
+    void set_blend_kernel(const std::string& name);
+    // Name of the kernel in use
+    std::string blend_kernel();
+    // Kernels this CPU runs, best last
+    std::vector<std::string> blend_kernels();
+
+    // Blend colour (RGB) through mask OVER width pixels of dst, in place.
+    // dst has 3 or 4 bands.
+    void blend_row(uint8_t* dst, int bands, const uint8_t* mask, int width, const uint8_t colour[3]);
+
+    // Draw a one band uchar text mask in colour (RGB) with its top-left corner
+    // at x, y. Only the area under the text is evaluated, the rest of the
+    // image stays lazy and keeps its bands. Images that are not uchar sRGB or
+    // sRGBA, images loaded for sequential access, and the vips kernel use the
+    // generic composite, which stays lazy.
+    vips::VImage draw_text(const vips::VImage& image, const vips::VImage& mask, int x, int y, const std::vector<u_char>& colour);
+
+}
+
+#endif
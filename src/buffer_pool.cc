@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "buffer_pool.h"
+
+using namespace vips;
+
+BufferPoolStats& BufferPoolStats::operator+=(const BufferPoolStats& other) {
+    this->acquired += other.acquired;
+    this->reused += other.reused;
+    this->allocated += other.allocated;
+    this->released += other.released;
+    this->dropped += other.dropped;
+    this->pooled += other.pooled;
+    this->pooledBytes += other.pooledBytes;
+    return *this;
+}
+
+BufferPool::Buffer::Buffer(Buffer&& other) noexcept {
+    *this = std::move(other);
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        this->pool_ = std::move(other.pool_);
+        this->data_ = other.data_;
+        this->capacity_ = other.capacity_;
+        this->sizeClass_ = other.sizeClass_;
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+BufferPool::Buffer::~Buffer() {
+    reset();
+}
+
+void BufferPool::Buffer::reset() {
+    if (this->data_ != nullptr) {
+        this->pool_->release(this->data_, this->sizeClass_);
+        this->data_ = nullptr;
+    }
+    this->pool_.reset();
+}
+
+std::atomic<size_t> BufferPool::pooledBytes_ {0};
+
+BufferPool::BufferPool(size_t unitBytes, int slotsPerClass):
+    unitBytes_(unitBytes), slotsPerClass_(slotsPerClass), slots_(new std::atomic<uint8_t*>[sizeClasses * slotsPerClass]) {
+    for (int i = 0; i < sizeClasses * slotsPerClass; i++) {
+        this->slots_[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+BufferPool::~BufferPool() {
+    for (int i = 0; i < sizeClasses * this->slotsPerClass_; i++) {
+        if (uint8_t* data = this->slots_[i].load(std::memory_order_relaxed)) {
+            pooledBytes_ -= this->unitBytes_ * class_units(i / this->slotsPerClass_);
+            std::free(data);
+        }
+    }
+}
+
+std::shared_ptr<BufferPool> BufferPool::create(size_t unitBytes, int slotsPerClass) {
+    return std::make_shared<BufferPool>(unitBytes, slotsPerClass);
+}
+
+size_t BufferPool::class_units(int sizeClass) {
+    if (sizeClass < 4) {
+        return static_cast<size_t>(sizeClass) + 1;
+    }
+    return static_cast<size_t>(5 + sizeClass % 4) << (sizeClass / 4 - 1);
+}
+
+BufferPool::Buffer BufferPool::acquire(size_t units) {
+    Buffer buffer;
+    buffer.pool_ = shared_from_this();
+    this->acquired_++;
+
+    int sizeClass = 0;
+    while (sizeClass < sizeClasses && class_units(sizeClass) < units) {
+        sizeClass++;
+    }
+    buffer.sizeClass_ = sizeClass;
+    buffer.capacity_ = this->unitBytes_ * (sizeClass < sizeClasses ? class_units(sizeClass) : std::max<size_t>(units, 1));
+
+    if (sizeClass < sizeClasses) {
+        std::atomic<uint8_t*>* slots = &this->slots_[sizeClass * this->slotsPerClass_];
+        for (int i = 0; i < this->slotsPerClass_; i++) {
+            if (slots[i].load(std::memory_order_relaxed) == nullptr) {
+                continue;
+            }
+            uint8_t* data = slots[i].exchange(nullptr, std::memory_order_acquire);
+            if (data != nullptr) {
+                pooledBytes_ -= buffer.capacity_;
+                this->reused_++;
+                buffer.data_ = data;
+                return buffer;
+            }
+        }
+    }
+
+    buffer.data_ = static_cast<uint8_t*>(std::malloc(buffer.capacity_));
+    if (buffer.data_ == nullptr) {
+        throw std::bad_alloc();
+    }
+    this->allocated_++;
+    return buffer;
+}
+
+void BufferPool::release(uint8_t* data, int sizeClass) {
+    if (sizeClass < sizeClasses) {
+        // Counted first, so the pools never hold more than the cap
+        const size_t bytes = this->unitBytes_ * class_units(sizeClass);
+        if (pooledBytes_.fetch_add(bytes) + bytes <= maxPooledBytes) {
+            std::atomic<uint8_t*>* slots = &this->slots_[sizeClass * this->slotsPerClass_];
+            for (int i = 0; i < this->slotsPerClass_; i++) {
+                uint8_t* expected = nullptr;
+                if (slots[i].compare_exchange_strong(expected, data, std::memory_order_release, std::memory_order_relaxed)) {
+                    this->released_++;
+                    return;
+                }
+            }
+        }
+        pooledBytes_ -= bytes;
+    }
+
+    std::free(data);
+    this->dropped_++;
+}
+
+VImage BufferPool::wrap(Buffer buffer, int width, int height, int bands) {
+    VImage image = VImage::new_from_memory(buffer.data(), static_cast<size_t>(width) * height * bands, width, height, bands, VIPS_FORMAT_UCHAR);
+
+    auto* owned = new Buffer(std::move(buffer));
+    g_signal_connect(image.get_image(), "postclose", G_CALLBACK(+[](VipsImage*, gpointer data) {
+        delete static_cast<Buffer*>(data);
+    }), owned);
+    return image;
+}
+
+BufferPoolStats BufferPool::stats() const {
+    BufferPoolStats stats;
+    stats.acquired = this->acquired_;
+    stats.reused = this->reused_;
+    stats.allocated = this->allocated_;
+    stats.released = this->released_;
+    stats.dropped = this->dropped_;
+
+    for (int sizeClass = 0; sizeClass < sizeClasses; sizeClass++) {
+        for (int i = 0; i < this->slotsPerClass_; i++) {
+            if (this->slots_[sizeClass * this->slotsPerClass_ + i].load(std::memory_order_relaxed) != nullptr) {
+                stats.pooled++;
+                stats.pooledBytes += this->unitBytes_ * class_units(sizeClass);
+            }
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,103 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vips/vips8>
+
+struct BufferPoolStats {
+    uint64_t acquired {0};
+    // Acquisitions served from the pool
+    uint64_t reused {0};
+    uint64_t allocated {0};
+    // Buffers given back to the pool, and freed because it was full
+    uint64_t released {0};
+    uint64_t dropped {0};
+    size_t pooled {0};
+    size_t pooledBytes {0};
+
+    BufferPoolStats& operator+=(const BufferPoolStats& other);
+};
+
+//
+// Free lists of frame buffers. A buffer holds a number of units, e.g. frames
+// of a template, rounded up to one of four classes per power of two: at
+// most a quarter is wasted, and a render of the same length always finds a
+// buffer of the right class.
+//
+// Each class is a small array of slots: acquire takes a buffer out with an
+// atomic exchange, release puts it back with a compare-exchange into an
+// empty slot. No locks, and a full class frees the buffer instead. The
+// pools of the process hold at most maxPooledBytes, past that released
+// buffers are freed too.
+//
+class BufferPool : public std::enable_shared_from_this<BufferPool> {
+  public:
+    // Move-only handle, returns the buffer to its pool when destroyed
+    class Buffer {
+      public:
+        Buffer() = default;
+        Buffer(Buffer&& other) noexcept;
+        Buffer& operator=(Buffer&& other) noexcept;
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+        ~Buffer();
+
+        uint8_t* data() const { return data_; }
+        size_t capacity() const { return capacity_; }
+
+      private:
+        friend class BufferPool;
+
+        void reset();
+
+        std::shared_ptr<BufferPool> pool_;
+        uint8_t* data_ {nullptr};
+        size_t capacity_ {0};
+        int sizeClass_ {0};
+    };
+
+    // Use create(), buffers keep their pool alive
+    BufferPool(size_t unitBytes, int slotsPerClass);
+    ~BufferPool();
+
+    static std::shared_ptr<BufferPool> create(size_t unitBytes, int slotsPerClass = 4);
+
+    // A buffer of at least units * unitBytes bytes, the content is undefined
+    Buffer acquire(size_t units);
+
+    // Image of width x height pixels over the buffer, the buffer returns to
+    // the pool when libvips closes the image
+    static vips::VImage wrap(Buffer buffer, int width, int height, int bands);
+
+    BufferPoolStats stats() const;
+
+    // Bytes the pools of the process keep at most
+    static const size_t maxPooledBytes = static_cast<size_t>(64) << 20;
+
+  private:
+    // Up to 8192 units, larger buffers are allocated and freed every time
+    static const int sizeClasses = 48;
+
+    // Units of the buffers of a class: 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, ...
+    static size_t class_units(int sizeClass);
+
+    void release(uint8_t* data, int sizeClass);
+
+    // Bytes held by the free lists of every pool
+    static std::atomic<size_t> pooledBytes_;
+
+    size_t unitBytes_;
+    int slotsPerClass_;
+    std::unique_ptr<std::atomic<uint8_t*>[]> slots_;
+
+    std::atomic<uint64_t> acquired_ {0};
+    std::atomic<uint64_t> reused_ {0};
+    std::atomic<uint64_t> allocated_ {0};
+    std::atomic<uint64_t> released_ {0};
+    std::atomic<uint64_t> dropped_ {0};
+};
+
+#endif
@@ -0,0 +1,517 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "blend.h"
+#include "countdown_renderer.h"
+#include "drawing.h"
+#include "quantizer.h"
+#include "trace.h"
+#include "utils.h"
+
+using namespace vips;
+
+CountdownRenderer::CountdownRenderer(const CountdownOptions& options): CountdownRenderer(options, jsvips::decode_background(options)) {}
+
+CountdownRenderer::CountdownRenderer(const CountdownOptions& options, const VImage& source): options_(options) {
+    jsvips::TraceSpan span("compile countdown");
+    span.arg("width", options.width).arg("height", options.height).arg("langs", options.langs.size());
+
+    // 1. Scale the background decoded once to the canvas, a flat colour is a single frame
+    this->bases_ = jsvips::background_frames(options, source);
+    const std::vector<VImage>& bases = this->bases_;
+    span.arg("backgroundFrames", bases.size());
+
+    // 2. Render the labels of every language. Label images are shared by the
+    // languages using the same text.
+    std::vector<std::string> langs = this->options_.langs;
+    if (langs.empty()) {
+        langs.push_back("");
+    }
+
+    std::map<std::string, VImage> labelImages;
+    for (const std::string& lang: langs) {
+        for (const auto& [key, value]: this->options_.labels) {
+            auto translated = value.texts.find(lang);
+            const std::string& text = translated != value.texts.end() ? translated->second : value.text;
+
+            std::string cacheKey = key + "\n" + text;
+            if (labelImages.find(cacheKey) == labelImages.end()) {
+                ColoredTextOptions labelOpts = jsvips::text_options(value, value.paddingTop, value.paddingBottom, this->options_.scale);
+                labelOpts.width = value.position.width;
+                labelOpts.height = value.position.height;
+
+                labelImages[cacheKey] = jsvips::colored_text_image(text, labelOpts);
+            }
+            this->labels_[key][lang] = labelImages[cacheKey];
+        }
+    }
+
+    // 3. The languages share the background frames, each one only adds its
+    // labels over them: one layer per language and frame
+    size_t layers = 0;
+    for (const std::string& lang: langs) {
+        CountdownLocale locale;
+        locale.lang = lang;
+        for (size_t i = 0; i < bases.size(); i++) {
+            locale.layers.push_back(layers++);
+        }
+        locale.background = compose_frame(bases[0], lang);
+        this->locales_[lang] = locale;
+    }
+
+    // 4. Initialize the digits images, shared by all languages
+    render_digits();
+
+    // 5. Flatten the digits onto the backgrounds, then convert to palette indices when possible
+    flatten();
+
+    // 6. The other densities, compiled from the same document and decoded
+    // background. Text and tiles are rasterized again at each density.
+    for (double scale: this->options_.scales) {
+        if (scale != this->options_.scale) {
+            std::shared_ptr<const CountdownRenderer> density(new CountdownRenderer(jsvips::scale_countdown_options(this->options_, scale), source));
+            this->densities_.emplace_back(scale, density);
+        }
+    }
+}
+
+void CountdownRenderer::render_digits() {
+    ColoredTextOptions digitOptions = jsvips::text_options(this->options_.digits.style, 0, 0, this->options_.scale);
+
+    this->digits_.clear();
+    for ( int i = 0; i < totalOfDigits; i++) {
+        std::string digitalText = jsvips::format("%02d", i);
+        if (this->options_.digits.textTemplate.size() > 0) {
+            digitalText = jsvips::expand_template(this->options_.digits.textTemplate, digitalText);
+        }
+
+        VImage digit = jsvips::colored_text_image(digitalText, digitOptions);
+        this->digits_.push_back(digit);
+    }
+}
+
+void CountdownRenderer::add_labels(const std::string& lang, std::vector<VImage>& images, std::vector<int>& x, std::vector<int>& y) const {
+    for (const auto& [key, label]: this->options_.labels) {
+        images.push_back(this->labels_.at(key).at(lang));
+        x.push_back(label.position.x);
+        y.push_back(label.position.y);
+    }
+}
+
+VImage CountdownRenderer::compose_frame(const VImage& base, const std::string& lang) const {
+    std::vector<VImage> images = {base};
+    std::vector<int> xLabel;
+    std::vector<int> yLabel;
+    add_labels(lang, images, xLabel, yLabel);
+    if (images.size() == 1) {
+        return base;
+    }
+
+    std::vector<int> modes = {VIPS_BLEND_MODE_OVER};
+    return VImage::composite(images, modes, VImage::option()->set("x", xLabel)->set("y", yLabel));
+}
+
+std::vector<std::pair<size_t, FlatCountdown::Source>> CountdownRenderer::flat_sources(const std::string& lang) const {
+    std::vector<FlatCountdown::Area> areas;
+    for (const auto& [key, label]: this->options_.labels) {
+        const VImage& image = this->labels_.at(key).at(lang);
+        areas.push_back({label.position.x, label.position.y, image.width(), image.height()});
+    }
+
+    // A background frame and the labels of the language over it
+    const CountdownLocale& locale = this->locales_.at(lang);
+    std::vector<std::pair<size_t, FlatCountdown::Source>> sources;
+    for (size_t i = 0; i < locale.layers.size(); i++) {
+        sources.push_back({locale.layers[i], {i, compose_frame(this->bases_[i], lang), areas}});
+    }
+    return sources;
+}
+
+void CountdownRenderer::digit_positions(std::vector<int>& x, std::vector<int>& y) const {
+    for (const auto& cp : this->options_.digits.positions) {
+        x.push_back(cp.position.x);
+        y.push_back(cp.position.y);
+    }
+}
+
+void CountdownRenderer::flatten() {
+    // Sources in layer order
+    std::vector<FlatCountdown::Source> sources;
+    for (const auto& [lang, locale]: this->locales_) {
+        for (auto& [layer, source]: flat_sources(lang)) {
+            if (layer >= sources.size()) {
+                sources.resize(layer + 1);
+            }
+            sources[layer] = std::move(source);
+        }
+    }
+
+    std::vector<int> xDigit;
+    std::vector<int> yDigit;
+    digit_positions(xDigit, yDigit);
+    const std::shared_ptr<const IndexedCountdown> previous = this->indexed_;
+    this->flat_ = FlatCountdown::build(this->bases_, sources, this->digits_, xDigit, yDigit, this->flat_.get());
+    this->indexed_ = this->flat_ ? IndexedCountdown::build(*this->flat_, previous.get()) : nullptr;
+}
+
+void CountdownRenderer::flatten_locales(const std::vector<std::string>& langs) {
+    if (!this->flat_) {
+        flatten();
+        return;
+    }
+
+    std::vector<std::pair<size_t, FlatCountdown::Source>> sources;
+    for (const std::string& lang: langs) {
+        for (auto& source: flat_sources(lang)) {
+            sources.push_back(std::move(source));
+        }
+    }
+    const std::shared_ptr<const IndexedCountdown> previous = this->indexed_;
+    this->flat_ = this->flat_->with_layers(sources);
+    this->indexed_ = this->flat_ ? IndexedCountdown::build(*this->flat_, previous.get()) : nullptr;
+}
+
+void CountdownRenderer::flatten_digits() {
+    if (!this->flat_) {
+        flatten();
+        return;
+    }
+
+    std::vector<int> xDigit;
+    std::vector<int> yDigit;
+    digit_positions(xDigit, yDigit);
+    const std::shared_ptr<const IndexedCountdown> previous = this->indexed_;
+    this->flat_ = this->flat_->with_digits(this->digits_, xDigit, yDigit);
+    this->indexed_ = this->flat_ ? IndexedCountdown::build(*this->flat_, previous.get()) : nullptr;
+}
+
+namespace {
+
+const std::string& label_text(const CountdownComponent& label, const std::string& lang) {
+    auto translated = label.texts.find(lang);
+    return translated != label.texts.end() ? translated->second : label.text;
+}
+
+// Whether a label looks the same in lang
+bool same_label(const CountdownComponent& a, const CountdownComponent& b, const std::string& lang) {
+    return label_text(a, lang) == label_text(b, lang) && a.color == b.color && a.font == b.font && a.fontFile == b.fontFile &&
+           a.width == b.width && a.height == b.height && a.textAlignment == b.textAlignment &&
+           a.paddingTop == b.paddingTop && a.paddingBottom == b.paddingBottom &&
+           a.position.x == b.position.x && a.position.y == b.position.y &&
+           a.position.width == b.position.width && a.position.height == b.position.height;
+}
+
+}
+
+std::shared_ptr<const CountdownRenderer> CountdownRenderer::with_label(const CountdownOptions& options, const std::string& key) const {
+    jsvips::TraceSpan span("update countdown label");
+
+    auto renderer = std::make_shared<CountdownRenderer>(*this);
+    renderer->options_ = options;
+    const CountdownComponent& label = options.labels.at(key);
+    auto previous = this->options_.labels.find(key);
+    const bool added = previous == this->options_.labels.end();
+
+    // Label images are shared by the languages using the same text
+    std::map<std::string, VImage> images;
+    std::vector<std::string> composed;
+    for (auto& [lang, locale]: renderer->locales_) {
+        if (!added && same_label(previous->second, label, lang)) {
+            continue;
+        }
+
+        const std::string& text = label_text(label, lang);
+        if (images.find(text) == images.end()) {
+            ColoredTextOptions labelOpts = jsvips::text_options(label, label.paddingTop, label.paddingBottom, options.scale);
+            labelOpts.width = label.position.width;
+            labelOpts.height = label.position.height;
+            images[text] = jsvips::colored_text_image(text, labelOpts);
+        }
+        renderer->labels_[key][lang] = images[text];
+        locale.background = renderer->compose_frame(renderer->bases_[0], lang);
+        composed.push_back(lang);
+    }
+    span.arg("langs", composed.size());
+
+    // Only the layers of these languages are flattened again, the digit
+    // tiles are kept where the label does not cover them
+    if (!composed.empty()) {
+        renderer->flatten_locales(composed);
+    }
+
+    for (auto& [scale, density]: renderer->densities_) {
+        density = density->with_label(jsvips::scale_countdown_options(options, scale), key);
+    }
+    return renderer;
+}
+
+std::shared_ptr<const CountdownRenderer> CountdownRenderer::with_digit_style(const CountdownOptions& options) const {
+    jsvips::TraceSpan span("update countdown digits");
+
+    auto renderer = std::make_shared<CountdownRenderer>(*this);
+    renderer->options_ = options;
+    renderer->render_digits();
+    renderer->flatten_digits();
+
+    for (auto& [scale, density]: renderer->densities_) {
+        density = density->with_digit_style(jsvips::scale_countdown_options(options, scale));
+    }
+    return renderer;
+}
+
+std::shared_ptr<const CountdownRenderer> CountdownRenderer::with_text(const TextMask& mask, int x, int y, const std::vector<u_char>& colour,
+                                                                     const std::string& key) const {
+    jsvips::TraceSpan span("draw countdown text");
+
+    auto renderer = std::make_shared<CountdownRenderer>(*this);
+    renderer->options_.fingerprint = jsvips::content_hash(this->options_.fingerprint + "\ntext\n" + key);
+    renderer->draw_on_backgrounds(mask(this->options_.scale), x, y, colour);
+
+    for (auto& [scale, density]: renderer->densities_) {
+        const double factor = scale / this->options_.scale;
+        auto scaled = std::make_shared<CountdownRenderer>(*density);
+        scaled->options_.fingerprint = renderer->options_.fingerprint + "@" + jsvips::scale_name(scale);
+        scaled->draw_on_backgrounds(mask(scale), static_cast<int>(x * factor + 0.5), static_cast<int>(y * factor + 0.5), colour);
+        density = scaled;
+    }
+    return renderer;
+}
+
+void CountdownRenderer::draw_on_backgrounds(const VImage& mask, int x, int y, const std::vector<u_char>& colour) {
+    for (VImage& base: this->bases_) {
+        base = jsvips::draw_text(base, mask, x, y, colour);
+    }
+    for (auto& [lang, locale]: this->locales_) {
+        locale.background = compose_frame(this->bases_[0], lang);
+    }
+    flatten();
+}
+
+const CountdownRenderer* CountdownRenderer::at_scale(double scale) const {
+    if (scale == this->options_.scale) {
+        return this;
+    }
+    for (const auto& [density, renderer]: this->densities_) {
+        if (density == scale) {
+            return renderer.get();
+        }
+    }
+    return nullptr;
+}
+
+const CountdownLocale* CountdownRenderer::find_locale(const std::string& lang) const {
+    // No language selects the first one
+    std::string key = lang;
+    if (key.empty() && !this->options_.langs.empty()) {
+        key = this->options_.langs.front();
+    }
+
+    auto it = this->locales_.find(key);
+    return it != this->locales_.end() ? &it->second : nullptr;
+}
+
+const VImage& CountdownRenderer::background() const {
+    return find_locale("")->background;
+}
+
+bool CountdownRenderer::encodes_gif(const CountdownRenderOptions& options) const {
+    return (this->indexed_ || options.lossy > 0) && (options.toFile.empty() || jsvips::has_extension(options.toFile, ".gif"));
+}
+
+VImage CountdownRenderer::render_animation(const std::vector<int> &duration, int frames, const CountdownLocale& locale) const {
+    jsvips::TraceSpan span("render countdown");
+    span.arg("frames", frames);
+
+    // Frames are copies of opaque tiles
+    if (this->flat_) {
+        return this->flat_->render(locale.layers, duration, frames, countdownFrameDelay);
+    }
+
+    int numFrames = jsvips::countdown_frames(frames, this->options_.height);
+
+    std::vector<VImage> pages;
+    std::vector<int> newDuration = duration;
+
+    std::vector<int> modes = {VipsBlendMode::VIPS_BLEND_MODE_OVER};
+
+    for (int i = 0; i < numFrames; i++) {
+
+        std::vector<VImage> subImages;
+        std::vector<int> xLabel;
+        std::vector<int> yLabel;
+        // Add background image, an animated one loops, and the labels of the language
+        subImages.push_back(this->bases_[i % this->bases_.size()]);
+        add_labels(locale.lang, subImages, xLabel, yLabel);
+
+        for (int j = 0; j < lengthOfCountdownMomentParts; j++) {
+            const Position2D& position = this->options_.digits.positions[j].position;
+            xLabel.push_back(position.x);
+            yLabel.push_back(position.y);
+            int digitValue = newDuration.at(j);
+            std::string k = countdownMomentPartNames[j];
+            subImages.push_back(this->digits_.at(digitValue));
+        }
+
+        // Build a frame
+        VImage page = VImage::composite(subImages, modes, VImage::option()->set("x", xLabel)->set("y", yLabel));
+        pages.push_back(page);
+
+        // Next frame
+        jsvips::countdown_minus_one_second(newDuration);
+    }
+
+    // Join a set of pages vertically to make a multipage image
+    VImage animation = VImage::arrayjoin(pages, VImage::option()->set("across", 1));
+    VImage gifData = animation.copy();
+    gifData.set("page-height", locale.background.height());
+
+    // frame delays are in milliseconds ... 300 is pretty slow!
+    std::vector<int> delayArray(pages.size(), countdownFrameDelay);
+    gifData.set("delay", delayArray);
+
+    return gifData;
+}
+
+std::vector<uint8_t> CountdownRenderer::render_gif(const std::vector<int>& start, int frames, const CountdownLocale& locale, int lossy,
+                                                   const std::function<bool()>& cancelled) const {
+    jsvips::TraceSpan span("render countdown gif");
+    span.arg("frames", frames);
+
+    if (this->indexed_) {
+        return this->indexed_->render(locale.layers, start, frames, countdownFrameDelay, lossy, cancelled);
+    }
+    // Quantized by this library, libvips has no lossy LZW
+    if (lossy > 0) {
+        return jsvips::write_gif(render_animation(start, frames, locale), lossy);
+    }
+
+    size_t size;
+    void* buf;
+    render_animation(start, frames, locale).write_to_buffer(".gif", &buf, &size);
+    std::vector<uint8_t> gif(static_cast<uint8_t*>(buf), static_cast<uint8_t*>(buf) + size);
+    g_free(buf);
+    return gif;
+}
+
+CountdownOutputs CountdownRenderer::render_outputs(const std::vector<int>& start, int frames, const CountdownLocale& locale,
+                                                  const CountdownRenderOptions& options, const std::function<bool()>& cancelled,
+                                                  const std::function<void(const VImage&)>& watch) const {
+    jsvips::TraceSpan span("render countdown outputs");
+    span.arg("frames", frames).arg("outputs", options.outputs.size());
+
+    const std::vector<std::string>& outputs = options.outputs;
+    if (outputs.empty()) {
+        return {};
+    }
+
+    // The palette-indexed GIF is assembled from its own tiles, every other
+    // output is encoded from one RGB composition
+    VImage animation;
+    const long composed = std::count_if(outputs.begin(), outputs.end(), [this](const std::string& output) {
+        return output != "gif" || !this->indexed_;
+    });
+    if (composed > 0) {
+        animation = render_animation(start, frames, locale);
+        if (watch) {
+            watch(animation);
+        }
+        // Without flat tiles the frames are a lazy composite, which every
+        // encoder would compute again: compute it once for all of them
+        if (composed > 1 && !this->flat_) {
+            jsvips::TraceSpan compose("compose frames");
+            animation = animation.copy_memory();
+        }
+    }
+
+    auto encode = [&](const std::string& output) {
+        if (output == "gif" && this->indexed_) {
+            return this->indexed_->render(locale.layers, start, frames, countdownFrameDelay, options.lossy, cancelled);
+        }
+        if (output == "gif" && options.lossy > 0) {
+            return jsvips::write_gif(animation, options.lossy);
+        }
+
+        VImage image = animation;
+        std::string suffix = "." + output;
+        if (output == "poster") {
+            image = animation.extract_area(0, 0, animation.width(), locale.background.height());
+            suffix = "." + options.posterFormat;
+        }
+
+        size_t size;
+        void* buf;
+        image.write_to_buffer(suffix.c_str(), &buf, &size);
+        std::vector<uint8_t> encoded(static_cast<uint8_t*>(buf), static_cast<uint8_t*>(buf) + size);
+        g_free(buf);
+        return encoded;
+    };
+
+    // One after the other on the thread of the caller: a render takes one
+    // slot of the scheduler, the libvips encoders have their own threads
+    CountdownOutputs result;
+    for (const std::string& output: outputs) {
+        result[output] = encode(output);
+    }
+    return result;
+}
+
+void CountdownRenderer::render_cached_outputs(const std::vector<int>& start, int frames, const CountdownLocale& locale,
+                                              CountdownRenderOptions options, CountdownOutputs& rendered, MappedOutputs& mapped,
+                                              const std::function<bool()>& cancelled,
+                                              const std::function<void(const VImage&)>& watch) const {
+    DiskCache& cache = DiskCache::shared();
+
+    std::vector<std::string> missing;
+    for (const std::string& output: options.outputs) {
+        std::shared_ptr<const MappedFile> file = cache.get(cache_key(start, frames, locale, options, output));
+        if (file) {
+            mapped[output] = file;
+        } else {
+            missing.push_back(output);
+        }
+    }
+    if (missing.empty()) {
+        return;
+    }
+
+    options.outputs = missing;
+    rendered = render_outputs(start, frames, locale, options, cancelled, watch);
+    for (const auto& [output, data]: rendered) {
+        cache.put(cache_key(start, frames, locale, options, output), data);
+    }
+}
+
+std::string CountdownRenderer::cache_key(const std::vector<int>& start, int frames, const CountdownLocale& locale,
+                                         const CountdownRenderOptions& options, const std::string& output) const {
+    // The resolved language: no language and the first one are the same files
+    std::string key = "countdown\n" + this->options_.fingerprint + "\n" + locale.lang + "\n";
+    for (int value: start) {
+        key += std::to_string(value) + ":";
+    }
+    key += "\n" + std::to_string(frames > 0 ? frames : 1) + "\n" + output;
+    if (output == "poster") {
+        key += "." + options.posterFormat;
+    }
+    // The two GIF encoders produce different files
+    if (output == "gif") {
+        key += this->indexed_ ? ".indexed" : options.lossy > 0 ? ".quantized" : ".vips";
+        if (options.lossy > 0) {
+            key += ".lossy" + std::to_string(options.lossy);
+        }
+    }
+    return key;
+}
+
+BufferPoolStats CountdownRenderer::pool_stats() const {
+    BufferPoolStats stats;
+    if (this->flat_) {
+        stats += this->flat_->pool_stats();
+    }
+    if (this->indexed_) {
+        stats += this->indexed_->pool_stats();
+    }
+    for (const auto& [scale, renderer]: this->densities_) {
+        stats += renderer->pool_stats();
+    }
+    return stats;
+}
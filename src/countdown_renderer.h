@@ -0,0 +1,153 @@
+#ifndef COUNTDOWN_RENDERER_H
+#define COUNTDOWN_RENDERER_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <vips/vips8>
+
+#include "buffer_pool.h"
+#include "disk_cache.h"
+#include "flat_countdown.h"
+#include "indexed_countdown.h"
+#include "render_options.h"
+
+// Encoded files of one render, by output name: gif, webp, poster
+using CountdownOutputs = std::map<std::string, std::vector<uint8_t>>;
+// Outputs read back from the disk cache, by output name
+using MappedOutputs = std::map<std::string, std::shared_ptr<const MappedFile>>;
+
+// Layers of a countdown template that depend on the language. The frames of
+// the background are shared, a language only adds its labels over them.
+struct CountdownLocale {
+    std::string lang;
+    // Background with the labels of the language, its first frame when it is animated
+    vips::VImage background;
+    // Layers of the language in the flattened templates, one per frame
+    std::vector<size_t> layers;
+};
+
+//
+// A compiled countdown template: the background frames, the labels of every
+// language, the digit images and their palette-indexed form. Immutable once built, it
+// is shared by the jobs rendering it.
+//
+class CountdownRenderer {
+  public:
+    explicit CountdownRenderer(const CountdownOptions& options);
+
+    const CountdownOptions& options() const { return options_; }
+
+    // The template at one of the scales of its options, nullptr for another
+    // scale. It lives as long as this template.
+    const CountdownRenderer* at_scale(double scale) const;
+
+    // Background of the default language
+    const vips::VImage& background() const;
+
+    // No language selects the default one, nullptr for an unknown language
+    const CountdownLocale* find_locale(const std::string& lang) const;
+
+    // Whether the GIF of a render is encoded by render_gif rather than by
+    // libvips: from palette indices, or lossy. toFile empty for a buffer.
+    bool encodes_gif(const CountdownRenderOptions& options) const;
+
+    const std::shared_ptr<const IndexedCountdown>& indexed() const { return indexed_; }
+
+    // The animation as a multipage image, one page per frame
+    vips::VImage render_animation(const std::vector<int>& start, int frames, const CountdownLocale& locale) const;
+
+    // Encoded GIF, by the palette-indexed path when possible. lossy: see
+    // GifEncoder. cancelled is polled between frames.
+    std::vector<uint8_t> render_gif(const std::vector<int>& start, int frames, const CountdownLocale& locale, int lossy = 0,
+                                    const std::function<bool()>& cancelled = nullptr) const;
+
+    // Compose the frames once and encode every output of options, one after
+    // the other on this thread. watch is given the composed animation before
+    // libvips evaluates it, so the caller can kill the pipelines.
+    CountdownOutputs render_outputs(const std::vector<int>& start, int frames, const CountdownLocale& locale,
+                                    const CountdownRenderOptions& options, const std::function<bool()>& cancelled = nullptr,
+                                    const std::function<void(const vips::VImage&)>& watch = nullptr) const;
+
+    // Serve the outputs of options from the disk cache, render the missing
+    // ones from one composition and store them
+    void render_cached_outputs(const std::vector<int>& start, int frames, const CountdownLocale& locale,
+                               CountdownRenderOptions options, CountdownOutputs& rendered, MappedOutputs& mapped,
+                               const std::function<bool()>& cancelled = nullptr,
+                               const std::function<void(const vips::VImage&)>& watch = nullptr) const;
+
+    // Key of an output in the disk cache: the template document, the
+    // language of locale, the moment, the frames and the encoding
+    std::string cache_key(const std::vector<int>& start, int frames, const CountdownLocale& locale,
+                          const CountdownRenderOptions& options, const std::string& output) const;
+
+    // A copy of this template with the label key of options replaced or
+    // added, options being the options of this template after
+    // set_countdown_label. Only that label is rendered again, the background
+    // frames are kept, and the digit tiles are kept where the label does not
+    // cover them.
+    std::shared_ptr<const CountdownRenderer> with_label(const CountdownOptions& options, const std::string& key) const;
+
+    // A copy of this template with the digits of options, the options of this
+    // template after set_countdown_digit_style. The backgrounds are kept.
+    std::shared_ptr<const CountdownRenderer> with_digit_style(const CountdownOptions& options) const;
+
+    // The mask of a text at a density, see with_text
+    using TextMask = std::function<vips::VImage(double scale)>;
+
+    // A copy of this template with a text drawn in colour (RGB) over every
+    // frame of its background, under the labels and the digits. x and y are
+    // at the density of this template, key identifies the text in the
+    // fingerprint. The digit tiles are kept where the text does not reach them.
+    std::shared_ptr<const CountdownRenderer> with_text(const TextMask& mask, int x, int y, const std::vector<u_char>& colour,
+                                                       const std::string& key) const;
+
+    // Frame buffers reused by the renders of this template
+    BufferPoolStats pool_stats() const;
+
+  private:
+    // The template at the density of options, its background decoded into
+    // source by the template at the first density
+    CountdownRenderer(const CountdownOptions& options, const vips::VImage& source);
+
+    // Render the 100 digit images
+    void render_digits();
+    // Blend a text mask over the background frames, then compose and flatten again
+    void draw_on_backgrounds(const vips::VImage& mask, int x, int y, const std::vector<u_char>& colour);
+    // Flatten the digits onto the backgrounds of the locales, see
+    // FlatCountdown::build. The tiles and palette indices of the flattened
+    // template this one was copied from are reused where they still apply.
+    void flatten();
+    // Flatten again only the layers of langs, whose labels changed
+    void flatten_locales(const std::vector<std::string>& langs);
+    // Flatten the digits again, the backgrounds and labels are kept
+    void flatten_digits();
+    // The layers of lang to flatten, by layer index
+    std::vector<std::pair<size_t, FlatCountdown::Source>> flat_sources(const std::string& lang) const;
+    // Top left corners of the digit parts
+    void digit_positions(std::vector<int>& x, std::vector<int>& y) const;
+    // Append the labels of lang and their positions to a composition
+    void add_labels(const std::string& lang, std::vector<vips::VImage>& images, std::vector<int>& x, std::vector<int>& y) const;
+    // A frame of the background with the labels of lang, composed when it is evaluated
+    vips::VImage compose_frame(const vips::VImage& base, const std::string& lang) const;
+
+    CountdownOptions options_;
+    // Frames of the background without the labels, shared by the languages
+    std::vector<vips::VImage> bases_;
+    // Label images by key and language
+    std::map<std::string, std::map<std::string, vips::VImage>> labels_;
+    std::vector<vips::VImage> digits_;
+    std::map<std::string, CountdownLocale> locales_;
+    // Digits flattened onto the backgrounds, null when they could not be
+    std::shared_ptr<const FlatCountdown> flat_;
+    // Null when the template has more than 256 colours
+    std::shared_ptr<const IndexedCountdown> indexed_;
+    // The template at the other scales
+    std::vector<std::pair<double, std::shared_ptr<const CountdownRenderer>>> densities_;
+};
+
+#endif
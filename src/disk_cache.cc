@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "disk_cache.h"
+#include "trace.h"
+#include "utils.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Bumped when the content of the renders changes for the same key
+const char* cacheVersion = "2";
+// Rescan the directory after this many writes, other processes change its size
+const int scanInterval = 64;
+
+// Files in the fan-out directories: mtime, size, path
+struct CachedFile {
+    fs::file_time_type mtime;
+    uintmax_t size;
+    fs::path path;
+};
+
+std::vector<CachedFile> list_files(const std::string& directory) {
+    std::vector<CachedFile> files;
+    std::error_code ec;
+    for (auto it = fs::recursive_directory_iterator(directory, ec); !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        std::error_code fileError;
+        // Files being written, not in the cache yet
+        if (it.depth() == 0 && it->path().filename() == "tmp") {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file(fileError)) {
+            continue;
+        }
+        CachedFile file {it->last_write_time(fileError), it->file_size(fileError), it->path()};
+        if (!fileError) {
+            files.push_back(std::move(file));
+        }
+    }
+    return files;
+}
+
+}
+
+MappedFile::~MappedFile() {
+    munmap(this->data_, this->size_);
+}
+
+DiskCache& DiskCache::shared() {
+    // Never destroyed: buffers of mapped files may outlive the module
+    static DiskCache* cache = new DiskCache();
+    return *cache;
+}
+
+void DiskCache::configure(const std::string& directory, size_t maxBytes) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->directory_ = directory;
+    this->maxBytes_ = maxBytes;
+    this->enabled_ = !directory.empty();
+    if (directory.empty()) {
+        return;
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(directory) / "tmp", ec);
+    if (ec) {
+        this->enabled_ = false;
+        throw std::runtime_error("Unable to create the cache directory " + directory + ": " + ec.message());
+    }
+
+    this->bytes_ = 0;
+    for (const CachedFile& file: list_files(directory)) {
+        this->bytes_ += file.size;
+    }
+    this->writesSinceScan_ = 0;
+}
+
+std::string DiskCache::path_of(const std::string& key) const {
+    std::string hash = jsvips::content_hash(std::string(cacheVersion) + "\n" + key);
+    return (fs::path(this->directory_) / hash.substr(0, 2) / hash).string();
+}
+
+std::shared_ptr<const MappedFile> DiskCache::get(const std::string& key) {
+    if (!enabled()) {
+        return nullptr;
+    }
+    jsvips::TraceSpan span("disk cache get");
+
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        path = path_of(key);
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stats_.misses++;
+        return nullptr;
+    }
+
+    // Private writable mapping: JS may write into the buffer, the file stays as it is
+    void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stats_.misses++;
+        return nullptr;
+    }
+
+    // Recently used for the cleanup of every process
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->stats_.hits++;
+    span.arg("bytes", static_cast<double>(st.st_size));
+    return std::make_shared<MappedFile>(static_cast<uint8_t*>(data), static_cast<size_t>(st.st_size));
+}
+
+int DiskCache::open_file(const std::string& key) const {
+    if (!enabled()) {
+        return -1;
+    }
+
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        path = path_of(key);
+    }
+    return open(path.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+void DiskCache::put(const std::string& key, const std::vector<uint8_t>& data) {
+    if (!enabled() || data.empty()) {
+        return;
+    }
+    jsvips::TraceSpan span("disk cache put");
+    span.arg("bytes", static_cast<double>(data.size()));
+
+    static std::atomic<uint64_t> counter {0};
+    std::string path;
+    std::string tmp;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (data.size() > this->maxBytes_) {
+            return;
+        }
+        path = path_of(key);
+        tmp = (fs::path(this->directory_) / "tmp" / (std::to_string(getpid()) + "-" + std::to_string(counter++))).string();
+    }
+
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    try {
+        jsvips::write_file(tmp, data);
+    } catch (const std::exception&) {
+        fs::remove(tmp, ec);
+        return;
+    }
+    // Atomic on POSIX, a concurrent writer of the same key writes the same bytes
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fs::remove(tmp, ec);
+        return;
+    }
+
+    bool over;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stats_.writes++;
+        this->bytes_ += data.size();
+        over = this->bytes_ > this->maxBytes_ || ++this->writesSinceScan_ >= scanInterval;
+    }
+    if (over) {
+        trim();
+    }
+}
+
+void DiskCache::trim() {
+    std::string directory;
+    size_t maxBytes;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        directory = this->directory_;
+        maxBytes = this->maxBytes_;
+    }
+
+    std::vector<CachedFile> files = list_files(directory);
+    size_t bytes = 0;
+    for (const CachedFile& file: files) {
+        bytes += file.size;
+    }
+
+    uint64_t evictions = 0;
+    const size_t target = maxBytes / 10 * 9;
+    if (bytes > maxBytes) {
+        std::sort(files.begin(), files.end(), [](const CachedFile& a, const CachedFile& b) { return a.mtime < b.mtime; });
+        for (const CachedFile& file: files) {
+            if (bytes <= target) {
+                break;
+            }
+            // Mapped copies stay valid after the file is removed
+            std::error_code ec;
+            if (fs::remove(file.path, ec)) {
+                bytes -= std::min<size_t>(bytes, file.size);
+                evictions++;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->bytes_ = bytes;
+    this->writesSinceScan_ = 0;
+    this->stats_.evictions += evictions;
+}
+
+DiskCacheStats DiskCache::stats() const {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    DiskCacheStats stats = this->stats_;
+    stats.bytes = this->bytes_;
+    stats.maxBytes = this->maxBytes_;
+    return stats;
+}
@@ -0,0 +1,81 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct DiskCacheStats {
+    uint64_t hits {0};
+    uint64_t misses {0};
+    uint64_t writes {0};
+    uint64_t evictions {0};
+    // Size of the cache directory when this process last scanned it, plus its own writes since
+    size_t bytes {0};
+    size_t maxBytes {0};
+};
+
+// A cached file mapped copy-on-write: writes to the memory never reach the file
+class MappedFile {
+  public:
+    MappedFile(uint8_t* data, size_t size): data_(data), size_(size) {}
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    uint8_t* data_;
+    size_t size_;
+};
+
+//
+// Content-addressed cache of rendered files in a directory shared by the
+// processes of a host. A file is named by the hash of its key, written to a
+// temporary file and renamed into place, so readers never see a partial
+// file. Reads map the file and touch its mtime, and the cleanup removes the
+// files with the oldest mtime once the directory is over its size cap.
+//
+class DiskCache {
+  public:
+    static DiskCache& shared();
+
+    // An empty directory turns the cache off. Creates the directory.
+    // Throws std::runtime_error when it cannot be created.
+    void configure(const std::string& directory, size_t maxBytes);
+    bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    // nullptr when the key is not cached or the cache is off
+    std::shared_ptr<const MappedFile> get(const std::string& key);
+    // Failures are ignored, the cache is an optimization
+    void put(const std::string& key, const std::vector<uint8_t>& data);
+
+    // A read-only descriptor of the cached file of key, -1 when it is not
+    // cached. A cached file is never written again, a new version is renamed
+    // over it.
+    int open_file(const std::string& key) const;
+
+    DiskCacheStats stats() const;
+
+  private:
+    std::string path_of(const std::string& key) const;
+    // Remove the least recently used files until the directory is under 90% of the cap
+    void trim();
+
+    mutable std::mutex mutex_;
+    std::atomic<bool> enabled_ {false};
+    std::string directory_;
+    size_t maxBytes_ {0};
+    size_t bytes_ {0};
+    // Writes since the last scan, the other processes write too
+    int writesSinceScan_ {0};
+    DiskCacheStats stats_;
+};
+
+#endif
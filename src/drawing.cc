@@ -0,0 +1,195 @@
+#include <cstdio>
+#include <stdexcept>
+
+#include "drawing.h"
+
+using namespace vips;
+
+namespace jsvips {
+
+VImage create_rgb_image(const CreationOptions& options) {
+    std::vector<u_char> bgColor = hexadecimal_color_to_argb(options.bgColor);
+    std::vector<double> channels = {(double)bgColor[1], (double)bgColor[2], (double)bgColor[3]};
+
+    // full image.
+    VImage emptyImage = VImage::black(options.width,options.height, VImage::option()->set("bands", 3)) + channels;
+    VImage formatted = emptyImage.cast(VipsBandFormat::VIPS_FORMAT_UCHAR).copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB));
+
+    return formatted;
+}
+
+VImage decode_background(const CountdownOptions& options) {
+    if (options.background.empty()) {
+        return VImage();
+    }
+
+    // Every page of an animation
+    VImage source = options.background.data
+        ? VImage::new_from_buffer(options.background.data->data(), options.background.data->size(), "", VImage::option()->set("n", -1))
+        : VImage::new_from_file(options.background.file.c_str(), VImage::option()->set("n", -1));
+    const int pages = source.height() / vips_image_get_page_height(source.get_image());
+    if (pages > maxBackgroundFrames) {
+        throw std::invalid_argument("The background has more than " + std::to_string(maxBackgroundFrames) + " frames");
+    }
+    return source.copy_memory();
+}
+
+std::vector<VImage> background_frames(const CountdownOptions& options, const VImage& source) {
+    if (options.background.empty()) {
+        return {create_rgb_image(options).copy_memory()};
+    }
+
+    const int pageHeight = vips_image_get_page_height(source.get_image());
+    const int pages = source.height() / pageHeight;
+
+    std::vector<u_char> bgColor = hexadecimal_color_to_argb(options.bgColor);
+    std::vector<double> fill = {(double)bgColor[1], (double)bgColor[2], (double)bgColor[3]};
+
+    std::vector<VImage> frames;
+    for (int page = 0; page < pages; page++) {
+        VImage frame = source.extract_area(0, page * pageHeight, source.width(), pageHeight).colourspace(VIPS_INTERPRETATION_sRGB);
+        if (frame.has_alpha()) {
+            frame = frame.flatten(VImage::option()->set("background", fill));
+        }
+
+        // Cover the canvas, cropping what sticks out around the centre
+        frame = frame.thumbnail_image(options.width, VImage::option()
+            ->set("height", options.height)
+            ->set("crop", VIPS_INTERESTING_CENTRE));
+        frames.push_back(frame.cast(VIPS_FORMAT_UCHAR).copy_memory());
+    }
+    return frames;
+}
+
+VImage colored_text_image(const std::string &text, const ColoredTextOptions& options) {
+    auto genOpts = VImage::option();
+    if (options.font.size() > 0) {
+//        std::cout << "font " << options.font << std::endl;
+        genOpts->set("font", options.font.c_str());
+    }
+
+    if (options.fontFile.size() > 0) {
+        genOpts->set("fontfile", options.fontFile.c_str());
+    }
+
+    if (options.dpi > 0) {
+        genOpts->set("dpi", options.dpi);
+    }
+
+    VImage textAlpha = VImage::text(text.c_str(), genOpts);
+
+    // Do subtle adjustment to the image for alignment
+    if (options.paddingBottom > 0 || options.paddingTop > 0) {
+        int newHeight = textAlpha.height() + options.paddingTop + options.paddingBottom;
+        int newWidth = textAlpha.width();
+
+        // use default VIPS_EXTEND_BLACK option
+        textAlpha = textAlpha.embed(0, options.paddingTop, newWidth, newHeight);
+    }
+
+//    std::cout << "render " << text << " xoffset " << textAlpha.xoffset() << " yoffset " << textAlpha.yoffset() << " width " << textAlpha.width() << " height " << textAlpha.height() << std::endl;
+    if (options.width > 0 || options.height > 0) {
+        int outWidth = options.width > 0 ? options.width : textAlpha.width();
+        int outHeight = options.height > 0 ? options.height : textAlpha.height();
+
+        if (outWidth < textAlpha.width() ) {
+            printf("width value [%d] is smaller than the size of text [%d] and reset to text width\n", outWidth, textAlpha.width());
+            outWidth = textAlpha.width();
+        }
+
+        if (outHeight < textAlpha.height() ) {
+            printf("height value [%d] is smaller than the size of text [%d] and reset to text height\n", outHeight, textAlpha.height());
+            outHeight = textAlpha.height();
+        }
+
+        textAlpha = textAlpha.gravity(options.textAlignment, outWidth, outHeight);
+
+    }
+
+    // make a constant image the size of $text, but with every pixel red ... tag it
+    // as srgb
+    const std::vector<double> textColor = {(double)options.textColor[0], (double)options.textColor[1], (double)options.textColor[2]};
+    VImage coloredImage = textAlpha.new_from_image(textColor).copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB)).bandjoin(textAlpha);
+//    std::cout << "return " << text << " xoffset " << coloredImage.xoffset() << " yoffset " << coloredImage.yoffset() << std::endl;
+    return coloredImage;
+}
+
+ColoredTextOptions text_options(const CountdownComponentStyle& style, int paddingTop, int paddingBottom, double scale) {
+    ColoredTextOptions options;
+    options.textColor = hexadecimal_color_to_argb(style.color);
+    options.font = style.font;
+    options.fontFile = style.fontFile;
+    options.width = style.width;
+    options.height = style.height;
+    options.textAlignment = style.textAlignment;
+    options.paddingTop = paddingTop;
+    options.paddingBottom = paddingBottom;
+    if (scale != 1) {
+        options.dpi = static_cast<int>(72 * scale + 0.5);
+    }
+    return options;
+}
+
+/**
+ * Convert hex color string to RGB
+ * 
+ * Allowed formats:
+ * [#]RGB
+ * [#]ARGB
+ * [#]RRGGBB
+ * [#]AARRGGBB
+ *
+ * @param hex color hex string, should be start with "#" and the rest length is 3, 4, 6 or 8 characters
+ * @return array a decimal ARGB array, return black if the hex string is invalid
+ * 
+ */
+std::vector<u_char> hexadecimal_color_to_argb(const std::string& hex) {
+    const std::vector<u_char> defaultColor = {0, 0, 0, 0};
+    if (hex.length() == 0) {
+        return defaultColor;
+    }
+
+    if (hex.length() != 4 && hex.length() != 5 && hex.length() != 7 && hex.length() != 9) {
+        return defaultColor;
+    }
+
+    if (hex.at(0) != '#') {
+        return defaultColor;
+    }
+
+    std::string a,r,g,b;
+    int withAlpha = 0;
+
+    if (hex.length() == 4 || hex.length() == 5) {
+        if ( hex.length() == 5 ) {
+            withAlpha = 1;
+            a = hex.substr(1, 1);
+        } else {
+            a = "FF";
+        }
+
+        r = hex.substr(1 + withAlpha, 1) + hex.substr(1 + withAlpha, 1);
+        g = hex.substr(2 + withAlpha, 1) + hex.substr(2 + withAlpha, 1);
+        b = hex.substr(3 + withAlpha, 1) + hex.substr(3 + withAlpha, 1);
+    } else if (hex.length() == 7 || hex.length() == 9) {
+        if ( hex.length() == 9 ) {
+            withAlpha = 1;
+            a = hex.substr(1, 2);
+        } else {
+            a = "FF";
+        }
+        r = hex.substr(1 + 2*withAlpha, 2);
+        g = hex.substr(3 + 2*withAlpha, 2);
+        b = hex.substr(5 + 2*withAlpha, 2);
+    }
+
+    // convert hex to decimal
+    u_char alpha = std::stoi(a, nullptr, 16);
+    u_char red = std::stoi(r, nullptr, 16);
+    u_char green = std::stoi(g, nullptr, 16);
+    u_char blue = std::stoi(b, nullptr, 16);
+
+    return {alpha, red, green, blue};
+}
+
+}
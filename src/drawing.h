@@ -0,0 +1,37 @@
+#ifndef DRAWING_H
+#define DRAWING_H
+
+#include <string>
+#include <vector>
+#include <vips/vips8>
+
+#include "render_options.h"
+
+namespace jsvips {
+
+    // An opaque sRGB image filled with the background color
+    vips::VImage create_rgb_image(const CreationOptions& options);
+
+    // Every page of the background image or animation of a countdown, decoded
+    // into memory once for all the densities of the template. An empty image
+    // when the countdown has no background.
+    vips::VImage decode_background(const CountdownOptions& options);
+
+    // Frames of the background of a countdown, opaque sRGB images of the
+    // canvas size held in memory. The pages of source, decode_background of
+    // the options at any density, are scaled to cover the canvas. Without a
+    // background the single frame is bgColor.
+    std::vector<vips::VImage> background_frames(const CountdownOptions& options, const vips::VImage& source);
+
+    // Text as sRGB + alpha, laid out in the box of the options
+    vips::VImage colored_text_image(const std::string& text, const ColoredTextOptions& options);
+
+    // Text options of a component. scale is the density of the template, the
+    // text is rendered at 72 * scale dpi.
+    ColoredTextOptions text_options(const CountdownComponentStyle& style, int paddingTop = 0, int paddingBottom = 0, double scale = 1);
+
+    std::vector<u_char> hexadecimal_color_to_argb(const std::string& hex);
+
+}
+
+#endif
@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "flat_countdown.h"
+#include "render_options.h"
+#include "trace.h"
+
+using namespace vips;
+
+namespace {
+
+// Memory a template may hold as RGB background frames, beyond it the frames
+// are composed by libvips
+const size_t maxBackgroundBytes = 128 * 1024 * 1024;
+// Memory of the digit tiles of a template, beyond it the digits of the other
+// layers are blended per frame
+const size_t maxTileBytes = 64 * 1024 * 1024;
+
+using Pixels = std::unique_ptr<uint8_t, decltype(&g_free)>;
+
+// Pixels of an image as interleaved uchar bands
+Pixels uchar_pixels(const VImage& image) {
+    size_t size;
+    void* data = image.cast(VIPS_FORMAT_UCHAR).write_to_memory(&size);
+    return {static_cast<uint8_t*>(data), &g_free};
+}
+
+// The image is opaque, drop the alpha band the composite may have added.
+// Returns false for an image that is not sRGB.
+bool opaque_rgb(const VImage& image, VImage& rgb) {
+    rgb = image.bands() > 3 ? image.extract_band(0, VImage::option()->set("n", 3)) : image;
+    return rgb.bands() == 3;
+}
+
+bool overlap(const FlatCountdown::Area& a, const FlatCountdown::Area& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+}
+
+std::shared_ptr<FlatCountdown> FlatCountdown::build(const std::vector<VImage>& backgrounds, const std::vector<Source>& layers,
+                                                    const std::vector<VImage>& digits,
+                                                    const std::vector<int>& x, const std::vector<int>& y,
+                                                    const FlatCountdown* previous) {
+    if (backgrounds.empty() || layers.empty()) {
+        return nullptr;
+    }
+
+    auto flat = std::make_shared<FlatCountdown>();
+    const int width = flat->width_ = backgrounds[0].width();
+    const int height = flat->height_ = backgrounds[0].height();
+    const size_t canvasBytes = static_cast<size_t>(width) * height * 3;
+    if (canvasBytes * backgrounds.size() > maxBackgroundBytes || !flat->set_digits(digits, x, y)) {
+        return nullptr;
+    }
+
+    // The frames of the background, shared by the layers
+    for (const VImage& background: backgrounds) {
+        VImage rgb;
+        if (background.width() != width || background.height() != height || !opaque_rgb(background, rgb)) {
+            return nullptr;
+        }
+        Pixels pixels = uchar_pixels(rgb);
+        flat->backgrounds_.push_back(std::make_shared<const Canvas>(pixels.get(), pixels.get() + canvasBytes));
+    }
+
+    // The tile sets of the previous build are reused where the pixels under
+    // the digits did not change
+    const TileSets* reuse = previous && previous->width_ == width && previous->height_ == height ? &previous->tileSets_ : nullptr;
+    Canvas canvas(canvasBytes);
+    for (const Source& source: layers) {
+        Layer layer;
+        if (!flat->make_layer(source, layer)) {
+            return nullptr;
+        }
+        flat->assign_tiles(layer, canvas, reuse);
+        flat->layers_.push_back(std::move(layer));
+    }
+
+    flat->pages_ = BufferPool::create(canvasBytes);
+    return flat;
+}
+
+std::shared_ptr<FlatCountdown> FlatCountdown::with_layers(const std::vector<std::pair<size_t, Source>>& layers) const {
+    auto flat = std::make_shared<FlatCountdown>(*this);
+    for (const auto& [index, source]: layers) {
+        if (index >= flat->layers_.size() || !flat->make_layer(source, flat->layers_[index])) {
+            return nullptr;
+        }
+    }
+
+    // The tiles of the replaced layers leave the budget before the new
+    // layers look for theirs
+    flat->prune_tiles();
+    Canvas canvas(static_cast<size_t>(this->width_) * this->height_ * 3);
+    for (const auto& [index, source]: layers) {
+        flat->assign_tiles(flat->layers_[index], canvas, &this->tileSets_);
+    }
+    return flat;
+}
+
+std::shared_ptr<FlatCountdown> FlatCountdown::with_digits(const std::vector<VImage>& digits,
+                                                          const std::vector<int>& x, const std::vector<int>& y) const {
+    auto flat = std::make_shared<FlatCountdown>(*this);
+    if (!flat->set_digits(digits, x, y)) {
+        return nullptr;
+    }
+
+    flat->tileSets_.clear();
+    Canvas canvas(static_cast<size_t>(this->width_) * this->height_ * 3);
+    for (Layer& layer: flat->layers_) {
+        flat->assign_tiles(layer, canvas, nullptr);
+    }
+    return flat;
+}
+
+bool FlatCountdown::set_digits(const std::vector<VImage>& digits, const std::vector<int>& x, const std::vector<int>& y) {
+    // Digits are sRGB + alpha text images
+    auto glyphs = std::make_shared<std::vector<Glyph>>();
+    for (const VImage& digit: digits) {
+        if (digit.bands() != 4) {
+            return false;
+        }
+        Glyph glyph;
+        glyph.width = digit.width();
+        glyph.height = digit.height();
+        Pixels pixels = uchar_pixels(digit);
+        glyph.pixels.assign(pixels.get(), pixels.get() + static_cast<size_t>(glyph.width) * glyph.height * 4);
+        glyphs->push_back(std::move(glyph));
+    }
+    this->digits_ = glyphs;
+
+    const size_t parts = std::min(x.size(), y.size());
+    this->x_.assign(x.begin(), x.begin() + parts);
+    this->y_.assign(y.begin(), y.begin() + parts);
+
+    this->areas_.assign(parts, Area());
+    for (size_t part = 0; part < parts; part++) {
+        int right = 0;
+        int bottom = 0;
+        for (const Glyph& digit: *glyphs) {
+            right = std::max(right, x[part] + digit.width);
+            bottom = std::max(bottom, y[part] + digit.height);
+        }
+        Area& area = this->areas_[part];
+        area.x = std::max(0, x[part]);
+        area.y = std::max(0, y[part]);
+        area.width = std::max(0, std::min(this->width_, right) - area.x);
+        area.height = std::max(0, std::min(this->height_, bottom) - area.y);
+    }
+
+    this->overlapping_ = false;
+    for (size_t a = 0; a < parts; a++) {
+        for (size_t b = a + 1; b < parts; b++) {
+            this->overlapping_ = this->overlapping_ || overlap(this->areas_[a], this->areas_[b]);
+        }
+    }
+    return true;
+}
+
+bool FlatCountdown::make_layer(const Source& source, Layer& layer) const {
+    VImage image;
+    if (source.background >= this->backgrounds_.size() || source.image.width() != this->width_ ||
+        source.image.height() != this->height_ || !opaque_rgb(source.image, image)) {
+        return false;
+    }
+
+    layer.background = source.background;
+    layer.tiles = nullptr;
+
+    // Only the areas the layer draws are kept, clipped to the canvas
+    auto patches = std::make_shared<std::vector<Tile>>();
+    for (const Area& area: source.areas) {
+        Tile patch;
+        patch.x = std::max(0, area.x);
+        patch.y = std::max(0, area.y);
+        patch.width = std::min(this->width_, area.x + area.width) - patch.x;
+        patch.height = std::min(this->height_, area.y + area.height) - patch.y;
+        if (patch.width <= 0 || patch.height <= 0) {
+            continue;
+        }
+        Pixels pixels = uchar_pixels(image.extract_area(patch.x, patch.y, patch.width, patch.height));
+        patch.pixels.assign(pixels.get(), pixels.get() + static_cast<size_t>(patch.width) * patch.height * 3);
+        patches->push_back(std::move(patch));
+    }
+    layer.patches = patches;
+    return true;
+}
+
+void FlatCountdown::assign_tiles(Layer& layer, Canvas& canvas, const TileSets* reuse) {
+    layer.tiles = nullptr;
+    if (this->overlapping_) {
+        return;
+    }
+
+    compose(layer, canvas.data());
+    std::vector<uint8_t> key = under_digits(canvas.data());
+    auto it = this->tileSets_.find(key);
+    if (it != this->tileSets_.end()) {
+        layer.tiles = it->second;
+        return;
+    }
+
+    // Every tile set holds each digit of each part
+    size_t tileSetBytes = 0;
+    for (size_t part = 0; part < this->x_.size(); part++) {
+        for (size_t d = 0; d < this->digits_->size(); d++) {
+            const Area area = digit_area(part, d);
+            tileSetBytes += static_cast<size_t>(area.width) * area.height * 3;
+        }
+    }
+    if ((this->tileSets_.size() + 1) * tileSetBytes > maxTileBytes) {
+        return;
+    }
+
+    std::shared_ptr<const TileSet> tiles;
+    if (reuse) {
+        auto reused = reuse->find(key);
+        if (reused != reuse->end()) {
+            tiles = reused->second;
+        }
+    }
+    if (!tiles) {
+        tiles = flatten(canvas.data());
+    }
+    layer.tiles = this->tileSets_.emplace(std::move(key), tiles).first->second;
+}
+
+void FlatCountdown::prune_tiles() {
+    for (auto it = this->tileSets_.begin(); it != this->tileSets_.end();) {
+        const bool used = std::any_of(this->layers_.begin(), this->layers_.end(), [&](const Layer& layer) {
+            return layer.tiles == it->second;
+        });
+        it = used ? std::next(it) : this->tileSets_.erase(it);
+    }
+}
+
+std::vector<uint8_t> FlatCountdown::under_digits(const uint8_t* canvas) const {
+    std::vector<uint8_t> key;
+    for (const Area& area: this->areas_) {
+        for (int row = area.y; row < area.y + area.height; row++) {
+            const uint8_t* begin = canvas + (static_cast<size_t>(row) * this->width_ + area.x) * 3;
+            key.insert(key.end(), begin, begin + area.width * 3);
+        }
+    }
+    return key;
+}
+
+std::shared_ptr<const FlatCountdown::TileSet> FlatCountdown::flatten(const uint8_t* canvas) const {
+    const size_t parts = this->x_.size();
+    auto tiles = std::make_shared<TileSet>(parts, std::vector<Tile>(this->digits_->size()));
+    for (size_t part = 0; part < parts; part++) {
+        for (size_t d = 0; d < this->digits_->size(); d++) {
+            Tile& tile = (*tiles)[part][d];
+            static_cast<Area&>(tile) = digit_area(part, d);
+            tile.pixels.resize(static_cast<size_t>(tile.width) * tile.height * 3);
+            blend(part, d, tile, canvas, tile.pixels.data(), static_cast<size_t>(tile.width) * 3);
+        }
+    }
+    return tiles;
+}
+
+FlatCountdown::Area FlatCountdown::digit_area(size_t part, size_t digit) const {
+    const Glyph& glyph = this->digits_->at(digit);
+    Area area;
+    area.x = std::max(0, this->x_[part]);
+    area.y = std::max(0, this->y_[part]);
+    area.width = std::max(0, std::min(this->width_, this->x_[part] + glyph.width) - area.x);
+    area.height = std::max(0, std::min(this->height_, this->y_[part] + glyph.height) - area.y);
+    return area;
+}
+
+void FlatCountdown::blend(size_t part, size_t digit, const Area& area, const uint8_t* canvas, uint8_t* out, size_t outStride) const {
+    const Glyph& glyph = (*this->digits_)[digit];
+    for (int row = 0; row < area.height; row++) {
+        const uint8_t* fg = glyph.pixels.data() + (static_cast<size_t>(area.y - this->y_[part] + row) * glyph.width + (area.x - this->x_[part])) * 4;
+        const uint8_t* under = canvas + (static_cast<size_t>(area.y + row) * this->width_ + area.x) * 3;
+        uint8_t* pixel = out + row * outStride;
+
+        for (int col = 0; col < area.width; col++, fg += 4, under += 3, pixel += 3) {
+            const int a = fg[3];
+            for (int band = 0; band < 3; band++) {
+                pixel[band] = static_cast<uint8_t>((fg[band] * a + under[band] * (255 - a) + 127) / 255);
+            }
+        }
+    }
+}
+
+void FlatCountdown::compose(const Layer& layer, uint8_t* canvas) const {
+    const size_t stride = static_cast<size_t>(this->width_) * 3;
+    std::memcpy(canvas, this->backgrounds_.at(layer.background)->data(), stride * this->height_);
+
+    for (const Tile& patch: *layer.patches) {
+        const size_t rowBytes = static_cast<size_t>(patch.width) * 3;
+        for (int row = 0; row < patch.height; row++) {
+            std::memcpy(canvas + (patch.y + row) * stride + patch.x * 3, patch.pixels.data() + row * rowBytes, rowBytes);
+        }
+    }
+}
+
+void FlatCountdown::draw(size_t layer, const std::vector<int>& moment, uint8_t* canvas) const {
+    const size_t stride = static_cast<size_t>(this->width_) * 3;
+    if (!this->layers_.at(layer).tiles) {
+        // In part order, a later part shows over an earlier one it overlaps
+        for (size_t part = 0; part < this->x_.size(); part++) {
+            const size_t digit = static_cast<size_t>(moment.at(part));
+            const Area area = digit_area(part, digit);
+            blend(part, digit, area, canvas, canvas + area.y * stride + area.x * 3, stride);
+        }
+        return;
+    }
+
+    const TileSet& tiles = *this->layers_.at(layer).tiles;
+
+    for (size_t part = 0; part < tiles.size(); part++) {
+        const Tile& tile = tiles[part].at(moment.at(part));
+        const size_t rowBytes = static_cast<size_t>(tile.width) * 3;
+        for (int row = 0; row < tile.height; row++) {
+            std::memcpy(canvas + (tile.y + row) * stride + tile.x * 3, tile.pixels.data() + row * rowBytes, rowBytes);
+        }
+    }
+}
+
+VImage FlatCountdown::render(const std::vector<size_t>& layers, const std::vector<int>& start, int frames, int delay) const {
+    const size_t frameBytes = static_cast<size_t>(this->width_) * this->height_ * 3;
+    const int numFrames = jsvips::countdown_frames(frames, this->height_);
+
+    jsvips::TraceSpan span("assemble frames");
+    span.arg("frames", numFrames).arg("pixels", static_cast<double>(frameBytes / 3) * numFrames);
+
+    BufferPool::Buffer pages = this->pages_->acquire(numFrames);
+    std::vector<int> moment = start;
+    for (int frame = 0; frame < numFrames; frame++) {
+        const size_t layer = layers.at(frame % layers.size());
+        uint8_t* canvas = pages.data() + frame * frameBytes;
+        compose(this->layers_.at(layer), canvas);
+        draw(layer, moment, canvas);
+        jsvips::countdown_minus_one_second(moment);
+    }
+
+    VImage animation = BufferPool::wrap(std::move(pages), this->width_, this->height_ * numFrames, 3);
+    VImage gifData = animation.copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB));
+    gifData.set("page-height", this->height_);
+    gifData.set("delay", std::vector<int>(numFrames, delay));
+    return gifData;
+}
@@ -0,0 +1,171 @@
+#ifndef FLAT_COUNTDOWN_H
+#define FLAT_COUNTDOWN_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <vips/vips8>
+
+#include "buffer_pool.h"
+
+//
+// Countdown frames assembled from opaque RGB tiles.
+//
+// The background under a digit never changes, so at template init every
+// digit is flattened once onto the patch of background it covers. A frame is
+// then a copy of the background with up to four tile rectangles copied over
+// it row by row: no alpha blending per frame.
+//
+// A template may have several layers (one per locale and frame of an
+// animated background). The frames of the background are kept once, a layer
+// only holds the patches its locale draws over them, i.e. the labels. The
+// tiles are shared by layers that are identical under the digits.
+//
+// Tiles are kept up to a memory budget: the layers past it, and every layer
+// when the parts overlap, have no tiles and blend the digits onto each frame
+// instead, which is still a fraction of a libvips composite.
+//
+// An update of some layers, or of the digits, is a copy sharing everything
+// else: the background frames, the other layers and their tiles.
+//
+class FlatCountdown {
+  public:
+    struct Area {
+        int x {0};
+        int y {0};
+        int width {0};
+        int height {0};
+    };
+
+    struct Tile : Area {
+        // Interleaved RGB, width * 3 bytes per row
+        std::vector<uint8_t> pixels;
+    };
+
+    // tiles[part][digit], already clipped to the canvas
+    using TileSet = std::vector<std::vector<Tile>>;
+
+    // Interleaved RGB of the whole canvas
+    using Canvas = std::vector<uint8_t>;
+
+    struct Layer {
+        // Index of the background frame
+        size_t background {0};
+        // Where the layer differs from its background frame, copied over it
+        std::shared_ptr<const std::vector<Tile>> patches;
+        // Null when the digits are blended per frame
+        std::shared_ptr<const TileSet> tiles;
+    };
+
+    // A layer to build: image is the background frame with what the layer
+    // draws over it, which only differs from the frame inside areas
+    struct Source {
+        size_t background {0};
+        vips::VImage image;
+        std::vector<Area> areas;
+    };
+
+    // Backgrounds are opaque sRGB images of the same size, layer images sRGB
+    // with an optional alpha band, digits sRGB + alpha. Returns nullptr when
+    // the images do not have these formats, or when the background frames
+    // take more memory than the template may hold. previous was built from
+    // the same digits at the same positions: a layer whose background did not
+    // change under the digits keeps its tiles.
+    static std::shared_ptr<FlatCountdown> build(const std::vector<vips::VImage>& backgrounds, const std::vector<Source>& layers,
+                                                const std::vector<vips::VImage>& digits,
+                                                const std::vector<int>& x, const std::vector<int>& y,
+                                                const FlatCountdown* previous = nullptr);
+
+    // A copy with the layers at the given indices built again from their
+    // sources, over the same backgrounds. The other layers are shared, a new
+    // layer identical under the digits to another one shares its tiles.
+    // nullptr when a source does not have the formats of build.
+    std::shared_ptr<FlatCountdown> with_layers(const std::vector<std::pair<size_t, Source>>& layers) const;
+
+    // A copy with other digits, the backgrounds and the patches of the
+    // layers are shared. nullptr when the digits are not sRGB + alpha.
+    std::shared_ptr<FlatCountdown> with_digits(const std::vector<vips::VImage>& digits,
+                                               const std::vector<int>& x, const std::vector<int>& y) const;
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    const std::vector<std::shared_ptr<const Canvas>>& backgrounds() const { return backgrounds_; }
+    const std::vector<Layer>& layers() const { return layers_; }
+
+    // Copy the background of a layer and its patches to canvas
+    void compose(const Layer& layer, uint8_t* canvas) const;
+
+    // Draw the digits of moment over canvas, which already shows the background
+    // of the layer, or an earlier frame of the same layer when it has tiles
+    void draw(size_t layer, const std::vector<int>& moment, uint8_t* canvas) const;
+
+    // Every frame as one page of a multipage sRGB image, from start going down
+    // one second per frame, delay in milliseconds. The frames show layers in
+    // turn, looping. The pages are a pooled buffer that goes back to the pool
+    // when libvips closes the image.
+    vips::VImage render(const std::vector<size_t>& layers, const std::vector<int>& start, int frames, int delay) const;
+
+    BufferPoolStats pool_stats() const { return pages_->stats(); }
+
+  private:
+    // A digit image, interleaved sRGB + alpha
+    struct Glyph {
+        int width {0};
+        int height {0};
+        std::vector<uint8_t> pixels;
+    };
+
+    // Tile sets by the pixels under the digits of the layers using them
+    using TileSets = std::map<std::vector<uint8_t>, std::shared_ptr<const TileSet>>;
+
+    // Read the digits and where each part shows them, false when they are
+    // not sRGB + alpha
+    bool set_digits(const std::vector<vips::VImage>& digits, const std::vector<int>& x, const std::vector<int>& y);
+
+    // The patches of the layer of source, without tiles. false when its
+    // image does not match the backgrounds.
+    bool make_layer(const Source& source, Layer& layer) const;
+
+    // Give layer the tile set of the layers identical under the digits, one
+    // of reuse, or a new one while they fit in the budget. canvas is scratch
+    // memory of the size of the canvas.
+    void assign_tiles(Layer& layer, Canvas& canvas, const TileSets* reuse);
+
+    // Forget the tile sets no layer uses anymore
+    void prune_tiles();
+
+    // The pixels of a canvas under the digits, the key of its tiles
+    std::vector<uint8_t> under_digits(const uint8_t* canvas) const;
+
+    // Every digit of every part flattened onto canvas
+    std::shared_ptr<const TileSet> flatten(const uint8_t* canvas) const;
+
+    // Where the digit shows when part displays it, clipped to the canvas
+    Area digit_area(size_t part, size_t digit) const;
+
+    // Blend the digit of part over the RGB pixels of canvas in area, out
+    // receiving the top left pixel of area with rows of outStride bytes.
+    // out may be the canvas itself.
+    void blend(size_t part, size_t digit, const Area& area, const uint8_t* canvas, uint8_t* out, size_t outStride) const;
+
+    int width_ {0};
+    int height_ {0};
+    std::vector<std::shared_ptr<const Canvas>> backgrounds_;
+    std::vector<Layer> layers_;
+    std::shared_ptr<const std::vector<Glyph>> digits_;
+    // Top left corner of the digits of each part, may be off the canvas
+    std::vector<int> x_;
+    std::vector<int> y_;
+    // Area covered by each part whatever digit it shows
+    std::vector<Area> areas_;
+    // Tiles are copied opaque: overlapping parts would hide each other, the
+    // layers then have no tiles
+    bool overlapping_ {false};
+    TileSets tileSets_;
+    // Page buffers, in frames of the canvas
+    std::shared_ptr<BufferPool> pages_;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#include "gif_encoder.h"
+
+namespace {
+
+const int maxCodes = 4096;
+const int hashSize = 8192;
+// Candidates tried for a lossy match, the closest colours
+const size_t maxNear = 16;
+
+std::atomic<uint64_t> filesWritten {0};
+std::atomic<uint64_t> lossyFilesWritten {0};
+std::atomic<uint64_t> framesWritten {0};
+std::atomic<uint64_t> pixelsWritten {0};
+std::atomic<uint64_t> bytesWritten {0};
+
+// Packs variable width LZW codes into 255 byte data sub-blocks
+class CodeWriter {
+  public:
+    explicit CodeWriter(std::vector<uint8_t>& out): out_(out) {}
+
+    void write(int code, int bits) {
+        buffer_ |= static_cast<uint32_t>(code) << count_;
+        count_ += bits;
+        while (count_ >= 8) {
+            push(static_cast<uint8_t>(buffer_ & 0xff));
+            buffer_ >>= 8;
+            count_ -= 8;
+        }
+    }
+
+    void flush() {
+        if (count_ > 0) {
+            push(static_cast<uint8_t>(buffer_ & 0xff));
+        }
+        buffer_ = 0;
+        count_ = 0;
+        if (length_ > 0) {
+            emit_block();
+        }
+        // Block terminator
+        out_.push_back(0);
+    }
+
+  private:
+    void push(uint8_t value) {
+        block_[length_++] = value;
+        if (length_ == 255) {
+            emit_block();
+        }
+    }
+
+    void emit_block() {
+        out_.push_back(static_cast<uint8_t>(length_));
+        out_.insert(out_.end(), block_, block_ + length_);
+        length_ = 0;
+    }
+
+    std::vector<uint8_t>& out_;
+    uint32_t buffer_ {0};
+    int count_ {0};
+    uint8_t block_[255];
+    int length_ {0};
+};
+
+}
+
+GifEncoder::GifEncoder(int width, int height, const std::vector<uint8_t>& palette, int loop, int lossy):
+    keys_(hashSize), codes_(hashSize) {
+    int colours = static_cast<int>(palette.size() / 3);
+    if (colours < 1 || colours > 256) {
+        throw std::invalid_argument("A GIF palette has between 1 and 256 colours");
+    }
+    if (lossy < 0 || lossy > maxLossy) {
+        throw std::invalid_argument("The lossy level is between 0 and " + std::to_string(maxLossy));
+    }
+
+    if (lossy > 0) {
+        // Indices past the palette have no neighbours
+        this->near_.resize(256);
+        for (int i = 0; i < colours; i++) {
+            std::vector<std::pair<int, uint8_t>> candidates;
+            for (int j = 0; j < colours; j++) {
+                int dr = palette[i * 3] - palette[j * 3];
+                int dg = palette[i * 3 + 1] - palette[j * 3 + 1];
+                int db = palette[i * 3 + 2] - palette[j * 3 + 2];
+                int distance = dr * dr + dg * dg + db * db;
+                if (j != i && distance <= lossy * lossy) {
+                    candidates.emplace_back(distance, static_cast<uint8_t>(j));
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+            candidates.resize(std::min(candidates.size(), maxNear));
+            for (const auto& [distance, j]: candidates) {
+                this->near_[i].push_back(j);
+            }
+        }
+    }
+
+    // The colour table size is a power of two, at least 2 entries
+    this->tableBits_ = 1;
+    while ((1 << this->tableBits_) < colours) {
+        this->tableBits_++;
+    }
+    this->minCodeSize_ = std::max(2, this->tableBits_);
+
+    const char* signature = "GIF89a";
+    this->out_.insert(this->out_.end(), signature, signature + 6);
+
+    // Logical screen descriptor with a global colour table
+    put_short(width);
+    put_short(height);
+    put_byte(static_cast<uint8_t>(0x80 | (7 << 4) | (this->tableBits_ - 1)));
+    put_byte(0);
+    put_byte(0);
+
+    this->out_.insert(this->out_.end(), palette.begin(), palette.begin() + colours * 3);
+    this->out_.resize(this->out_.size() + ((1 << this->tableBits_) - colours) * 3, 0);
+
+    // NETSCAPE2.0 application extension for looping
+    const char* application = "NETSCAPE2.0";
+    put_byte(0x21);
+    put_byte(0xff);
+    put_byte(11);
+    this->out_.insert(this->out_.end(), application, application + 11);
+    put_byte(3);
+    put_byte(1);
+    put_short(loop);
+    put_byte(0);
+}
+
+void GifEncoder::add_frame(const uint8_t* pixels, size_t stride, int x, int y, int width, int height, int delay) {
+    // Graphic control extension: do not dispose, no transparency
+    put_byte(0x21);
+    put_byte(0xf9);
+    put_byte(4);
+    put_byte(1 << 2);
+    this->lastDelay_ = this->out_.size();
+    this->lastDelayCs_ = (delay + 5) / 10;
+    put_short(this->lastDelayCs_);
+    put_byte(0);
+    put_byte(0);
+
+    // Image descriptor, the global colour table is used
+    put_byte(0x2c);
+    put_short(x);
+    put_short(y);
+    put_short(width);
+    put_short(height);
+    put_byte(0);
+
+    write_lzw(pixels, stride, width, height);
+    this->frames_++;
+    this->pixels_ += static_cast<uint64_t>(width) * height;
+}
+
+void GifEncoder::extend_last_frame(int delay) {
+    if (this->lastDelay_ == 0) {
+        return;
+    }
+
+    this->lastDelayCs_ = std::min(this->lastDelayCs_ + (delay + 5) / 10, 0xffff);
+    this->out_[this->lastDelay_] = static_cast<uint8_t>(this->lastDelayCs_ & 0xff);
+    this->out_[this->lastDelay_ + 1] = static_cast<uint8_t>(this->lastDelayCs_ >> 8);
+}
+
+void GifEncoder::reserve(size_t bytes) {
+    this->out_.reserve(bytes);
+}
+
+std::vector<uint8_t> GifEncoder::finish() {
+    put_byte(0x3b);
+
+    filesWritten++;
+    if (!this->near_.empty()) {
+        lossyFilesWritten++;
+    }
+    framesWritten += this->frames_;
+    pixelsWritten += this->pixels_;
+    bytesWritten += this->out_.size();
+    return std::move(this->out_);
+}
+
+GifEncoderStats GifEncoder::stats() {
+    GifEncoderStats stats;
+    stats.files = filesWritten.load();
+    stats.lossyFiles = lossyFilesWritten.load();
+    stats.frames = framesWritten.load();
+    stats.pixels = pixelsWritten.load();
+    stats.bytes = bytesWritten.load();
+    return stats;
+}
+
+void GifEncoder::put_byte(uint8_t value) {
+    this->out_.push_back(value);
+}
+
+void GifEncoder::put_short(int value) {
+    this->out_.push_back(static_cast<uint8_t>(value & 0xff));
+    this->out_.push_back(static_cast<uint8_t>((value >> 8) & 0xff));
+}
+
+void GifEncoder::write_lzw(const uint8_t* pixels, size_t stride, int width, int height) {
+    put_byte(static_cast<uint8_t>(this->minCodeSize_));
+
+    const int clearCode = 1 << this->minCodeSize_;
+    const int endCode = clearCode + 1;
+
+    // Open addressing table from (prefix code << 8 | pixel) to code
+    std::vector<int32_t>& keys = this->keys_;
+    std::vector<int16_t>& codes = this->codes_;
+    std::fill(keys.begin(), keys.end(), -1);
+
+    // Slot of a key, or the free slot where it would go
+    auto find = [&](int32_t key) {
+        int slot = (key ^ (key >> 12)) & (hashSize - 1);
+        while (keys[slot] >= 0 && keys[slot] != key) {
+            slot = (slot + 1) & (hashSize - 1);
+        }
+        return slot;
+    };
+
+    CodeWriter writer(this->out_);
+    int codeSize = this->minCodeSize_ + 1;
+    int next = endCode + 1;
+
+    // Width grows once the next free code no longer fits, see the GIF89a spec appendix F
+    auto emit = [&](int code) {
+        writer.write(code, codeSize);
+        if (next > (1 << codeSize) - 1 && codeSize < 12) {
+            codeSize++;
+        }
+    };
+
+    writer.write(clearCode, codeSize);
+
+    int prefix = -1;
+    for (int row = 0; row < height; row++) {
+        const uint8_t* line = pixels + row * stride;
+        for (int col = 0; col < width; col++) {
+            int pixel = line[col];
+            if (prefix < 0) {
+                prefix = pixel;
+                continue;
+            }
+
+            int32_t key = (prefix << 8) | pixel;
+            int slot = find(key);
+            if (keys[slot] == key) {
+                prefix = codes[slot];
+                continue;
+            }
+
+            // Extend the string with a close colour instead. The decoder
+            // adds entries from the first pixel of each string, which is
+            // always exact, so its table stays the same as this one.
+            if (!this->near_.empty()) {
+                int extended = -1;
+                for (uint8_t colour: this->near_[pixel]) {
+                    int nearSlot = find((prefix << 8) | colour);
+                    if (keys[nearSlot] >= 0) {
+                        extended = codes[nearSlot];
+                        break;
+                    }
+                }
+                if (extended >= 0) {
+                    prefix = extended;
+                    continue;
+                }
+            }
+
+            emit(prefix);
+            if (next < maxCodes) {
+                keys[slot] = key;
+                codes[slot] = static_cast<int16_t>(next++);
+            } else {
+                writer.write(clearCode, codeSize);
+                std::fill(keys.begin(), keys.end(), -1);
+                codeSize = this->minCodeSize_ + 1;
+                next = endCode + 1;
+            }
+            prefix = pixel;
+        }
+    }
+
+    if (prefix >= 0) {
+        emit(prefix);
+    }
+    writer.write(endCode, codeSize);
+    writer.flush();
+}
@@ -0,0 +1,69 @@
+#ifndef GIF_ENCODER_H
+#define GIF_ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Files written by every encoder of the process
+struct GifEncoderStats {
+    uint64_t files {0};
+    uint64_t lossyFiles {0};
+    uint64_t frames {0};
+    // Palette indices encoded, one byte each before compression
+    uint64_t pixels {0};
+    uint64_t bytes {0};
+};
+
+//
+// Minimal GIF89a writer for palette-indexed frames. Frames may cover a
+// sub-rectangle of the canvas, they are drawn over the previous frame.
+//
+// With a lossy level the LZW strings may end with a colour up to that RGB
+// distance away from the pixel, like gifsicle --lossy: runs get longer and
+// the file smaller, each pixel is off by at most the level.
+//
+class GifEncoder {
+  public:
+    // palette: RGB triples, at most 256 colours. loop: 0 repeats forever.
+    // lossy: 0 for a lossless file, up to maxLossy.
+    GifEncoder(int width, int height, const std::vector<uint8_t>& palette, int loop = 0, int lossy = 0);
+
+    static const int maxLossy = 255;
+
+    // Append a frame. pixels points at the top-left index of the rectangle,
+    // rows are stride bytes apart. delay is in milliseconds.
+    void add_frame(const uint8_t* pixels, size_t stride, int x, int y, int width, int height, int delay);
+
+    // Show the last frame longer instead of adding an identical one
+    void extend_last_frame(int delay);
+
+    // Expected size of the encoded file, avoids growing the output frame by frame
+    void reserve(size_t bytes);
+
+    // Write the trailer and hand over the encoded file
+    std::vector<uint8_t> finish();
+
+    static GifEncoderStats stats();
+
+  private:
+    void put_byte(uint8_t value);
+    void put_short(int value);
+    void write_lzw(const uint8_t* pixels, size_t stride, int width, int height);
+
+    std::vector<uint8_t> out_;
+    // LZW hash table, allocated once and cleared for every frame
+    std::vector<int32_t> keys_;
+    std::vector<int16_t> codes_;
+    // Other colours within the lossy distance of each colour, closest first
+    std::vector<std::vector<uint8_t>> near_;
+    uint64_t frames_ {0};
+    uint64_t pixels_ {0};
+    int tableBits_;
+    int minCodeSize_;
+    // Offset of the delay field of the last graphic control extension
+    size_t lastDelay_ {0};
+    int lastDelayCs_ {0};
+};
+
+#endif
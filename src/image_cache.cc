@@ -0,0 +1,132 @@
+#include <sys/stat.h>
+
+#include "image_cache.h"
+#include "trace.h"
+
+using namespace vips;
+
+namespace {
+
+// Modification time in nanoseconds, stat() fails for a missing file
+bool file_version(const std::string& path, int64_t& size, int64_t& mtime) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    size = st.st_size;
+#ifdef __APPLE__
+    mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+}
+
+ImageCache& ImageCache::shared() {
+    // Never destroyed: images may be released by worker threads at exit
+    static ImageCache* cache = new ImageCache();
+    return *cache;
+}
+
+void ImageCache::configure(size_t maxBytes) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->maxBytes_ = maxBytes;
+    evict_locked();
+}
+
+bool ImageCache::enabled() const {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    return this->maxBytes_ > 0;
+}
+
+VImage ImageCache::load(const std::string& path) {
+    int64_t size = 0;
+    int64_t mtime = 0;
+    if (!enabled() || !file_version(path, size, mtime)) {
+        // libvips reports the missing file
+        return VImage::new_from_file(path.c_str(), VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        auto it = this->index_.find(path);
+        if (it != this->index_.end()) {
+            Entry& entry = *it->second;
+            if (entry.size == size && entry.mtime == mtime) {
+                this->entries_.splice(this->entries_.begin(), this->entries_, it->second);
+                this->hits_++;
+                return entry.image;
+            }
+
+            // The file has changed
+            this->bytes_ -= entry.bytes;
+            this->entries_.erase(it->second);
+            this->index_.erase(it);
+        }
+        this->misses_++;
+    }
+
+    // Decoded outside of the lock, concurrent misses of a path may both decode it
+    Entry entry;
+    {
+        jsvips::TraceSpan span("decode image");
+        entry.image = VImage::new_from_file(path.c_str()).copy_memory();
+        span.arg("width", entry.image.width()).arg("height", entry.image.height());
+    }
+    entry.path = path;
+    entry.size = size;
+    entry.mtime = mtime;
+    entry.bytes = static_cast<size_t>(VIPS_IMAGE_SIZEOF_IMAGE(entry.image.get_image()));
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (entry.bytes > this->maxBytes_ || this->index_.count(path) > 0) {
+        return entry.image;
+    }
+
+    this->bytes_ += entry.bytes;
+    this->entries_.push_front(entry);
+    this->index_[path] = this->entries_.begin();
+    evict_locked();
+    return entry.image;
+}
+
+void ImageCache::invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    if (path.empty()) {
+        this->entries_.clear();
+        this->index_.clear();
+        this->bytes_ = 0;
+        return;
+    }
+
+    auto it = this->index_.find(path);
+    if (it != this->index_.end()) {
+        this->bytes_ -= it->second->bytes;
+        this->entries_.erase(it->second);
+        this->index_.erase(it);
+    }
+}
+
+ImageCacheStats ImageCache::stats() const {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    ImageCacheStats stats;
+    stats.entries = this->entries_.size();
+    stats.bytes = this->bytes_;
+    stats.maxBytes = this->maxBytes_;
+    stats.hits = this->hits_;
+    stats.misses = this->misses_;
+    stats.evictions = this->evictions_;
+    return stats;
+}
+
+void ImageCache::evict_locked() {
+    while (this->bytes_ > this->maxBytes_ && !this->entries_.empty()) {
+        const Entry& last = this->entries_.back();
+        this->bytes_ -= last.bytes;
+        this->index_.erase(last.path);
+        this->entries_.pop_back();
+        this->evictions_++;
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vips/vips8>
+
+struct ImageCacheStats {
+    size_t entries {0};
+    size_t bytes {0};
+    size_t maxBytes {0};
+    uint64_t hits {0};
+    uint64_t misses {0};
+    uint64_t evictions {0};
+};
+
+//
+// Process-wide cache of decoded source images, off until it is given a byte
+// budget. An entry is keyed by path and checked against the size and mtime
+// of the file on every lookup, so a file replaced on disk is decoded again.
+// Entries are decoded into memory once; VImage is immutable, so instances
+// drawing on a cached image build new images over the shared pixels.
+//
+class ImageCache {
+  public:
+    static ImageCache& shared();
+
+    // 0 turns the cache off and drops every entry
+    void configure(size_t maxBytes);
+    bool enabled() const;
+
+    // The decoded image of a file. Without a cache the file is opened for
+    // sequential access, as a one-off decode. Throws vips::VError.
+    vips::VImage load(const std::string& path);
+
+    // Drop the entry of a path, or every entry when path is empty
+    void invalidate(const std::string& path = "");
+
+    ImageCacheStats stats() const;
+
+  private:
+    struct Entry {
+        std::string path;
+        int64_t size {0};
+        int64_t mtime {0};
+        size_t bytes {0};
+        vips::VImage image;
+    };
+
+    void evict_locked();
+
+    mutable std::mutex mutex_;
+    size_t maxBytes_ {0};
+    size_t bytes_ {0};
+    // Most recently used first
+    std::list<Entry> entries_;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    uint64_t hits_ {0};
+    uint64_t misses_ {0};
+    uint64_t evictions_ {0};
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "gif_encoder.h"
+#include "indexed_countdown.h"
+#include "render_options.h"
+#include "trace.h"
+
+std::shared_ptr<IndexedCountdown> IndexedCountdown::build(const FlatCountdown& flat, const IndexedCountdown* previous) {
+    // Digits blended per frame have no tiles to index
+    for (const FlatCountdown::Layer& layer: flat.layers()) {
+        if (!layer.tiles) {
+            return nullptr;
+        }
+    }
+
+    auto indexed = std::make_shared<IndexedCountdown>();
+    indexed->width_ = flat.width();
+    indexed->height_ = flat.height();
+
+    if (previous && (previous->width_ != flat.width() || previous->height_ != flat.height())) {
+        previous = nullptr;
+    }
+
+    // The indices of previous stay valid
+    std::unordered_map<uint32_t, uint8_t> lookup;
+    if (previous) {
+        indexed->palette_ = previous->palette_;
+        for (size_t i = 0; i * 3 < indexed->palette_.size(); i++) {
+            const uint8_t* p = indexed->palette_.data() + i * 3;
+            lookup[(p[0] << 16) | (p[1] << 8) | p[2]] = static_cast<uint8_t>(i);
+        }
+    }
+    // The colours of previous fill the palette: start again without them
+    auto full = [&]() {
+        return previous ? build(flat, nullptr) : nullptr;
+    };
+
+    auto index_of = [&](const uint8_t* p) -> int {
+        uint32_t key = (p[0] << 16) | (p[1] << 8) | p[2];
+        auto it = lookup.find(key);
+        if (it != lookup.end()) {
+            return it->second;
+        }
+        if (lookup.size() == 256) {
+            return -1;
+        }
+
+        uint8_t index = static_cast<uint8_t>(lookup.size());
+        lookup[key] = index;
+        indexed->palette_.insert(indexed->palette_.end(), p, p + 3);
+        return index;
+    };
+
+    // RGB to indices, false when the palette is full
+    auto convert = [&](const std::vector<uint8_t>& rgb, std::vector<uint8_t>& indices) {
+        indices.resize(rgb.size() / 3);
+        for (size_t i = 0; i < indices.size(); i++) {
+            int index = index_of(rgb.data() + i * 3);
+            if (index < 0) {
+                return false;
+            }
+            indices[i] = static_cast<uint8_t>(index);
+        }
+        return true;
+    };
+
+    // Tiles of the flat countdown as indices
+    auto convert_tiles = [&](const std::vector<FlatCountdown::Tile>& flatTiles, std::vector<Tile>& tiles) {
+        for (const FlatCountdown::Tile& flatTile: flatTiles) {
+            Tile tile;
+            tile.x = flatTile.x;
+            tile.y = flatTile.y;
+            tile.width = flatTile.width;
+            tile.height = flatTile.height;
+            if (!convert(flatTile.pixels, tile.pixels)) {
+                return false;
+            }
+            tiles.push_back(std::move(tile));
+        }
+        return true;
+    };
+
+    for (size_t i = 0; i < flat.backgrounds().size(); i++) {
+        const std::shared_ptr<const FlatCountdown::Canvas>& flatBackground = flat.backgrounds()[i];
+        indexed->flatBackgrounds_.push_back(flatBackground);
+        if (previous && i < previous->flatBackgrounds_.size() && previous->flatBackgrounds_[i] == flatBackground) {
+            indexed->backgrounds_.push_back(previous->backgrounds_[i]);
+            continue;
+        }
+        auto background = std::make_shared<std::vector<uint8_t>>();
+        if (!convert(*flatBackground, *background)) {
+            return full();
+        }
+        indexed->backgrounds_.push_back(background);
+    }
+
+    // Patches and tile sets shared by several layers, or with previous, are
+    // converted once
+    std::map<const std::vector<FlatCountdown::Tile>*, std::shared_ptr<const std::vector<Tile>>> convertedPatches;
+    std::map<const FlatCountdown::TileSet*, std::shared_ptr<const TileSet>> converted;
+    if (previous) {
+        for (const Layer& layer: previous->layers_) {
+            convertedPatches[layer.flatPatches.get()] = layer.patches;
+            converted[layer.flatTiles.get()] = layer.tiles;
+        }
+    }
+
+    for (const FlatCountdown::Layer& flatLayer: flat.layers()) {
+        Layer layer;
+        layer.background = flatLayer.background;
+        layer.flatPatches = flatLayer.patches;
+        layer.flatTiles = flatLayer.tiles;
+
+        auto patches = convertedPatches.find(flatLayer.patches.get());
+        if (patches != convertedPatches.end()) {
+            layer.patches = patches->second;
+        } else {
+            auto converting = std::make_shared<std::vector<Tile>>();
+            if (!convert_tiles(*flatLayer.patches, *converting)) {
+                return full();
+            }
+            layer.patches = converting;
+            convertedPatches[flatLayer.patches.get()] = converting;
+        }
+
+        auto it = converted.find(flatLayer.tiles.get());
+        if (it != converted.end()) {
+            layer.tiles = it->second;
+        } else {
+            const FlatCountdown::TileSet& flatTiles = *flatLayer.tiles;
+            auto tiles = std::make_shared<TileSet>(flatTiles.size());
+            for (size_t part = 0; part < flatTiles.size(); part++) {
+                if (!convert_tiles(flatTiles[part], (*tiles)[part])) {
+                    return full();
+                }
+            }
+            layer.tiles = tiles;
+            converted[flatLayer.tiles.get()] = tiles;
+        }
+
+        indexed->layers_.push_back(std::move(layer));
+    }
+
+    indexed->canvases_ = previous ? previous->canvases_ : BufferPool::create(static_cast<size_t>(indexed->width_) * indexed->height_);
+    return indexed;
+}
+
+std::vector<uint8_t> IndexedCountdown::render(const std::vector<size_t>& layers, const std::vector<int>& start, int frames, int delay,
+                                              int lossy, const std::function<bool()>& cancelled) const {
+    const int width = this->width_;
+    const int height = this->height_;
+    const size_t parts = this->layers_.at(layers.at(0)).tiles->size();
+
+    const int numFrames = jsvips::countdown_frames(frames, height);
+
+    jsvips::TraceSpan span("encode indexed gif");
+    span.arg("frames", numFrames).arg("pixels", static_cast<double>(width) * height * numFrames);
+
+    GifEncoder encoder(width, height, this->palette_, 0, lossy);
+    encoder.reserve(this->lastSize_.load(std::memory_order_relaxed));
+
+    BufferPool::Buffer canvasBuffer = this->canvases_->acquire(1);
+    uint8_t* canvas = canvasBuffer.data();
+
+    const Layer* shownLayer = nullptr;
+    std::vector<int> shown(parts, -1);
+    std::vector<int> moment = start;
+
+    for (int frame = 0; frame < numFrames; frame++, jsvips::countdown_minus_one_second(moment)) {
+        if (cancelled && cancelled()) {
+            throw std::runtime_error("Rendering has been cancelled");
+        }
+
+        const Layer& layer = this->layers_.at(layers[frame % layers.size()]);
+        const TileSet& tiles = *layer.tiles;
+
+        // Area touched by the digits that change in this frame
+        int x0 = width, y0 = height, x1 = 0, y1 = 0;
+        auto extend = [&](const Tile& tile) {
+            if (tile.width > 0 && tile.height > 0) {
+                x0 = std::min(x0, tile.x);
+                y0 = std::min(y0, tile.y);
+                x1 = std::max(x1, tile.x + tile.width);
+                y1 = std::max(y1, tile.y + tile.height);
+            }
+        };
+
+        for (size_t part = 0; part < parts; part++) {
+            if (moment.at(part) != shown[part]) {
+                if (shown[part] >= 0) {
+                    extend(tiles[part][shown[part]]);
+                }
+                extend(tiles[part].at(moment.at(part)));
+            }
+        }
+
+        // The first frame, and every frame where an animated background moves on
+        if (&layer != shownLayer) {
+            x0 = 0;
+            y0 = 0;
+            x1 = width;
+            y1 = height;
+        } else if (x0 >= x1 || y0 >= y1) {
+            // Nothing changed, e.g. the countdown has reached zero
+            encoder.extend_last_frame(delay);
+            continue;
+        }
+
+        // Restore the background and the patches of the layer, then draw
+        // every digit overlapping the area
+        const std::vector<uint8_t>& background = *this->backgrounds_[layer.background];
+        for (int row = y0; row < y1; row++) {
+            std::memcpy(canvas + row * width + x0, background.data() + row * width + x0, x1 - x0);
+        }
+
+        auto copy = [&](const Tile& tile) {
+            int left = std::max(x0, tile.x);
+            int right = std::min(x1, tile.x + tile.width);
+            int top = std::max(y0, tile.y);
+            int bottom = std::min(y1, tile.y + tile.height);
+
+            for (int row = top; row < bottom; row++) {
+                std::memcpy(canvas + row * width + left,
+                            tile.pixels.data() + (row - tile.y) * tile.width + (left - tile.x),
+                            std::max(0, right - left));
+            }
+        };
+        for (const Tile& patch: *layer.patches) {
+            copy(patch);
+        }
+        for (size_t part = 0; part < parts; part++) {
+            copy(tiles[part][moment[part]]);
+        }
+        shown = moment;
+        shownLayer = &layer;
+
+        encoder.add_frame(canvas + y0 * width + x0, width, x0, y0, x1 - x0, y1 - y0, delay);
+    }
+
+    std::vector<uint8_t> gif = encoder.finish();
+    this->lastSize_.store(gif.size(), std::memory_order_relaxed);
+    span.arg("bytes", static_cast<double>(gif.size()));
+    return gif;
+}
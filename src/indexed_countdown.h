@@ -0,0 +1,78 @@
+#ifndef INDEXED_COUNTDOWN_H
+#define INDEXED_COUNTDOWN_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "flat_countdown.h"
+
+//
+// Countdown frames assembled directly as palette indices.
+//
+// At template init the backgrounds and the flattened digit tiles are
+// converted to palette indices once. A frame is then a handful of rectangle
+// copies that go straight to the LZW encoder: no compositing and no
+// quantization per frame.
+//
+// A template may have several layers (one per locale and frame of an
+// animated background). They share one palette, and the background frames,
+// label patches and digit tiles are shared like the RGB ones they come from.
+// An update converts only what its flat countdown does not share with the
+// previous one.
+//
+class IndexedCountdown {
+  public:
+    // Returns nullptr when the template needs more than 256 colours, or when
+    // a layer of flat blends its digits per frame. previous was built from an
+    // earlier version of flat: what they share keeps its indices, and the
+    // palette starts with the colours of previous.
+    static std::shared_ptr<IndexedCountdown> build(const FlatCountdown& flat, const IndexedCountdown* previous = nullptr);
+
+    // layers: indices into the layers of the flat countdown, shown in turn.
+    // The frames go down one second each from start, delay is in
+    // milliseconds. lossy: see GifEncoder. cancelled is polled between frames.
+    std::vector<uint8_t> render(const std::vector<size_t>& layers, const std::vector<int>& start, int frames, int delay,
+                                int lossy = 0, const std::function<bool()>& cancelled = nullptr) const;
+
+    BufferPoolStats pool_stats() const { return canvases_->stats(); }
+
+  private:
+    struct Tile {
+        int x {0};
+        int y {0};
+        int width {0};
+        int height {0};
+        std::vector<uint8_t> pixels;
+    };
+
+    // tiles[part][digit], already clipped to the canvas
+    using TileSet = std::vector<std::vector<Tile>>;
+
+    struct Layer {
+        // Index of the background frame
+        size_t background {0};
+        std::shared_ptr<const std::vector<Tile>> patches;
+        std::shared_ptr<const TileSet> tiles;
+        // What they were converted from, reused by the next build
+        std::shared_ptr<const std::vector<FlatCountdown::Tile>> flatPatches;
+        std::shared_ptr<const FlatCountdown::TileSet> flatTiles;
+    };
+
+    int width_ {0};
+    int height_ {0};
+    std::vector<uint8_t> palette_;
+    std::vector<std::shared_ptr<const std::vector<uint8_t>>> backgrounds_;
+    // The RGB frames they were converted from
+    std::vector<std::shared_ptr<const FlatCountdown::Canvas>> flatBackgrounds_;
+    std::vector<Layer> layers_;
+    // Canvas of a render, one frame of indices
+    std::shared_ptr<BufferPool> canvases_;
+    // Size of the last file, reserved up front by the next render
+    mutable std::atomic<size_t> lastSize_ {0};
+};
+
+#endif
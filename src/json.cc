@@ -0,0 +1,423 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "json.h"
+
+namespace jsvips {
+
+namespace {
+
+const Json nullJson;
+
+class Parser {
+  public:
+    explicit Parser(const std::string& text): text_(text) {}
+
+    Json document() {
+        Json value = parse_value(0);
+        skip_spaces();
+        if (pos_ != text_.size()) {
+            fail("Unexpected content after the document");
+        }
+        return value;
+    }
+
+  private:
+    // Deep enough for any template, shallow enough to keep the stack safe
+    static const int maxDepth = 64;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::invalid_argument(message + " at offset " + std::to_string(pos_));
+    }
+
+    void skip_spaces() {
+        while (pos_ < text_.size() && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+            pos_++;
+        }
+    }
+
+    bool consume(char c) {
+        skip_spaces();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c)) {
+            fail(std::string("Expected '") + c + "'");
+        }
+    }
+
+    void expect_word(const char* word) {
+        for (const char* p = word; *p; p++, pos_++) {
+            if (pos_ >= text_.size() || text_[pos_] != *p) {
+                fail("Invalid literal");
+            }
+        }
+    }
+
+    Json parse_value(int depth) {
+        if (depth > maxDepth) {
+            fail("The document is nested too deeply");
+        }
+
+        skip_spaces();
+        if (pos_ >= text_.size()) {
+            fail("Unexpected end of the document");
+        }
+
+        switch (text_[pos_]) {
+            case '{': {
+                pos_++;
+                Json object {Json::Object()};
+                if (consume('}')) {
+                    return object;
+                }
+                do {
+                    skip_spaces();
+                    std::string key = parse_string();
+                    expect(':');
+                    object.set(key, parse_value(depth + 1));
+                } while (consume(','));
+                expect('}');
+                return object;
+            }
+            case '[': {
+                pos_++;
+                Json array {Json::Array()};
+                if (consume(']')) {
+                    return array;
+                }
+                do {
+                    array.push_back(parse_value(depth + 1));
+                } while (consume(','));
+                expect(']');
+                return array;
+            }
+            case '"':
+                return Json(parse_string());
+            case 't':
+                expect_word("true");
+                return Json(true);
+            case 'f':
+                expect_word("false");
+                return Json(false);
+            case 'n':
+                expect_word("null");
+                return Json();
+            default:
+                return Json(parse_number());
+        }
+    }
+
+    double parse_number() {
+        size_t start = pos_;
+        if (pos_ < text_.size() && text_[pos_] == '-') {
+            pos_++;
+        }
+        while (pos_ < text_.size() && (std::isdigit(static_cast<unsigned char>(text_[pos_])) || text_[pos_] == '.' ||
+                                       text_[pos_] == 'e' || text_[pos_] == 'E' || text_[pos_] == '+' || text_[pos_] == '-')) {
+            pos_++;
+        }
+
+        double value = 0;
+        auto [end, ec] = std::from_chars(text_.data() + start, text_.data() + pos_, value);
+        if (start == pos_ || ec != std::errc() || end != text_.data() + pos_) {
+            pos_ = start;
+            fail("Invalid number");
+        }
+        return value;
+    }
+
+    unsigned hex4() {
+        if (pos_ + 4 > text_.size()) {
+            fail("Invalid unicode escape");
+        }
+        unsigned value = 0;
+        for (int i = 0; i < 4; i++) {
+            char c = text_[pos_++];
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                value |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                value |= c - 'A' + 10;
+            } else {
+                fail("Invalid unicode escape");
+            }
+        }
+        return value;
+    }
+
+    static void append_utf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xc0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xe0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        } else {
+            out += static_cast<char>(0xf0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+            out += static_cast<char>(0x80 | (code & 0x3f));
+        }
+    }
+
+    std::string parse_string() {
+        if (pos_ >= text_.size() || text_[pos_] != '"') {
+            fail("Expected a string");
+        }
+        pos_++;
+
+        std::string out;
+        while (true) {
+            if (pos_ >= text_.size()) {
+                fail("Unterminated string");
+            }
+            char c = text_[pos_++];
+            if (c == '"') {
+                return out;
+            }
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+
+            if (pos_ >= text_.size()) {
+                fail("Unterminated string");
+            }
+            switch (text_[pos_++]) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned code = hex4();
+                    // Characters outside the BMP are written as a surrogate pair
+                    if (code >= 0xd800 && code < 0xdc00 && text_.compare(pos_, 2, "\\u") == 0) {
+                        pos_ += 2;
+                        unsigned low = hex4();
+                        if (low < 0xdc00 || low > 0xdfff) {
+                            fail("Invalid surrogate pair");
+                        }
+                        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                    }
+                    append_utf8(out, code);
+                    break;
+                }
+                default:
+                    fail("Invalid escape sequence");
+            }
+        }
+    }
+
+    const std::string& text_;
+    size_t pos_ {0};
+};
+
+const char* type_names[] = {"null", "a boolean", "a number", "a string", "an array", "an object"};
+
+void dump_string(std::string& out, const std::string& value) {
+    out += '"';
+    for (char c: value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+void check_type(Json::Type actual, Json::Type expected) {
+    if (actual != expected) {
+        throw std::invalid_argument(std::string("Expected ") + type_names[static_cast<int>(expected)] +
+                                    ", got " + type_names[static_cast<int>(actual)]);
+    }
+}
+
+}
+
+Json::Json(bool value): type_(Type::BOOLEAN), bool_(value) {}
+Json::Json(double value): type_(Type::NUMBER), number_(value) {}
+Json::Json(const std::string& value): type_(Type::STRING), string_(value) {}
+Json::Json(const char* value): type_(Type::STRING), string_(value) {}
+Json::Json(Array value): type_(Type::ARRAY), array_(std::move(value)) {}
+Json::Json(Object value): type_(Type::OBJECT), object_(std::move(value)) {}
+
+Json Json::parse(const std::string& text) {
+    return Parser(text).document();
+}
+
+bool Json::as_bool() const {
+    check_type(this->type_, Type::BOOLEAN);
+    return this->bool_;
+}
+
+double Json::as_number() const {
+    check_type(this->type_, Type::NUMBER);
+    return this->number_;
+}
+
+int Json::as_int() const {
+    check_type(this->type_, Type::NUMBER);
+    // Converting a double outside the range of int is undefined
+    if (!std::isfinite(this->number_) || this->number_ <= static_cast<double>(INT_MIN) - 1 ||
+        this->number_ >= static_cast<double>(INT_MAX) + 1) {
+        throw std::invalid_argument("Expected an integer, got " + std::to_string(this->number_));
+    }
+    return static_cast<int>(this->number_);
+}
+
+const std::string& Json::as_string() const {
+    check_type(this->type_, Type::STRING);
+    return this->string_;
+}
+
+const Json::Array& Json::as_array() const {
+    check_type(this->type_, Type::ARRAY);
+    return this->array_;
+}
+
+const Json::Object& Json::as_object() const {
+    check_type(this->type_, Type::OBJECT);
+    return this->object_;
+}
+
+bool Json::has(const std::string& key) const {
+    return !(*this)[key].is_null();
+}
+
+const Json& Json::operator[](const std::string& key) const {
+    if (this->type_ == Type::OBJECT) {
+        for (const auto& [name, value]: this->object_) {
+            if (name == key) {
+                return value;
+            }
+        }
+    }
+    return nullJson;
+}
+
+void Json::set(const std::string& key, Json value) {
+    check_type(this->type_, Type::OBJECT);
+    for (auto& [name, member]: this->object_) {
+        if (name == key) {
+            member = std::move(value);
+            return;
+        }
+    }
+    this->object_.emplace_back(key, std::move(value));
+}
+
+void Json::push_back(Json value) {
+    check_type(this->type_, Type::ARRAY);
+    this->array_.push_back(std::move(value));
+}
+
+std::string Json::to_string() const {
+    if (this->type_ == Type::STRING) {
+        return this->string_;
+    }
+    if (this->type_ != Type::NUMBER) {
+        throw std::invalid_argument("Expected a string or a number");
+    }
+
+    // Integers without a fraction, other values with the shortest round trip form
+    if (std::trunc(this->number_) == this->number_ && std::fabs(this->number_) < 1e15) {
+        return std::to_string(static_cast<long long>(this->number_));
+    }
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), this->number_);
+    return std::string(buffer, end);
+}
+
+std::string Json::dump() const {
+    std::string out;
+    dump(out, false);
+    return out;
+}
+
+std::string Json::canonical() const {
+    std::string out;
+    dump(out, true);
+    return out;
+}
+
+void Json::dump(std::string& out, bool sorted) const {
+    switch (this->type_) {
+        case Type::NUL:
+            out += "null";
+            break;
+        case Type::BOOLEAN:
+            out += this->bool_ ? "true" : "false";
+            break;
+        case Type::NUMBER:
+            // JSON has no NaN nor Infinity
+            out += std::isfinite(this->number_) ? to_string() : "null";
+            break;
+        case Type::STRING:
+            dump_string(out, this->string_);
+            break;
+        case Type::ARRAY:
+            out += '[';
+            for (size_t i = 0; i < this->array_.size(); i++) {
+                if (i > 0) {
+                    out += ',';
+                }
+                this->array_[i].dump(out, sorted);
+            }
+            out += ']';
+            break;
+        case Type::OBJECT: {
+            std::vector<const std::pair<std::string, Json>*> members;
+            for (const auto& member: this->object_) {
+                members.push_back(&member);
+            }
+            if (sorted) {
+                std::stable_sort(members.begin(), members.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+            }
+            out += '{';
+            for (size_t i = 0; i < members.size(); i++) {
+                if (i > 0) {
+                    out += ',';
+                }
+                dump_string(out, members[i]->first);
+                out += ':';
+                members[i]->second.dump(out, sorted);
+            }
+            out += '}';
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,86 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jsvips {
+
+    //
+    // Small JSON document model, enough for template and job files. Objects
+    // keep the order of their keys, like JS objects do.
+    //
+    class Json {
+      public:
+        enum class Type {
+            NUL,
+            BOOLEAN,
+            NUMBER,
+            STRING,
+            ARRAY,
+            OBJECT
+        };
+
+        using Array = std::vector<Json>;
+        using Object = std::vector<std::pair<std::string, Json>>;
+
+        Json() = default;
+        Json(bool value);
+        Json(double value);
+        Json(const std::string& value);
+        Json(const char* value);
+        Json(Array value);
+        Json(Object value);
+
+        // Parse a document, throws std::invalid_argument with the offset of the error
+        static Json parse(const std::string& text);
+
+        Type type() const { return type_; }
+        bool is_null() const { return type_ == Type::NUL; }
+        bool is_bool() const { return type_ == Type::BOOLEAN; }
+        bool is_number() const { return type_ == Type::NUMBER; }
+        bool is_string() const { return type_ == Type::STRING; }
+        bool is_array() const { return type_ == Type::ARRAY; }
+        bool is_object() const { return type_ == Type::OBJECT; }
+
+        // Accessors throw std::invalid_argument on a type mismatch, as_int
+        // also for a number out of the range of int (the fraction is dropped)
+        bool as_bool() const;
+        double as_number() const;
+        int as_int() const;
+        const std::string& as_string() const;
+        const Array& as_array() const;
+        const Object& as_object() const;
+
+        // Object members, a missing key is null
+        bool has(const std::string& key) const;
+        const Json& operator[](const std::string& key) const;
+        void set(const std::string& key, Json value);
+
+        void push_back(Json value);
+
+        // Strings as they are, numbers formatted the way JS does for the usual values
+        std::string to_string() const;
+
+        // Serialize the document on one line
+        std::string dump() const;
+
+        // Serialize with the members of objects sorted by key: documents equal
+        // but for the order of their members give the same text
+        std::string canonical() const;
+
+      private:
+        void dump(std::string& out, bool sorted) const;
+
+        Type type_ {Type::NUL};
+        bool bool_ {false};
+        double number_ {0};
+        std::string string_;
+        Array array_;
+        Object object_;
+    };
+
+}
+
+#endif
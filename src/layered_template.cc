@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "drawing.h"
+#include "layered_template.h"
+#include "trace.h"
+#include "utils.h"
+
+using namespace vips;
+
+LayeredTemplate::LayeredTemplate(const TemplateOptions& options): options_(options) {
+    jsvips::TraceSpan span("compile template");
+    span.arg("layers", options.layers.size()).arg("slots", options.slots.size());
+
+    VImage base = jsvips::create_rgb_image(options);
+    const int width = base.width();
+    const int height = base.height();
+
+    // 1. Flatten the static layers into the background
+    std::vector<VImage> layers = {base};
+    std::vector<int> xLayer;
+    std::vector<int> yLayer;
+    for (const CountdownComponent& layer: this->options_.layers) {
+        ColoredTextOptions layerOpts = jsvips::text_options(layer, layer.paddingTop, layer.paddingBottom);
+        layerOpts.width = layer.position.width;
+        layerOpts.height = layer.position.height;
+
+        layers.push_back(jsvips::colored_text_image(layer.text, layerOpts));
+        xLayer.push_back(layer.position.x);
+        yLayer.push_back(layer.position.y);
+    }
+
+    VImage background = base;
+    if (layers.size() > 1) {
+        std::vector<int> modes = {VIPS_BLEND_MODE_OVER};
+        background = VImage::composite(layers, modes, VImage::option()->set("x", xLayer)->set("y", yLayer));
+        // The alpha band added by the composite is opaque
+        background = background.extract_band(0, VImage::option()->set("n", 3));
+    }
+    this->background_ = background.copy_memory();
+
+    // 2. Clip the slot boxes to the canvas and pre-render the enumerable values
+    for (auto& [name, slot]: this->options_.slots) {
+        int left = std::max(0, slot.position.x);
+        int top = std::max(0, slot.position.y);
+        int right = std::min(width, slot.position.x + slot.position.width);
+        int bottom = std::min(height, slot.position.y + slot.position.height);
+        if (right <= left || bottom <= top) {
+            throw std::invalid_argument("Slot " + name + " is outside of the image");
+        }
+
+        slot.area.x = left;
+        slot.area.y = top;
+        slot.area.width = right - left;
+        slot.area.height = bottom - top;
+
+        for (const std::string& value: slot.values) {
+            this->tiles_[name][value] = slot_tile(slot, value);
+        }
+    }
+}
+
+/**
+ * The box of a slot showing value: the text flattened onto the background it
+ * covers, opaque sRGB kept in memory.
+ */
+VImage LayeredTemplate::slot_tile(const TemplateSlot& slot, const std::string& value) const {
+    char* escaped = g_markup_escape_text(value.c_str(), -1);
+    std::string text = escaped;
+    g_free(escaped);
+    if (slot.textTemplate.size() > 0) {
+        text = jsvips::expand_template(slot.textTemplate, text);
+    }
+
+    const Position2D& area = slot.area;
+    VImage patch = this->background_.extract_area(area.x, area.y, area.width, area.height);
+    if (text.empty()) {
+        return patch.copy_memory();
+    }
+
+    ColoredTextOptions textOpts = jsvips::text_options(slot, slot.paddingTop, slot.paddingBottom);
+    textOpts.width = slot.position.width;
+    textOpts.height = slot.position.height;
+
+    VImage textImage = jsvips::colored_text_image(text, textOpts);
+    VImage tile = patch.composite(textImage, VIPS_BLEND_MODE_OVER,
+                                  VImage::option()->set("x", slot.position.x - area.x)->set("y", slot.position.y - area.y));
+    return tile.extract_band(0, VImage::option()->set("n", 3)).copy_memory();
+}
+
+/**
+ * Tile of a free text value, rendered on first use
+ */
+VImage LayeredTemplate::cached_slot_tile(const std::string& name, const TemplateSlot& slot, const std::string& value) const {
+    const std::string key = name + "\n" + value;
+    {
+        std::lock_guard<std::mutex> lock(this->cacheMutex_);
+        auto it = this->cacheIndex_.find(key);
+        if (it != this->cacheIndex_.end()) {
+            this->cacheHits_++;
+            this->cache_.splice(this->cache_.begin(), this->cache_, it->second);
+            return it->second->second;
+        }
+        this->cacheMisses_++;
+    }
+
+    // Rendered without the lock, two jobs may render the same value at once
+    VImage tile = slot_tile(slot, value);
+
+    std::lock_guard<std::mutex> lock(this->cacheMutex_);
+    if (this->options_.cacheSize > 0 && this->cacheIndex_.find(key) == this->cacheIndex_.end()) {
+        this->cache_.emplace_front(key, tile);
+        this->cacheIndex_[key] = this->cache_.begin();
+        while (this->cache_.size() > this->options_.cacheSize) {
+            this->cacheIndex_.erase(this->cache_.back().first);
+            this->cache_.pop_back();
+        }
+    }
+    return tile;
+}
+
+VImage LayeredTemplate::render(const std::map<std::string, std::string>& values) const {
+    jsvips::TraceSpan span("render template");
+    span.arg("values", values.size());
+
+    VImage image = this->background_;
+
+    for (const auto& [name, value]: values) {
+        auto slot = this->options_.slots.find(name);
+        if (slot == this->options_.slots.end()) {
+            throw std::invalid_argument("Unknown slot " + name);
+        }
+
+        VImage tile;
+        if (slot->second.values.empty()) {
+            tile = cached_slot_tile(name, slot->second, value);
+        } else {
+            const auto& tiles = this->tiles_.at(name);
+            auto it = tiles.find(value);
+            if (it == tiles.end()) {
+                throw std::invalid_argument("Value " + value + " is not allowed in slot " + name);
+            }
+            tile = it->second;
+        }
+
+        image = image.insert(tile, slot->second.area.x, slot->second.area.y);
+    }
+
+    return image;
+}
+
+LayeredTemplateStats LayeredTemplate::stats() const {
+    LayeredTemplateStats stats;
+    for (const auto& [name, slotTiles]: this->tiles_) {
+        stats.tiles += slotTiles.size();
+    }
+
+    std::lock_guard<std::mutex> lock(this->cacheMutex_);
+    stats.cached = this->cache_.size();
+    stats.cacheHits = this->cacheHits_;
+    stats.cacheMisses = this->cacheMisses_;
+    return stats;
+}
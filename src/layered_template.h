@@ -0,0 +1,64 @@
+#ifndef LAYERED_TEMPLATE_H
+#define LAYERED_TEMPLATE_H
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vips/vips8>
+
+#include "render_options.h"
+
+struct LayeredTemplateStats {
+    // Pre-rendered values
+    size_t tiles {0};
+    // Free text values in the cache
+    size_t cached {0};
+    uint64_t cacheHits {0};
+    uint64_t cacheMisses {0};
+};
+
+//
+// A layered template. Every slot value is flattened onto the background it
+// covers, so rendering only copies opaque tiles into the background.
+//
+class LayeredTemplate {
+  public:
+    // Flattens the static layers and pre-renders the enumerable slot values.
+    // Throws std::invalid_argument for a slot outside of the image.
+    explicit LayeredTemplate(const TemplateOptions& options);
+
+    const TemplateOptions& options() const { return options_; }
+    const vips::VImage& background() const { return background_; }
+
+    // Insert the tiles of the slot values into the background. Slots without
+    // a value show the background. Throws std::invalid_argument for an
+    // unknown slot or a value outside of the domain of the slot.
+    vips::VImage render(const std::map<std::string, std::string>& values) const;
+
+    LayeredTemplateStats stats() const;
+
+  private:
+    using CacheEntry = std::pair<std::string, vips::VImage>;
+
+    vips::VImage slot_tile(const TemplateSlot& slot, const std::string& value) const;
+    vips::VImage cached_slot_tile(const std::string& name, const TemplateSlot& slot, const std::string& value) const;
+
+    TemplateOptions options_;
+    vips::VImage background_;
+    // Tiles of the enumerable slots: slot -> value -> tile
+    std::map<std::string, std::map<std::string, vips::VImage>> tiles_;
+
+    // Tiles of free text values, the least recently used is dropped first
+    mutable std::mutex cacheMutex_;
+    mutable std::list<CacheEntry> cache_;
+    mutable std::unordered_map<std::string, std::list<CacheEntry>::iterator> cacheIndex_;
+    mutable uint64_t cacheHits_ {0};
+    mutable uint64_t cacheMisses_ {0};
+};
+
+#endif
@@ -1,9 +1,244 @@
+#include <cmath>
 #include <iostream>
+#include <limits>
+#include "blend.h"
+#include "disk_cache.h"
+#include "drawing.h"
+#include "gif_encoder.h"
+#include "image_cache.h"
+#include "quantizer.h"
+#include "trace.h"
 #include "utils.h"
 #include "native_image.h"
 
 using namespace vips;
 
+enum class AsyncJobResult {
+    NUMBER,
+    PATH,
+    BUFFER,
+    // An object of buffers, one per output format
+    OUTPUTS,
+    // An object of OUTPUTS results, one per density
+    SCALED
+};
+
+struct AsyncJobContext {
+    explicit AsyncJobContext(Napi::Env env): deferred(Napi::Promise::Deferred::New(env)) {}
+
+    ~AsyncJobContext() {
+        g_free(this->data);
+    }
+
+    Napi::Promise::Deferred deferred;
+    Napi::ThreadSafeFunction tsfn;
+    // Keeps the NativeImage alive while the job is in flight
+    Napi::ObjectReference self;
+    Napi::ObjectReference signal;
+    Napi::FunctionReference abortListener;
+    std::shared_ptr<RenderJob> job;
+
+    // Filled in by the worker thread
+    JobStatus status {JobStatus::DONE};
+    std::string error;
+    std::string code;
+    AsyncJobResult result {AsyncJobResult::NUMBER};
+    void* data {nullptr};
+    size_t size {0};
+    std::vector<uint8_t> bytes;
+    std::string path;
+    CountdownOutputs outputs;
+    MappedOutputs mapped;
+    std::map<std::string, std::pair<CountdownOutputs, MappedOutputs>> scaled;
+    // Resolve with this output alone instead of the object of outputs
+    std::string output;
+    // Runs on the JS thread before the promise is resolved
+    std::function<void()> then;
+    // A template edit another job may publish, the promise settles with its outcome
+    std::shared_ptr<EditOutcome> edit;
+};
+
+void EditOutcome::settle(std::exception_ptr error) {
+    std::function<void(std::exception_ptr)> done;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->settled_ = true;
+        this->error_ = error;
+        done.swap(this->done_);
+    }
+    if (done) {
+        done(error);
+    }
+}
+
+void EditOutcome::when_settled(std::function<void(std::exception_ptr)> done) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (!this->settled_) {
+            this->done_ = std::move(done);
+            return;
+        }
+    }
+    done(this->error_);
+}
+
+static Napi::Error job_error(Napi::Env env, JobStatus status, const std::string& message, const std::string& code) {
+    Napi::Error error = Napi::Error::New(env, message);
+    if (status == JobStatus::CANCELLED) {
+        error.Set("name", Napi::String::New(env, "AbortError"));
+        error.Set("code", Napi::String::New(env, "ABORT_ERR"));
+    } else if (status == JobStatus::TIMED_OUT) {
+        error.Set("code", Napi::String::New(env, "ETIMEDOUT"));
+    } else if (!code.empty()) {
+        error.Set("code", Napi::String::New(env, code));
+    }
+    return error;
+}
+
+// A Buffer over the bytes of the vector, without copying them
+static Napi::Buffer<char> external_buffer(Napi::Env env, std::vector<uint8_t>&& data) {
+    auto* bytes = new std::vector<uint8_t>(std::move(data));
+    return Napi::Buffer<char>::New(env, reinterpret_cast<char*>(bytes->data()), bytes->size(),
+        [](Napi::Env, char*, std::vector<uint8_t>* bytes) { delete bytes; }, bytes);
+}
+
+// A Buffer over a file of the disk cache, the mapping lives as long as the Buffer
+static Napi::Buffer<char> mapped_buffer(Napi::Env env, const std::shared_ptr<const MappedFile>& file) {
+    auto* owner = new std::shared_ptr<const MappedFile>(file);
+    return Napi::Buffer<char>::New(env, reinterpret_cast<char*>(file->data()), file->size(),
+        [](Napi::Env, char*, std::shared_ptr<const MappedFile>* owner) { delete owner; }, owner);
+}
+
+static Napi::Object outputs_object(Napi::Env env, CountdownOutputs&& outputs, const MappedOutputs& mapped = {}) {
+    Napi::Object result = Napi::Object::New(env);
+    for (auto& [name, data]: outputs) {
+        result.Set(name, external_buffer(env, std::move(data)));
+    }
+    for (const auto& [name, file]: mapped) {
+        result.Set(name, mapped_buffer(env, file));
+    }
+    return result;
+}
+
+// Lossy GIFs are encoded by this library, libvips has no lossy LZW
+static bool lossy_gif(const std::string& toFile, const std::string& format, int lossy) {
+    return lossy > 0 && (toFile.empty() ? format == "gif" : jsvips::has_extension(toFile, ".gif"));
+}
+
+// The template compiled at a density the render asks for
+static const CountdownRenderer& scaled_renderer(const CountdownRenderer& countdown, double scale) {
+    const CountdownRenderer* renderer = countdown.at_scale(scale);
+    if (renderer == nullptr) {
+        throw std::invalid_argument("The template has no scale " + jsvips::scale_name(scale));
+    }
+    return *renderer;
+}
+
+static const CountdownLocale& locale_of(const CountdownRenderer& countdown, const std::string& lang) {
+    const CountdownLocale* locale = countdown.find_locale(lang);
+    if (locale == nullptr) {
+        throw std::invalid_argument("Unknown language " + lang);
+    }
+    return *locale;
+}
+
+// Render on the daemon, each density of scales under its name or the outputs
+// of the render under "". A file of toFile is written here, with no result.
+static std::map<std::string, MappedOutputs> render_on_daemon(const jsvips::DaemonTemplate& remote, const std::vector<int>& start,
+                                                             int frames, CountdownRenderOptions options) {
+    std::map<std::string, MappedOutputs> results;
+    if (!options.toFile.empty()) {
+        const std::string format = jsvips::has_extension(options.toFile, ".gif") ? "gif"
+                                 : jsvips::has_extension(options.toFile, ".webp") ? "webp" : "";
+        if (format.empty()) {
+            throw std::invalid_argument("The render daemon writes .gif and .webp files");
+        }
+        options.outputs = {format};
+        MappedOutputs files = remote.render(start, frames, options);
+        const MappedFile& file = *files.at(format);
+        jsvips::write_file(options.toFile, std::vector<uint8_t>(file.data(), file.data() + file.size()));
+        return results;
+    }
+
+    if (options.scales.empty()) {
+        results[""] = remote.render(start, frames, options);
+        return results;
+    }
+    for (double scale: options.scales) {
+        options.scale = scale;
+        results[jsvips::scale_name(scale)] = remote.render(start, frames, options);
+    }
+    return results;
+}
+
+// Runs on the JS thread: settle the promise and release the context
+static void settle_job(Napi::Env env, AsyncJobContext* ctx) {
+    Napi::HandleScope scope(env);
+
+    if (!ctx->signal.IsEmpty()) {
+        Napi::Object signal = ctx->signal.Value();
+        signal.Get("removeEventListener").As<Napi::Function>().Call(signal, {Napi::String::New(env, "abort"), ctx->abortListener.Value()});
+    }
+
+    if (ctx->status == JobStatus::DONE && ctx->then) {
+        ctx->then();
+    }
+
+    if (ctx->status != JobStatus::DONE) {
+        ctx->deferred.Reject(job_error(env, ctx->status, ctx->error, ctx->code).Value());
+    } else if (ctx->result == AsyncJobResult::BUFFER && ctx->data != nullptr) {
+        // Hand the libvips allocation over to the Buffer without copying
+        char* data = static_cast<char*>(ctx->data);
+        ctx->data = nullptr;
+        ctx->deferred.Resolve(Napi::Buffer<char>::New(env, data, ctx->size, [](Napi::Env, char* data) { g_free(data); }));
+    } else if (ctx->result == AsyncJobResult::BUFFER) {
+        ctx->deferred.Resolve(external_buffer(env, std::move(ctx->bytes)));
+    } else if (ctx->result == AsyncJobResult::OUTPUTS) {
+        Napi::Object outputs = outputs_object(env, std::move(ctx->outputs), ctx->mapped);
+        ctx->deferred.Resolve(ctx->output.empty() ? outputs : outputs.Get(ctx->output));
+    } else if (ctx->result == AsyncJobResult::SCALED) {
+        Napi::Object result = Napi::Object::New(env);
+        for (auto& [scale, files]: ctx->scaled) {
+            Napi::Object outputs = outputs_object(env, std::move(files.first), files.second);
+            result.Set(scale, ctx->output.empty() ? outputs : outputs.Get(ctx->output));
+        }
+        ctx->deferred.Resolve(result);
+    } else if (ctx->result == AsyncJobResult::PATH) {
+        ctx->deferred.Resolve(Napi::String::New(env, ctx->path));
+    } else {
+        ctx->deferred.Resolve(Napi::Number::New(env, 0));
+    }
+
+    delete ctx;
+}
+
+// A finite number of bytes, 0 or more, that fits a size_t
+static bool byte_count(const Napi::Value& value, size_t& bytes) {
+    if (!value.IsNumber()) {
+        return false;
+    }
+    const double number = value.As<Napi::Number>().DoubleValue();
+    if (!std::isfinite(number) || number < 0 || number >= static_cast<double>(std::numeric_limits<size_t>::max())) {
+        return false;
+    }
+    bytes = static_cast<size_t>(number);
+    return true;
+}
+
+// Errors of the rendering core: invalid options and values are type errors,
+// a render daemon that does not answer is ETIMEDOUT
+static void throw_error(Napi::Env env, const std::exception& e) {
+    if (dynamic_cast<const std::invalid_argument*>(&e) != nullptr) {
+        Napi::TypeError::New(env, e.what()).ThrowAsJavaScriptException();
+    } else {
+        Napi::Error error = Napi::Error::New(env, e.what());
+        if (dynamic_cast<const jsvips::DaemonTimeout*>(&e) != nullptr) {
+            error.Set("code", Napi::String::New(env, "ETIMEDOUT"));
+        }
+        error.ThrowAsJavaScriptException();
+    }
+}
+
 NativeImage::NativeImage(const Napi::CallbackInfo& info): Napi::ObjectWrap<NativeImage>(info) {
     mode_ = ImageMode::IMAGE;
     Napi::Env env = info.Env();
@@ -14,93 +249,85 @@ NativeImage::NativeImage(const Napi::CallbackInfo& info): Napi::ObjectWrap<Nativ
     }
 
     this->mode_ = ImageMode::IMAGE;
+    // An instance to clone, see Clone
+    if (info[0].IsExternal()) {
+        const NativeImage* source = info[0].As<Napi::External<NativeImage>>().Data();
+        this->image_ = source->image_;
+        this->base_ = source->base_;
+        this->imageOriginalPath_ = source->imageOriginalPath_;
+        this->mode_ = source->mode_;
+        std::atomic_store(&this->countdown_, source->countdown_snapshot());
+        std::atomic_store(&this->layeredTemplate_, source->template_snapshot());
+        std::atomic_store(&this->daemonTemplate_, source->daemon_snapshot());
+        return;
+    }
+
     // First argument is the path to the image file or configuration file
     if (info[0].IsString()) {
         std::string path = info[0].As<Napi::String>().Utf8Value();
-        this->image_ = VImage::new_from_file(path.c_str(), VImage::option ()->set ("access", VIPS_ACCESS_SEQUENTIAL));
+        try {
+            this->image_ = ImageCache::shared().load(path);
+        } catch (const std::exception& e) {
+            throw_error(env, e);
+            return;
+        }
         this->imageOriginalPath_ = path;
     } else if (info[0].IsObject()) {
-//        std::cout << "NativeImage object" << std::endl;
-        Napi::Object options = info[0].As<Napi::Object>();
-        CreationOptions opts = parse_creation_options(options);
-        this->image_ = create_rgb_Image(opts);
+        int mode = static_cast<int>(ImageMode::IMAGE);
         if (info.Length() >= 2) {
             // Extra arguments are available
             if (!info[1].IsNumber()) {
                 Napi::TypeError::New(env, "Invalid mode").ThrowAsJavaScriptException();
+                return;
             }
+            mode = info[1].As<Napi::Number>().Int32Value();
+        }
+
+        try {
+            jsvips::Json options = to_json(info[0]);
 
             // create the template
-            if (info[1].As<Napi::Number>().Int32Value() == 1) {
+            if (mode == static_cast<int>(ImageMode::IMAGE)) {
+                this->image_ = jsvips::create_rgb_image(jsvips::parse_creation_options(options));
+            } else if (mode == static_cast<int>(ImageMode::COUNTDOWN) && info.Length() >= 3 && info[2].IsObject() &&
+                       info[2].As<Napi::Object>().Get("daemon").IsString()) {
+                // Compiled and rendered by the render daemon, the image is the blank canvas
                 this->mode_ = ImageMode::COUNTDOWN;
-
-                // Parse the countdown options
-                this->countdownOptions_ = parse_countdown_options(options);
-
-                // Parpare the template
-                init_countdown_animation();
-
+                if (info[0].As<Napi::Object>().Get("background").IsBuffer()) {
+                    throw std::invalid_argument("The background of a template of the render daemon must be a file");
+                }
+                Napi::Object createOptions = info[2].As<Napi::Object>();
+                std::string daemon = createOptions.Get("daemon").As<Napi::String>().Utf8Value();
+                int timeout = jsvips::DaemonClient::defaultTimeout;
+                if (createOptions.Has("daemonTimeout") && !createOptions.Get("daemonTimeout").IsUndefined()) {
+                    if (!createOptions.Get("daemonTimeout").IsNumber()) {
+                        throw std::invalid_argument("Attribute daemonTimeout must be a number");
+                    }
+                    timeout = createOptions.Get("daemonTimeout").As<Napi::Number>().Int32Value();
+                }
+                // Blocks until the daemon has compiled the template, at most timeout
+                this->daemonTemplate_ = jsvips::DaemonTemplate::load(jsvips::DaemonClient::shared(daemon, timeout), options);
+                this->image_ = jsvips::create_rgb_image(jsvips::parse_creation_options(options));
+            } else if (mode == static_cast<int>(ImageMode::COUNTDOWN)) {
+                this->mode_ = ImageMode::COUNTDOWN;
+                this->countdown_ = std::make_shared<const CountdownRenderer>(parse_countdown_options(info[0]));
+                // The default language is the image of the object
+                this->image_ = this->countdown_->background();
+            } else if (mode == static_cast<int>(ImageMode::TEMPLATE)) {
+                this->mode_ = ImageMode::TEMPLATE;
+                this->layeredTemplate_ = std::make_shared<const LayeredTemplate>(jsvips::parse_template_options(options));
+                this->image_ = this->layeredTemplate_->background();
             } else {
                 Napi::TypeError::New(env, "Invalid mode").ThrowAsJavaScriptException();
             }
+        } catch (const std::exception& e) {
+            throw_error(env, e);
         }
     } else {
         Napi::TypeError::New(env, "Invalid the first argument.").ThrowAsJavaScriptException();
     }
 }
 
-void NativeImage::init_countdown_animation() {
-    // 1. Create an empty image with background color - allready done!
-
-    std::vector<VImage> labels;
-    std::vector<int> modes = {VIPS_BLEND_MODE_OVER};
-    std::vector<int> xLabel;
-    std::vector<int> yLabel;
-
-    // 2. Added background images
-    labels.push_back(this->image_);
-
-    // 3. Create labels images
-    for (const auto& [key, value]: this->countdownOptions_.labels) {
-        ColoredTextOptions labelOpts;
-        labelOpts.textColor = hexadecimal_color_to_argb(value.color);
-        labelOpts.font = value.font;
-        labelOpts.fontFile = value.fontFile;
-        labelOpts.width = value.position.width;
-        labelOpts.height = value.position.height;
-        labelOpts.textAlignment = value.textAlignment;
-        labelOpts.paddingTop = value.paddingTop;
-        labelOpts.paddingBottom = value.paddingBottom;
-        
-        VImage labelImage = colored_text_image(value.text, labelOpts);
-        labels.push_back(labelImage);
-        xLabel.push_back(value.position.x);
-        yLabel.push_back(value.position.y);
-    }
-
-    // 3. draw the template
-    this->image_ = VImage::composite(labels, modes, VImage::option()->set("x", xLabel)->set("y", yLabel));
-
-    // 4. Initialize the digits images
-    ColoredTextOptions digitOptions;
-    digitOptions.textColor = hexadecimal_color_to_argb(this->countdownOptions_.digits.style.color);
-    digitOptions.width = this->countdownOptions_.digits.style.width;
-    digitOptions.height = this->countdownOptions_.digits.style.height;
-    digitOptions.font = this->countdownOptions_.digits.style.font;
-    digitOptions.fontFile = this->countdownOptions_.digits.style.fontFile;
-
-    for ( int i = 0; i < 100; i++) {
-        std::string digitalText = jsvips::format("%02d", i);
-        if (this->countdownOptions_.digits.textTemplate.size() > 0) {
-            digitalText = jsvips::format(this->countdownOptions_.digits.textTemplate, digitalText.c_str());
-        }
-
-        VImage digit = colored_text_image(digitalText, digitOptions);
-        this->countdownDigits_.push_back(digit);
-    }
-
-}
-
 Napi::Object NativeImage::Init(Napi::Env env, Napi::Object exports) {
     Napi::HandleScope scope(env);
 
@@ -108,9 +335,33 @@ Napi::Object NativeImage::Init(Napi::Env env, Napi::Object exports) {
         StaticMethod<&NativeImage::CreateSRGBImage>("createSRGBImage", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
         InstanceMethod<&NativeImage::Save>("save", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
         InstanceMethod<&NativeImage::DrawText>("drawText", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::Clone>("clone", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
         StaticMethod<&NativeImage::CreateCountdownAnimation>("createCountdownAnimation", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
         InstanceMethod<&NativeImage::RenderCountdownAnimation>("renderCountdownAnimation", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
         StaticMethod<&NativeImage::CreateText>("createText", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::RenderCountdownAnimationAsync>("renderCountdownAnimationAsync", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::SaveAsync>("saveAsync", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::ConfigureScheduler>("configureScheduler", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::GetSchedulerStats>("schedulerStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::MemoryStats>("memoryStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::ConfigureImageCache>("configureImageCache", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::GetImageCacheStats>("imageCacheStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::InvalidateImageCache>("invalidateImageCache", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::ConfigureDiskCache>("configureDiskCache", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::GetDiskCacheStats>("diskCacheStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::GetGifStats>("gifStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::SetBlendKernel>("setBlendKernel", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::StartTrace>("startTrace", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::StopTrace>("stopTrace", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::RenderDaemonStats>("renderDaemonStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        StaticMethod<&NativeImage::CreateTemplate>("createTemplate", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::Render>("render", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::RenderAsync>("renderAsync", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::TemplateStats>("templateStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::FramePoolStats>("framePoolStats", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::UpdateTemplate>("updateTemplate", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::UpdateLabel>("updateLabel", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+        InstanceMethod<&NativeImage::UpdateDigitStyle>("updateDigitStyle", static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
     });
 
     // Create a persistent reference to the class constructor. This will allow
@@ -161,7 +412,7 @@ Napi::Value NativeImage::CreateSRGBImage(const Napi::CallbackInfo& info) {
  */
 Napi::Value NativeImage::DrawText(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
-    Napi::HandleScope scope(env);
+    Napi::EscapableHandleScope scope(env);
 
     if (info.Length() < 4) {
         Napi::TypeError::New(env, "Missing parameters").ThrowAsJavaScriptException();
@@ -187,8 +438,7 @@ Napi::Value NativeImage::DrawText(const Napi::CallbackInfo& info) {
     const double topY = info[2].As<Napi::Number>().DoubleValue();
 
     std::string color = "#000000";
-
-    auto opts = VImage::option();
+    std::string font;
 
     if (info.Length() > 3) {
         if (!info[3].IsObject()) {
@@ -202,7 +452,7 @@ Napi::Value NativeImage::DrawText(const Napi::CallbackInfo& info) {
                 Napi::TypeError::New(env, "Invalid font").ThrowAsJavaScriptException();
             }
 //            std::cout << "font: " << options.Get("font").As<Napi::String>().Utf8Value() << std::endl;
-            opts->set("font", options.Get("font").As<Napi::String>().Utf8Value().c_str());
+            font = options.Get("font").As<Napi::String>().Utf8Value();
         }
 
         if (options.Has("fontFile")) {
@@ -225,29 +475,48 @@ Napi::Value NativeImage::DrawText(const Napi::CallbackInfo& info) {
         }
     }
 
-    auto textColor = hexadecimal_color_to_argb(color);
-
-    // Create a new text image
+    auto textColor = jsvips::hexadecimal_color_to_argb(color);
+    const std::vector<u_char> rgb = {textColor[1], textColor[2], textColor[3]};
 
     // this renders the text to a one-band image ... set width to the pixels across
-    // of the area we want to render to to have it break lines for you
-    VImage textImage = VImage::text(text.c_str(), opts);
-    std::cout << "textImage width: " << textImage.width() << " height: " << textImage.height() << std::endl;
-
-    // make a constant image the size of $text, but with every pixel red ... tag it
-    // as srgb
-    const std::vector<double> bgText = {double(textColor[1]), double(textColor[2]), double(textColor[3])};
-    VImage textImageBg = textImage.new_from_image(bgText).copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB));
+    // of the area we want to render to to have it break lines for you.
+    // Countdowns render it at the dpi of each of their densities.
+    auto mask = [text, font](double scale) {
+        auto opts = VImage::option();
+        if (!font.empty()) {
+            opts->set("font", font.c_str());
+        }
+        if (scale != 1) {
+            opts->set("dpi", static_cast<int>(72 * scale + 0.5));
+        }
+        return VImage::text(text.c_str(), opts);
+    };
 
-    // use the text mask as the alpha for the constant red image
-    VImage overlay = textImageBg.bandjoin(textImage);
+    if (this->mode_ == ImageMode::COUNTDOWN) {
+        return scope.Escape(draw_countdown_text(env, mask, static_cast<int>(topX), static_cast<int>(topY), rgb,
+                                                text + "\n" + font + "\n" + color + "\n" + std::to_string(topX) + "," + std::to_string(topY)));
+    }
 
-    // composite the text on the image
-    this->image_ = this->image_.composite(overlay, VIPS_BLEND_MODE_OVER, VImage::option()->set("x", topX)->set("y", topY));
+    // blend the text mask in its colour over the image
+    this->image_ = jsvips::draw_text(this->image_, mask(1), static_cast<int>(topX), static_cast<int>(topY), rgb);
 
     return Napi::Number::New(env, 0);
 }
 
+Napi::Value NativeImage::draw_countdown_text(Napi::Env env, const CountdownRenderer::TextMask& mask, int x, int y,
+                                             const std::vector<u_char>& colour, const std::string& key) {
+    if (daemon_snapshot()) {
+        Napi::TypeError::New(env, "drawText is not supported on a countdown of the render daemon").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // Drawing on every background frame is slow, a job publishes it like
+    // the other template updates
+    return update_countdown(env, env.Undefined(), [mask, x, y, colour, key](const CountdownRenderer& countdown) {
+        return countdown.with_text(mask, x, y, colour, key);
+    }, nullptr);
+}
+
 /**
  * Save the image to a file
  */
@@ -264,7 +533,21 @@ Napi::Value NativeImage::Save(const Napi::CallbackInfo& info) {
     }
 
     std::string path = info[0].As<Napi::String>().Utf8Value();
-    this->image_.write_to_file(path.c_str());
+    try {
+        SaveOptions saveOptions;
+        if (info.Length() >= 2 && info[1].IsObject()) {
+            saveOptions = jsvips::parse_save_options(to_json(info[1]));
+        }
+
+        if (lossy_gif(path, "", saveOptions.lossy)) {
+            jsvips::write_file(path, jsvips::write_gif(this->image_, saveOptions.lossy));
+        } else {
+            this->image_.write_to_file(path.c_str());
+        }
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
 
     return Napi::Number::New(env, 0);
 }
@@ -285,7 +568,7 @@ Napi::Value NativeImage::CreateCountdownAnimation(const Napi::CallbackInfo& info
     // JS class the constructor represents.
     Napi::Value mode = Napi::Number::New(env, static_cast<int>(ImageMode::COUNTDOWN));
     Napi::FunctionReference* constructor = env.GetInstanceData<Napi::FunctionReference>();
-    Napi::Object obj = constructor->New({info[0], mode});
+    Napi::Object obj = constructor->New({info[0], mode, info.Length() >= 2 ? info[1] : env.Undefined()});
     return scope.Escape(napi_value(obj)).ToObject();
 }
 
@@ -300,620 +583,1381 @@ Napi::Value NativeImage::RenderCountdownAnimation(const Napi::CallbackInfo& info
 
     if (info.Length() < 2) {
         Napi::TypeError::New(env, "At least 2 parameter are required!").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if (!info[0].IsObject()) {
+        Napi::TypeError::New(env, "Invalid start time object").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if (!info[1].IsNumber()) {
+        Napi::TypeError::New(env, "Invalid frames number").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    int frames;
+    try {
+        frames = jsvips::parse_countdown_frames(to_json(info[1]));
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
+
+    if (info.Length() >= 3 && !info[2].IsString() && !info[2].IsObject()) {
+        Napi::TypeError::New(env, "Invalid file path").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    if (this->mode_ != ImageMode::COUNTDOWN) {
+        Napi::TypeError::New(env, "The object is not initialized with countdown mode").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    try {
+        std::vector<int> start = jsvips::parse_countdown_moment_with_number(to_json(info[0]));
+
+        CountdownRenderOptions renderOptions;
+        if (info.Length() >= 3 && info[2].IsString()) {
+            // Directly save to file
+            renderOptions.toFile = info[2].As<Napi::String>().Utf8Value();
+        } else if (info.Length() >= 3) {
+            renderOptions = jsvips::parse_countdown_render_options(to_json(info[2]));
+        }
+        const std::string& outputFilePath = renderOptions.toFile;
+
+        // The render daemon holds the template, its files are mapped into buffers
+        if (std::shared_ptr<const jsvips::DaemonTemplate> remote = daemon_snapshot()) {
+            std::map<std::string, MappedOutputs> results = render_on_daemon(*remote, start, frames, renderOptions);
+            if (!outputFilePath.empty()) {
+                return Napi::String::New(env, outputFilePath);
+            }
+
+            const bool single = renderOptions.outputs.empty();
+            if (renderOptions.scales.empty()) {
+                Napi::Object outputs = outputs_object(env, CountdownOutputs(), results[""]);
+                return single ? outputs.Get("gif") : outputs;
+            }
+            Napi::Object result = Napi::Object::New(env);
+            for (const auto& [density, files]: results) {
+                Napi::Object outputs = outputs_object(env, CountdownOutputs(), files);
+                result.Set(density, single ? outputs.Get("gif") : outputs);
+            }
+            return result;
+        }
+
+        // Renders finish on the template they started with, whatever updates happen meanwhile
+        std::shared_ptr<const CountdownRenderer> snapshot = countdown_snapshot();
+
+        // Several densities at once, each one a GIF buffer or an object of outputs
+        if (!renderOptions.scales.empty()) {
+            const bool single = renderOptions.outputs.empty();
+            if (single) {
+                renderOptions.outputs = {"gif"};
+            }
+
+            Napi::Object result = Napi::Object::New(env);
+            for (double scale: renderOptions.scales) {
+                const CountdownRenderer& renderer = scaled_renderer(*snapshot, scale);
+                CountdownOutputs rendered;
+                MappedOutputs mapped;
+                renderer.render_cached_outputs(start, frames, locale_of(renderer, renderOptions.lang), renderOptions, rendered, mapped);
+
+                Napi::Object outputs = outputs_object(env, std::move(rendered), mapped);
+                result.Set(jsvips::scale_name(scale), single ? outputs.Get("gif") : outputs);
+            }
+            return result;
+        }
+
+        const CountdownRenderer* countdown = &scaled_renderer(*snapshot, renderOptions.scale);
+        const CountdownLocale* locale = &locale_of(*countdown, renderOptions.lang);
+
+        // Several formats from one composition. A GIF buffer goes this way too
+        // when the disk cache is on, as a cached output.
+        const bool single = renderOptions.outputs.empty();
+        if (!single || (outputFilePath.empty() && DiskCache::shared().enabled())) {
+            if (single) {
+                renderOptions.outputs = {"gif"};
+            }
+            CountdownOutputs rendered;
+            MappedOutputs mapped;
+            countdown->render_cached_outputs(start, frames, *locale, renderOptions, rendered, mapped);
+
+            Napi::Object outputs = outputs_object(env, std::move(rendered), mapped);
+            return single ? outputs.Get("gif") : outputs;
+        }
+
+        // Palette-indexed templates are encoded directly
+        if (countdown->encodes_gif(renderOptions)) {
+            std::vector<uint8_t> gif = countdown->render_gif(start, frames, *locale, renderOptions.lossy);
+            if (outputFilePath.empty()) {
+                return Napi::Buffer<char>::Copy(env, reinterpret_cast<char*>(gif.data()), gif.size());
+            }
+            jsvips::write_file(outputFilePath, gif);
+            return Napi::String::New(env, outputFilePath);
+        }
+
+        // Generate animation
+        VImage gifImage = countdown->render_animation(start, frames, *locale);
+
+        // Return buffer or save to file
+        if (outputFilePath.empty()) {
+            // write to a formatted memory buffer
+            size_t size;
+            void *buf;
+            gifImage.write_to_buffer(".gif", &buf, &size);
+            return Napi::Buffer<char>::New(env, static_cast<char*>(buf), size, [](Napi::Env, char* data) { g_free(data); });
+        } else {
+            gifImage.write_to_file(outputFilePath.c_str());
+            return Napi::String::New(env, outputFilePath);
+        }
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
+}
+
+/**
+ *   renderCountdownAnimationAsync(start: CountdownMoment<number>, frames: number, opts?: RenderOptions): Promise<Buffer | string>;
+ * The arguments are checked on the JS thread, the frames are assembled and
+ * encoded by the job scheduler.
+ */
+Napi::Value NativeImage::RenderCountdownAnimationAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() < 2) {
+        Napi::TypeError::New(env, "At least 2 parameter are required!").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
     if (!info[0].IsObject()) {
         Napi::TypeError::New(env, "Invalid start time object").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
-    Napi::Object startObj = info[0].As<Napi::Object>();
-    std::vector<int> start = parse_countdown_moment_with_number(startObj);
 
     if (!info[1].IsNumber()) {
         Napi::TypeError::New(env, "Invalid frames number").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    int frames;
+    try {
+        frames = jsvips::parse_countdown_frames(to_json(info[1]));
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
     }
-    int frames = info[1].As<Napi::Number>().Int32Value();
 
-    std::string outputFilePath;
+    Napi::Value options = env.Undefined();
     if (info.Length() >= 3) {
-        // Directly save to file
-        if (!info[2].IsString()) {
-            Napi::TypeError::New(env, "Invalid file path").ThrowAsJavaScriptException();
+        if (!info[2].IsObject()) {
+            Napi::TypeError::New(env, "Invalid render options").ThrowAsJavaScriptException();
+            return env.Undefined();
         }
-        outputFilePath = info[2].As<Napi::String>().Utf8Value();
+        options = info[2];
     }
 
-    // Generate animation
-    VImage gifImage = render_countdown_animation(start, frames);
-//    std::cout << "Render countdown animation with " << frames << " frames " << gifImage.height() << " height, " << gifImage.width()<< std::endl;
+    if (this->mode_ != ImageMode::COUNTDOWN) {
+        Napi::TypeError::New(env, "The object is not initialized with countdown mode").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
 
-    // Return buffer or save to file
-    if (outputFilePath.empty()) {
-        // write to a formatted memory buffer
-        size_t size;
-        void *buf;
-        gifImage.write_to_buffer(".gif", &buf, &size);
-        return Napi::Buffer<char>::Copy(env, static_cast<char*>(buf), size);
-    } else {
-        gifImage.write_to_file(outputFilePath.c_str());
-        return Napi::String::New(env, outputFilePath);
+    std::shared_ptr<const CountdownRenderer> snapshot = countdown_snapshot();
+    std::shared_ptr<const jsvips::DaemonTemplate> remote = daemon_snapshot();
+    std::vector<int> start;
+    CountdownRenderOptions renderOptions;
+    const CountdownRenderer* countdown = nullptr;
+    const CountdownLocale* locale = nullptr;
+    try {
+        start = jsvips::parse_countdown_moment_with_number(to_json(info[0]));
+        if (options.IsObject()) {
+            renderOptions = jsvips::parse_countdown_render_options(to_json(options));
+        }
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
+
+    // The worker waits for the render daemon, which renders and encodes
+    if (remote) {
+        return schedule(env, options, [remote, start, frames, renderOptions](RenderJob&, AsyncJobContext& ctx) {
+            std::map<std::string, MappedOutputs> results = render_on_daemon(*remote, start, frames, renderOptions);
+            if (!renderOptions.toFile.empty()) {
+                ctx.path = renderOptions.toFile;
+                ctx.result = AsyncJobResult::PATH;
+                return;
+            }
+
+            if (renderOptions.scales.empty()) {
+                ctx.mapped = results[""];
+                ctx.result = AsyncJobResult::OUTPUTS;
+            } else {
+                for (auto& [density, files]: results) {
+                    ctx.scaled[density].second = files;
+                }
+                ctx.result = AsyncJobResult::SCALED;
+            }
+            if (renderOptions.outputs.empty()) {
+                ctx.output = "gif";
+            }
+        });
+    }
+
+    try {
+        for (double scale: renderOptions.scales) {
+            locale_of(scaled_renderer(*snapshot, scale), renderOptions.lang);
+        }
+        countdown = &scaled_renderer(*snapshot, renderOptions.scale);
+        locale = &locale_of(*countdown, renderOptions.lang);
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
     }
+    const std::string outputFilePath = renderOptions.toFile;
+    const bool single = renderOptions.outputs.empty();
+
+    // The densities are rendered one after the other in one job
+    if (!renderOptions.scales.empty()) {
+        if (single) {
+            renderOptions.outputs = {"gif"};
+        }
+        return schedule(env, options, [snapshot, start, frames, renderOptions, single](RenderJob& job, AsyncJobContext& ctx) {
+            auto render = [&](double scale) {
+                const CountdownRenderer& renderer = scaled_renderer(*snapshot, scale);
+                std::pair<CountdownOutputs, MappedOutputs> result;
+                renderer.render_cached_outputs(start, frames, locale_of(renderer, renderOptions.lang), renderOptions,
+                                               result.first, result.second, [&job] {
+                    return job.cancelled() || job.expired();
+                }, [&job](const VImage& animation) {
+                    job.watch(animation);
+                });
+                return result;
+            };
+
+            // In the slot of this job, the libvips pipelines have their own threads
+            for (double scale: renderOptions.scales) {
+                ctx.scaled[jsvips::scale_name(scale)] = render(scale);
+            }
+
+            ctx.result = AsyncJobResult::SCALED;
+            if (single) {
+                ctx.output = "gif";
+            }
+        });
+    }
+
+    if (!single || (outputFilePath.empty() && DiskCache::shared().enabled())) {
+        if (single) {
+            renderOptions.outputs = {"gif"};
+        }
+        return schedule(env, options, [snapshot, countdown, locale, start, frames, renderOptions, single](RenderJob& job, AsyncJobContext& ctx) {
+            countdown->render_cached_outputs(start, frames, *locale, renderOptions, ctx.outputs, ctx.mapped, [&job] {
+                return job.cancelled() || job.expired();
+            }, [&job](const VImage& animation) {
+                job.watch(animation);
+            });
+            ctx.result = AsyncJobResult::OUTPUTS;
+            if (single) {
+                ctx.output = "gif";
+            }
+        });
+    }
+
+    if (countdown->encodes_gif(renderOptions)) {
+        const int lossy = renderOptions.lossy;
+        return schedule(env, options, [snapshot, countdown, locale, start, frames, outputFilePath, lossy](RenderJob& job, AsyncJobContext& ctx) {
+            std::vector<uint8_t> gif = countdown->render_gif(start, frames, *locale, lossy, [&job] {
+                return job.cancelled() || job.expired();
+            });
+            if (outputFilePath.empty()) {
+                ctx.bytes = std::move(gif);
+                ctx.result = AsyncJobResult::BUFFER;
+            } else {
+                jsvips::write_file(outputFilePath, gif);
+                ctx.path = outputFilePath;
+                ctx.result = AsyncJobResult::PATH;
+            }
+        });
+    }
+
+    // The frames are assembled on the worker thread too
+    return schedule(env, options, [snapshot, countdown, locale, start, frames, outputFilePath](RenderJob& job, AsyncJobContext& ctx) {
+        VImage gifImage = countdown->render_animation(start, frames, *locale);
+        job.watch(gifImage);
+        if (outputFilePath.empty()) {
+            gifImage.write_to_buffer(".gif", &ctx.data, &ctx.size);
+            ctx.result = AsyncJobResult::BUFFER;
+        } else {
+            gifImage.write_to_file(outputFilePath.c_str());
+            ctx.path = outputFilePath;
+            ctx.result = AsyncJobResult::PATH;
+        }
+    });
 }
 
-Napi::Value NativeImage::CreateText(const Napi::CallbackInfo& info) {
+//
+// Prepare a layered template with text slots
+//
+Napi::Value NativeImage::CreateTemplate(const Napi::CallbackInfo& info) {
     Napi::Env env = info.Env();
     Napi::EscapableHandleScope scope(env);
 
-    // Retrieve the instance data we stored during `Init()`. We only stored the
-    // constructor there, so we retrieve it here to create a new instance of the
-    // JS class the constructor represents.
+    if (info.Length() == 0) {
+        Napi::TypeError::New(env, "Missing TemplateOptions").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    Napi::Value mode = Napi::Number::New(env, static_cast<int>(ImageMode::TEMPLATE));
     Napi::FunctionReference* constructor = env.GetInstanceData<Napi::FunctionReference>();
-    Napi::Object obj = constructor->New({});
+    Napi::Object obj = constructor->New({info[0], mode});
     return scope.Escape(napi_value(obj)).ToObject();
 }
 
-VImage NativeImage::create_rgb_Image(const CreationOptions& options) {
-    std::vector<u_char> bgColor = hexadecimal_color_to_argb(options.bgColor);
-    std::vector<double> channels = {(double)bgColor[1], (double)bgColor[2], (double)bgColor[3]};
+/**
+ *   render(values: TemplateValues, opts?: TemplateRenderOptions): Buffer | string;
+ */
+Napi::Value NativeImage::Render(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
 
-    // full image.
-    VImage emptyImage = VImage::black(options.width,options.height, VImage::option()->set("bands", 3)) + channels;
-    VImage formatted = emptyImage.cast(VipsBandFormat::VIPS_FORMAT_UCHAR).copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB));
+    if (info.Length() == 0 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Invalid slot values").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
 
-    return formatted;
-}
+    if (info.Length() >= 2 && !info[1].IsObject()) {
+        Napi::TypeError::New(env, "Invalid render options").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
 
-VImage NativeImage::colored_text_image(const std::string &text, const ColoredTextOptions& options) {
-    auto genOpts = VImage::option();
-    if (options.font.size() > 0) {
-//        std::cout << "font " << options.font << std::endl;
-        genOpts->set("font", options.font.c_str());
+    if (this->mode_ != ImageMode::TEMPLATE) {
+        Napi::TypeError::New(env, "The object is not initialized with template mode").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    if (options.fontFile.size() > 0) {
-        genOpts->set("fontfile", options.fontFile.c_str());
+    try {
+        std::map<std::string, std::string> values = jsvips::parse_template_values(to_json(info[0]));
+        TemplateRenderOptions renderOptions;
+        if (info.Length() >= 2) {
+            renderOptions = jsvips::parse_template_render_options(to_json(info[1]));
+        }
+
+        VImage image = template_snapshot()->render(values);
+        if (lossy_gif(renderOptions.toFile, renderOptions.format, renderOptions.lossy)) {
+            std::vector<uint8_t> gif = jsvips::write_gif(image, renderOptions.lossy);
+            if (renderOptions.toFile.empty()) {
+                return Napi::Buffer<char>::Copy(env, reinterpret_cast<char*>(gif.data()), gif.size());
+            }
+            jsvips::write_file(renderOptions.toFile, gif);
+            return Napi::String::New(env, renderOptions.toFile);
+        }
+        if (renderOptions.toFile.empty()) {
+            size_t size;
+            void* buf;
+            image.write_to_buffer(("." + renderOptions.format).c_str(), &buf, &size);
+            return Napi::Buffer<char>::New(env, static_cast<char*>(buf), size, [](Napi::Env, char* data) { g_free(data); });
+        }
+        image.write_to_file(renderOptions.toFile.c_str());
+        return Napi::String::New(env, renderOptions.toFile);
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
     }
+}
 
-    VImage textAlpha = VImage::text(text.c_str(), genOpts);
+/**
+ *   renderAsync(values: TemplateValues, opts?: TemplateRenderOptions & JobOptions): Promise<Buffer | string>;
+ * Free text values are rendered by the job scheduler too.
+ */
+Napi::Value NativeImage::RenderAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
 
-    // Do subtle adjustment to the image for alignment
-    if (options.paddingBottom > 0 || options.paddingTop > 0) {
-        int newHeight = textAlpha.height() + options.paddingTop + options.paddingBottom;
-        int newWidth = textAlpha.width();
+    if (info.Length() == 0 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Invalid slot values").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
 
-        // use default VIPS_EXTEND_BLACK option
-        textAlpha = textAlpha.embed(0, options.paddingTop, newWidth, newHeight);
+    Napi::Value options = env.Undefined();
+    if (info.Length() >= 2) {
+        if (!info[1].IsObject()) {
+            Napi::TypeError::New(env, "Invalid render options").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        options = info[1];
     }
 
-//    std::cout << "render " << text << " xoffset " << textAlpha.xoffset() << " yoffset " << textAlpha.yoffset() << " width " << textAlpha.width() << " height " << textAlpha.height() << std::endl;
-    if (options.width > 0 || options.height > 0) {
-        int outWidth = options.width > 0 ? options.width : textAlpha.width();
-        int outHeight = options.height > 0 ? options.height : textAlpha.height();
+    if (this->mode_ != ImageMode::TEMPLATE) {
+        Napi::TypeError::New(env, "The object is not initialized with template mode").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
 
-        if (outWidth < textAlpha.width() ) {
-            printf("width value [%d] is smaller than the size of text [%d] and reset to text width\n", outWidth, textAlpha.width());
-            outWidth = textAlpha.width();
+    std::map<std::string, std::string> values;
+    TemplateRenderOptions renderOptions;
+    try {
+        values = jsvips::parse_template_values(to_json(info[0]));
+        if (options.IsObject()) {
+            renderOptions = jsvips::parse_template_render_options(to_json(options));
         }
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
+
+    std::shared_ptr<const LayeredTemplate> layered = template_snapshot();
 
-        if (outHeight < textAlpha.height() ) {
-            printf("height value [%d] is smaller than the size of text [%d] and reset to text height\n", outHeight, textAlpha.height());
-            outHeight = textAlpha.height();
+    return schedule(env, options, [layered, values, renderOptions](RenderJob& job, AsyncJobContext& ctx) {
+        VImage image = layered->render(values);
+        job.watch(image);
+        if (lossy_gif(renderOptions.toFile, renderOptions.format, renderOptions.lossy)) {
+            std::vector<uint8_t> gif = jsvips::write_gif(image, renderOptions.lossy);
+            if (renderOptions.toFile.empty()) {
+                ctx.bytes = std::move(gif);
+                ctx.result = AsyncJobResult::BUFFER;
+            } else {
+                jsvips::write_file(renderOptions.toFile, gif);
+                ctx.path = renderOptions.toFile;
+                ctx.result = AsyncJobResult::PATH;
+            }
+        } else if (renderOptions.toFile.empty()) {
+            image.write_to_buffer(("." + renderOptions.format).c_str(), &ctx.data, &ctx.size);
+            ctx.result = AsyncJobResult::BUFFER;
+        } else {
+            image.write_to_file(renderOptions.toFile.c_str());
+            ctx.path = renderOptions.toFile;
+            ctx.result = AsyncJobResult::PATH;
         }
+    });
+}
 
-        textAlpha = textAlpha.gravity(options.textAlignment, outWidth, outHeight);
+Napi::Value NativeImage::TemplateStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
 
+    if (this->mode_ != ImageMode::TEMPLATE) {
+        Napi::TypeError::New(env, "The object is not initialized with template mode").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    // make a constant image the size of $text, but with every pixel red ... tag it
-    // as srgb
-    const std::vector<double> textColor = {(double)options.textColor[0], (double)options.textColor[1], (double)options.textColor[2]};
-    VImage coloredImage = textAlpha.new_from_image(textColor).copy(VImage::option()->set("interpretation", VIPS_INTERPRETATION_sRGB)).bandjoin(textAlpha);
-//    std::cout << "return " << text << " xoffset " << coloredImage.xoffset() << " yoffset " << coloredImage.yoffset() << std::endl;
-    return coloredImage;
-}
+    LayeredTemplateStats templateStats = template_snapshot()->stats();
 
-VImage NativeImage::render_countdown_animation(const std::vector<int> &duration, int frames) {
-    if ( this->mode_ != ImageMode::COUNTDOWN ) {
-        throw std::invalid_argument("The object is not initialized with countdown mode");
-    }
+    Napi::Object stats = Napi::Object::New(env);
+    stats.Set("tiles", Napi::Number::New(env, static_cast<double>(templateStats.tiles)));
+    stats.Set("cached", Napi::Number::New(env, static_cast<double>(templateStats.cached)));
+    stats.Set("cacheHits", Napi::Number::New(env, static_cast<double>(templateStats.cacheHits)));
+    stats.Set("cacheMisses", Napi::Number::New(env, static_cast<double>(templateStats.cacheMisses)));
 
-    int numFrames = frames > 0 ? frames : 1;
+    return scope.Escape(stats);
+}
 
-    std::vector<VImage> pages;
-    std::vector<int> newDuration = duration;
+Napi::Value NativeImage::FramePoolStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
 
-    // Build the position array
-    std::vector<int> xLabel;
-    std::vector<int> yLabel;
-    for (auto cp : this->countdownOptions_.digits.positions) {
-        xLabel.push_back(cp.position.x);
-        yLabel.push_back(cp.position.y);
+    if (this->mode_ != ImageMode::COUNTDOWN) {
+        Napi::TypeError::New(env, "The object is not initialized with countdown mode").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
-    std::vector<int> modes = {VipsBlendMode::VIPS_BLEND_MODE_OVER};
 
-    for (int i = 0; i < numFrames; i++) {
-
-        std::vector<VImage> subImages;
-        // Add background image
-        subImages.push_back(this->image_);
+    std::shared_ptr<const CountdownRenderer> snapshot = countdown_snapshot();
+    if (!snapshot) {
+        Napi::TypeError::New(env, "The frame pool of a template of the render daemon is in the daemon").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    BufferPoolStats poolStats = snapshot->pool_stats();
+
+    Napi::Object stats = Napi::Object::New(env);
+    stats.Set("acquired", Napi::Number::New(env, static_cast<double>(poolStats.acquired)));
+    stats.Set("reused", Napi::Number::New(env, static_cast<double>(poolStats.reused)));
+    stats.Set("allocated", Napi::Number::New(env, static_cast<double>(poolStats.allocated)));
+    stats.Set("released", Napi::Number::New(env, static_cast<double>(poolStats.released)));
+    stats.Set("dropped", Napi::Number::New(env, static_cast<double>(poolStats.dropped)));
+    stats.Set("pooled", Napi::Number::New(env, static_cast<double>(poolStats.pooled)));
+    stats.Set("pooledBytes", Napi::Number::New(env, static_cast<double>(poolStats.pooledBytes)));
+
+    return scope.Escape(stats);
+}
 
-        for (int j = 0; j < lengthOfCountdownMomentParts; j++) {
-            int digitValue = newDuration.at(j);
-            std::string k = countdownMomentPartNames[j];
-            subImages.push_back(this->countdownDigits_.at(digitValue));
-        }
+/**
+ *   updateTemplate(opts: CountdownOptions | TemplateOptions, jobOpts?: JobOptions): Promise<number>;
+ * The new template is compiled by the job scheduler and published with one
+ * atomic pointer swap. Renders in flight finish on the template they started
+ * with, the old template is freed with its last reader.
+ */
+Napi::Value NativeImage::UpdateTemplate(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
 
-        // Build a frame
-        VImage page = VImage::composite(subImages, modes, VImage::option()->set("x", xLabel)->set("y", yLabel));
-        pages.push_back(page);
+    if (info.Length() == 0 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Missing template options").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
 
-        // Next frame
-        newDuration = minus_one_second_to_duration(newDuration);
+    if (this->mode_ != ImageMode::COUNTDOWN && this->mode_ != ImageMode::TEMPLATE) {
+        Napi::TypeError::New(env, "The object is not initialized with countdown or template mode").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    // Join a set of pages vertically to make a multipage image
-    VImage animation = VImage::arrayjoin(pages, VImage::option()->set("across", 1));
-    VImage gifData = animation.copy();
-    gifData.set("page-height", this->image_.height());
+    // Options are checked right away, compiling the template is the slow part
+    std::function<void(uint64_t, AsyncJobContext&)> compile;
+    try {
+        if (std::shared_ptr<const jsvips::DaemonTemplate> remote = daemon_snapshot()) {
+            // Compiled by the daemon the template was created on
+            if (info[0].As<Napi::Object>().Get("background").IsBuffer()) {
+                throw std::invalid_argument("The background of a template of the render daemon must be a file");
+            }
+            jsvips::Json document = to_json(info[0]);
+            jsvips::parse_creation_options(document);
+            std::shared_ptr<jsvips::DaemonClient> client = remote->client;
+            compile = [this, document, client](uint64_t generation, AsyncJobContext& ctx) {
+                publish_template(&NativeImage::daemonTemplate_, generation, jsvips::DaemonTemplate::load(client, document), ctx.then);
+            };
+        } else if (this->mode_ == ImageMode::COUNTDOWN) {
+            CountdownOptions countdownOptions = parse_countdown_options(info[0]);
+            compile = [this, countdownOptions](uint64_t generation, AsyncJobContext& ctx) {
+                publish_template(&NativeImage::countdown_, generation, std::make_shared<const CountdownRenderer>(countdownOptions), ctx.then);
+            };
+        } else {
+            TemplateOptions templateOptions = jsvips::parse_template_options(to_json(info[0]));
+            compile = [this, templateOptions](uint64_t generation, AsyncJobContext& ctx) {
+                publish_template(&NativeImage::layeredTemplate_, generation, std::make_shared<const LayeredTemplate>(templateOptions), ctx.then);
+            };
+        }
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
 
-    // frame delays are in milliseconds ... 300 is pretty slow!
-    std::vector<int> delayArray(pages.size(), 1000);
-    gifData.set("delay", delayArray);
+    // Only a valid update replaces the ones in flight. The edits submitted
+    // before it are dropped, it replaces the whole template.
+    uint64_t generation;
+    std::vector<PendingEdit> dropped;
+    {
+        std::lock_guard<std::mutex> lock(this->publishMutex_);
+        generation = this->replaceGeneration_ = ++this->templateGeneration_;
+        dropped.swap(this->pendingEdits_);
+    }
+    for (const PendingEdit& edit: dropped) {
+        edit.outcome->settle(nullptr);
+    }
 
-    return gifData;
+    return schedule(env, info.Length() >= 2 ? info[1] : env.Undefined(), [compile, generation](RenderJob&, AsyncJobContext& ctx) {
+        compile(generation, ctx);
+    }, [this, generation](const std::string& error) {
+        abandon_template(generation, error);
+    });
 }
 
-CreationOptions NativeImage::parse_creation_options(const Napi::Object& options) {
-    CreationOptions opts;
+/**
+ *   updateLabel(key: string, label: CountdownComponent, jobOpts?: JobOptions): Promise<number>;
+ * Replace or add one label of the countdown template. The label is rendered
+ * again and composed where it was and where it goes, the rest of the
+ * template is kept.
+ */
+Napi::Value NativeImage::UpdateLabel(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
 
-    Napi::Value width = options.Get("width");
-    if (width.IsNumber()) {
-        opts.width = width.As<Napi::Number>().Int32Value();
-    } else {
-        Napi::TypeError::New(options.Env(), "The value of the width should be a number").ThrowAsJavaScriptException();
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsObject()) {
+        Napi::TypeError::New(env, "Missing label key or options").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    Napi::Value height = options.Get("height");
-    if (height.IsNumber()) {
-        opts.height = height.As<Napi::Number>().Int32Value();
-    } else {
-        Napi::TypeError::New(options.Env(), "The value of the height should be a number").ThrowAsJavaScriptException();
+    if (this->mode_ != ImageMode::COUNTDOWN) {
+        Napi::TypeError::New(env, "The object is not initialized with countdown mode").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    Napi::Value bgColor = options.Get("bgColor");
-    if (bgColor.IsString()) {
-        opts.bgColor = bgColor.As<Napi::String>().Utf8Value();
-        if (opts.bgColor.at(0) != '#') {
-            Napi::TypeError::New(options.Env(), "bgColor should be a valid hexadecimal string").ThrowAsJavaScriptException();
-        }
-    } else {
-        Napi::TypeError::New(options.Env(), "bgColor should be a string").ThrowAsJavaScriptException();
+    std::string key = info[0].As<Napi::String>().Utf8Value();
+    jsvips::Json label;
+    try {
+        label = to_json(info[1]);
+        // Checked right away, the template it applies to is read by the job
+        CountdownOptions checked;
+        jsvips::set_countdown_label(checked, key, label);
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
     }
 
-    return opts;
+    return update_countdown(env, info.Length() >= 3 ? info[2] : env.Undefined(), [key, label](const CountdownRenderer& countdown) {
+        CountdownOptions options = countdown.options();
+        jsvips::set_countdown_label(options, key, label);
+        return countdown.with_label(options, key);
+    }, [key, label](jsvips::Json& document) {
+        jsvips::Json labels = document["labels"];
+        labels.set(key, label);
+        document.set("labels", labels);
+    });
 }
 
 /**
- * Parse position options
+ *   updateDigitStyle(style: CountdownComponentStyle, jobOpts?: JobOptions): Promise<number>;
+ * Replace the style of the digits of the countdown template. The digits are
+ * rendered again, the backgrounds and labels are kept.
  */
-Position2D NativeImage::parse_position_2d(const Napi::Object& options) {
-    Position2D position;
+Napi::Value NativeImage::UpdateDigitStyle(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
 
-    // attribute "x" - required
-    if (options.Has("x")) {
-        if (options.Get("x").IsNumber()) {
-            position.x = options.Get("x").As<Napi::Number>().Int32Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute x must be a number").ThrowAsJavaScriptException();
-        }
-    } else {
-        Napi::TypeError::New(options.Env(), "Missing x attribute").ThrowAsJavaScriptException();
+    if (info.Length() == 0 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Missing digit style").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    // attribute "y" - required
-    if (options.Has("y")) {
-        if (options.Get("y").IsNumber()) {
-            position.y = options.Get("y").As<Napi::Number>().Int32Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute y must be a number").ThrowAsJavaScriptException();
-        }
+    if (this->mode_ != ImageMode::COUNTDOWN) {
+        Napi::TypeError::New(env, "The object is not initialized with countdown mode").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    jsvips::Json style;
+    try {
+        style = to_json(info[0]);
+        CountdownOptions checked;
+        jsvips::set_countdown_digit_style(checked, style);
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
+
+    return update_countdown(env, info.Length() >= 2 ? info[1] : env.Undefined(), [style](const CountdownRenderer& countdown) {
+        CountdownOptions options = countdown.options();
+        jsvips::set_countdown_digit_style(options, style);
+        return countdown.with_digit_style(options);
+    }, [style](jsvips::Json& document) {
+        jsvips::Json digits = document["digits"];
+        digits.set("style", style);
+        document.set("digits", digits);
+    });
+}
+
+Napi::Value NativeImage::update_countdown(Napi::Env env, const Napi::Value& jobOptions,
+                                          std::function<std::shared_ptr<const CountdownRenderer>(const CountdownRenderer&)> update,
+                                          std::function<void(jsvips::Json&)> edit) {
+    // Queued in the order of the calls, a job applies the edits queued so far
+    // to the published template
+    const bool remote = daemon_snapshot() != nullptr;
+    uint64_t replaces;
+    std::shared_ptr<EditOutcome> outcome;
+    if (remote) {
+        outcome = queue_edit([edit](const std::shared_ptr<const void>& current) -> std::shared_ptr<const void> {
+            const jsvips::DaemonTemplate& daemon = *std::static_pointer_cast<const jsvips::DaemonTemplate>(current);
+            jsvips::Json document = daemon.document;
+            edit(document);
+            return jsvips::DaemonTemplate::load(daemon.client, document);
+        }, replaces);
     } else {
-        Napi::TypeError::New(options.Env(), "Missing y attribute").ThrowAsJavaScriptException();
+        outcome = queue_edit([update](const std::shared_ptr<const void>& current) -> std::shared_ptr<const void> {
+            return update(*std::static_pointer_cast<const CountdownRenderer>(current));
+        }, replaces);
     }
 
-    // attribute "width" - optional
-    if (options.Has("width")) {
-        if (options.Get("width").IsNumber()) {
-            position.width = options.Get("width").As<Napi::Number>().Int32Value();
+    // The job settles with the outcome of this edit, whichever job publishes it
+    return schedule(env, jobOptions, [this, remote, replaces, outcome](RenderJob&, AsyncJobContext& ctx) {
+        if (remote) {
+            publish_template<jsvips::DaemonTemplate>(&NativeImage::daemonTemplate_, replaces, nullptr, ctx.then);
         } else {
-            Napi::TypeError::New(options.Env(), "Attribute width must be a number").ThrowAsJavaScriptException();
+            publish_template<CountdownRenderer>(&NativeImage::countdown_, replaces, nullptr, ctx.then);
+        }
+        ctx.edit = outcome;
+        ctx.then = [this] { this->image_ = template_image(); };
+    });
+}
+
+std::shared_ptr<EditOutcome> NativeImage::queue_edit(TemplateEdit apply, uint64_t& replaces) {
+    auto outcome = std::make_shared<EditOutcome>();
+    std::lock_guard<std::mutex> lock(this->publishMutex_);
+    replaces = this->replaceGeneration_;
+    ++this->templateGeneration_;
+    this->pendingEdits_.push_back({std::move(apply), outcome});
+    return outcome;
+}
+
+void NativeImage::abandon_template(uint64_t generation, const std::string& error) {
+    std::vector<PendingEdit> failed;
+    {
+        std::lock_guard<std::mutex> lock(this->publishMutex_);
+        if (generation != this->replaceGeneration_ || generation == this->publishedGeneration_) {
+            return;
         }
+        this->replaceGeneration_ = this->publishedGeneration_;
+        failed.swap(this->pendingEdits_);
     }
+    for (const PendingEdit& edit: failed) {
+        edit.outcome->settle(std::make_exception_ptr(std::runtime_error("The template update this edit follows failed: " + error)));
+    }
+}
 
-    // attribute "height" - optional
-    if (options.Has("height")) {
-        if (options.Get("height").IsNumber()) {
-            position.height = options.Get("height").As<Napi::Number>().Int32Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute height must be a number").ThrowAsJavaScriptException();
+template<class T>
+void NativeImage::publish_template(std::shared_ptr<const T> NativeImage::*slot, uint64_t replaces,
+                                   std::shared_ptr<const T> compiled, std::function<void()>& then) {
+    for (;;) {
+        std::shared_ptr<const T> base = compiled;
+        std::vector<PendingEdit> edits;
+        {
+            std::lock_guard<std::mutex> lock(this->publishMutex_);
+            // A later updateTemplate replaces this one, and the edits
+            // applying to it
+            if (replaces != this->replaceGeneration_) {
+                return;
+            }
+            // Edits queued after an updateTemplate still compiling are
+            // applied by its job
+            if (!compiled) {
+                if (replaces != this->publishedGeneration_) {
+                    return;
+                }
+                base = std::atomic_load(&(this->*slot));
+            }
+            edits = this->pendingEdits_;
+        }
+
+        // Compiled without the lock, other updates publish meanwhile. An
+        // edit that fails is left out, its error goes to its submitter.
+        std::shared_ptr<const void> updated = base;
+        std::vector<std::exception_ptr> errors(edits.size());
+        for (size_t i = 0; i < edits.size(); i++) {
+            try {
+                updated = edits[i].apply(updated);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->publishMutex_);
+            if (replaces != this->replaceGeneration_) {
+                return;
+            }
+            // Built on a template another job replaced, or missing edits queued
+            // since: start again from the published template
+            if ((!compiled && std::atomic_load(&(this->*slot)) != base) || this->pendingEdits_.size() != edits.size()) {
+                continue;
+            }
+            std::atomic_store(&(this->*slot), std::static_pointer_cast<const T>(updated));
+            this->publishedGeneration_ = replaces;
+            this->pendingEdits_.clear();
         }
+        then = [this] { this->image_ = template_image(); };
+        for (size_t i = 0; i < edits.size(); i++) {
+            edits[i].outcome->settle(errors[i]);
+        }
+        return;
+    }
+}
+
+VImage NativeImage::template_image() const {
+    if (std::shared_ptr<const jsvips::DaemonTemplate> remote = daemon_snapshot()) {
+        return jsvips::create_rgb_image(jsvips::parse_creation_options(remote->document));
     }
+    if (std::shared_ptr<const CountdownRenderer> countdown = countdown_snapshot()) {
+        return countdown->background();
+    }
+    return template_snapshot()->background();
+}
+
+std::shared_ptr<const CountdownRenderer> NativeImage::countdown_snapshot() const {
+    return std::atomic_load(&this->countdown_);
+}
+
+std::shared_ptr<const LayeredTemplate> NativeImage::template_snapshot() const {
+    return std::atomic_load(&this->layeredTemplate_);
+}
 
-    return position;
+std::shared_ptr<const jsvips::DaemonTemplate> NativeImage::daemon_snapshot() const {
+    return std::atomic_load(&this->daemonTemplate_);
 }
 
 /**
- * Parse countdown component options
+ *   saveAsync(outFilePath: string, opts?: JobOptions): Promise<number>;
  */
-CountdownComponent NativeImage::parse_countdown_component(const Napi::Object& options, bool ignoreText) {
-    CountdownComponent component;
+Napi::Value NativeImage::SaveAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() == 0 || !info[0].IsString()) {
+        Napi::TypeError::New(env, "Invalid file path").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+    std::string path = info[0].As<Napi::String>().Utf8Value();
+
+    Napi::Value options = info.Length() >= 2 ? info[1] : env.Undefined();
+    SaveOptions saveOptions;
+    try {
+        if (options.IsObject()) {
+            saveOptions = jsvips::parse_save_options(to_json(options));
+        }
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
 
-    // attribute "text" - required / optional
-    if (options.Has("text")) {
-        if (options.Get("text").IsString()) {
-            component.text = options.Get("text").As<Napi::String>().Utf8Value();
+    // Watch a private copy, other jobs may be saving the same image
+    VImage output = this->image_.copy();
+
+    return schedule(env, options, [output, path, saveOptions](RenderJob& job, AsyncJobContext& ctx) {
+        job.watch(output);
+        if (lossy_gif(path, "", saveOptions.lossy)) {
+            jsvips::write_file(path, jsvips::write_gif(output, saveOptions.lossy));
         } else {
-            Napi::TypeError::New(options.Env(), "Attribute text must be a string.").ThrowAsJavaScriptException();
+            output.write_to_file(path.c_str());
         }
-    } else {
-        if (!ignoreText) {
-            Napi::TypeError::New(options.Env(), "Missing text attribute").ThrowAsJavaScriptException();
+    });
+}
+
+Napi::Value NativeImage::schedule(Napi::Env env, const Napi::Value& options, std::function<void(RenderJob&, AsyncJobContext&)> work,
+                                  std::function<void(const std::string&)> failed) {
+    JobOptions jobOptions;
+    Napi::Object signal;
+    if (options.IsObject()) {
+        Napi::Object opts = options.As<Napi::Object>();
+        jobOptions = parse_job_options(opts);
+
+        if (opts.Has("signal") && !opts.Get("signal").IsUndefined()) {
+            if (opts.Get("signal").IsObject()) {
+                signal = opts.Get("signal").As<Napi::Object>();
+            } else {
+                Napi::TypeError::New(env, "Attribute signal must be an AbortSignal").ThrowAsJavaScriptException();
+            }
         }
+    } else if (!options.IsUndefined()) {
+        Napi::TypeError::New(env, "Invalid job options").ThrowAsJavaScriptException();
+    }
 
+    if (env.IsExceptionPending()) {
+        return env.Undefined();
     }
 
-    // attribute "paddingTop" - optional
-    if (options.Has("paddingTop")) {
-        if (options.Get("paddingTop").IsNumber()) {
-            component.paddingTop = options.Get("paddingTop").As<Napi::Number>().Int32Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute paddingTop must be a number").ThrowAsJavaScriptException();
+    auto* ctx = new AsyncJobContext(env);
+    Napi::Promise promise = ctx->deferred.Promise();
+
+    if (!signal.IsEmpty() && signal.Get("aborted").ToBoolean().Value()) {
+        ctx->status = JobStatus::CANCELLED;
+        ctx->error = "The job was cancelled";
+        if (failed) {
+            failed(ctx->error);
         }
+        settle_job(env, ctx);
+        return promise;
     }
 
-    // attribute "paddingBottom" - optional
-    if (options.Has("paddingBottom")) {
-        if (options.Get("paddingBottom").IsNumber()) {
-            component.paddingBottom = options.Get("paddingBottom").As<Napi::Number>().Int32Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute paddingBottom must be a number").ThrowAsJavaScriptException();
-        }
+    auto job = std::make_shared<RenderJob>();
+    job->priority = jobOptions.priority;
+    if (jobOptions.timeout > 0) {
+        job->deadline = RenderJob::Clock::now() + std::chrono::milliseconds(jobOptions.timeout);
     }
 
-    // attribute "position" - required
-    if (options.Has("position")) {
-        if (options.Get("position").IsObject()) {
-            Napi::Object positionObj = options.Get("position").As<Napi::Object>();
-            component.position = parse_position_2d(positionObj);
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute position must be an object").ThrowAsJavaScriptException();
+    ctx->job = job;
+    ctx->self = Napi::Persistent(this->Value());
+    ctx->tsfn = Napi::ThreadSafeFunction::New(env, Napi::Function::New(env, [](const Napi::CallbackInfo&) {}), "NativeImageJob", 0, 1);
+
+    job->work = [ctx, work](RenderJob& job) {
+        try {
+            work(job, *ctx);
+        } catch (const jsvips::DaemonTimeout&) {
+            ctx->code = "ETIMEDOUT";
+            throw;
+        }
+    };
+    job->done = [ctx, failed](JobStatus status, const std::string& error) {
+        ctx->status = status;
+        ctx->error = error;
+        if (status != JobStatus::DONE && failed) {
+            failed(error);
         }
-    } else {
-        Napi::TypeError::New(options.Env(), "Missing position attribute").ThrowAsJavaScriptException();
-    }
 
-    // attribute "color" - optional
-    if (options.Has("color")) {
-        if (options.Get("color").IsString()) {
-            component.color = options.Get("color").As<Napi::String>().Utf8Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute color must be a string").ThrowAsJavaScriptException();
+        // The context is gone once it is settled, keep the function around.
+        // When the environment is shutting down the call fails and the context
+        // is left alone: its references may only be released on the JS thread.
+        auto settle = [ctx] {
+            Napi::ThreadSafeFunction tsfn = ctx->tsfn;
+            tsfn.BlockingCall(ctx, [](Napi::Env env, Napi::Function, AsyncJobContext* ctx) {
+                settle_job(env, ctx);
+            });
+            tsfn.Release();
+        };
+
+        // An edit is settled with its own outcome, once the job publishing
+        // it is done with it
+        if (status == JobStatus::DONE && ctx->edit) {
+            ctx->edit->when_settled([ctx, settle](std::exception_ptr error) {
+                if (error) {
+                    ctx->status = JobStatus::FAILED;
+                    try {
+                        std::rethrow_exception(error);
+                    } catch (const jsvips::DaemonTimeout& e) {
+                        ctx->error = e.what();
+                        ctx->code = "ETIMEDOUT";
+                    } catch (const std::exception& e) {
+                        ctx->error = e.what();
+                    }
+                }
+                settle();
+            });
+            return;
         }
+        settle();
+    };
+
+    if (!signal.IsEmpty()) {
+        std::weak_ptr<RenderJob> weakJob = job;
+        ctx->signal = Napi::Persistent(signal);
+        ctx->abortListener = Napi::Persistent(Napi::Function::New(env, [weakJob](const Napi::CallbackInfo&) {
+            if (auto job = weakJob.lock()) {
+                RenderScheduler::shared().cancel(job);
+            }
+        }));
+        signal.Get("addEventListener").As<Napi::Function>().Call(signal, {Napi::String::New(env, "abort"), ctx->abortListener.Value()});
     }
 
-    // attribute "textAlignment" - optional
-    if (options.Has("textAlignment")) {
-        if (options.Get("textAlignment").IsString()) {
-            component.textAlignment = jsvips::to_compass_direction(options.Get("textAlignment").As<Napi::String>().Utf8Value(), VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE);
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute textAlignment must be a string").ThrowAsJavaScriptException();
+    if (RenderScheduler::shared().submit(job) == RenderScheduler::Admission::REJECTED) {
+        ctx->status = JobStatus::FAILED;
+        ctx->error = "The render queue is full";
+        ctx->code = "EQUEUEFULL";
+        if (failed) {
+            failed(ctx->error);
         }
+        ctx->tsfn.Release();
+        settle_job(env, ctx);
     }
 
-    // attribute "font" - optional
-    if (options.Has("font")) {
-        if (options.Get("font").IsString()) {
-            component.font = options.Get("font").As<Napi::String>().Utf8Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute font must be a string").ThrowAsJavaScriptException();
-        }
+    return promise;
+}
+
+Napi::Value NativeImage::ConfigureScheduler(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() == 0 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Missing SchedulerOptions").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    // attribute "fontFile" - optional
-    if (options.Has("fontFile")) {
-        if (options.Get("fontFile").IsString()) {
-            component.fontFile = options.Get("fontFile").As<Napi::String>().Utf8Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute fontFile must be a string").ThrowAsJavaScriptException();
-        }
+    SchedulerOptions options = parse_scheduler_options(info[0].As<Napi::Object>());
+    if (env.IsExceptionPending()) {
+        return env.Undefined();
     }
 
-    return component;
+    RenderScheduler::shared().configure(options);
+
+    return Napi::Number::New(env, 0);
 }
 
-CountdownComponentPosition NativeImage::parse_countdown_component_position(const Napi::Object& options) {
-    CountdownComponentPosition cp;
+Napi::Value NativeImage::GetSchedulerStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
 
-    if (options.Has("position")) {
-        if (options.Get("position").IsObject()) {
-            Napi::Object positionObj = options.Get("position").As<Napi::Object>();
-            cp.position = parse_position_2d(positionObj);
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute position must be an object").ThrowAsJavaScriptException();
-        }
-    } else {
-        Napi::TypeError::New(options.Env(), "Missing position attribute").ThrowAsJavaScriptException();
+    SchedulerStats stats = RenderScheduler::shared().stats();
+
+    Napi::Object queued = Napi::Object::New(env);
+    for (int i = 0; i < lengthOfJobPriorities; i++) {
+        queued.Set(jobPriorityNames[i], Napi::Number::New(env, static_cast<double>(stats.queued[i])));
     }
 
-    return cp;
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("workers", Napi::Number::New(env, stats.workers));
+    result.Set("running", Napi::Number::New(env, stats.running));
+    result.Set("queued", queued);
+    result.Set("waiting", Napi::Number::New(env, static_cast<double>(stats.waiting)));
+    result.Set("completed", Napi::Number::New(env, static_cast<double>(stats.completed)));
+    result.Set("failed", Napi::Number::New(env, static_cast<double>(stats.failed)));
+    result.Set("cancelled", Napi::Number::New(env, static_cast<double>(stats.cancelled)));
+    result.Set("timedOut", Napi::Number::New(env, static_cast<double>(stats.timedOut)));
+    result.Set("rejected", Napi::Number::New(env, static_cast<double>(stats.rejected)));
+
+    return scope.Escape(result);
 }
 
-CountdownComponentStyle NativeImage::parse_countdown_component_style(const Napi::Object& options) {
-    CountdownComponentStyle cs;
+/**
+ *   clone(): NativeImage;
+ * A new instance sharing the pixels of this one. VImage is immutable, so the
+ * instances share the memory copy-on-write: drawText on either builds a new
+ * image over the shared pixels. The image is materialized once, a file opened
+ * for sequential access could not be read again by every clone.
+ */
+Napi::Value NativeImage::Clone(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
 
-    if (options.Has("color")) {
-        if (options.Get("color").IsString()) {
-            cs.color = options.Get("color").As<Napi::String>().Utf8Value();
-            if (cs.color.at(0) != '#') {
-                Napi::TypeError::New(options.Env(), "Attribute color should be a valid hexadecimal string").ThrowAsJavaScriptException();
-            }
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute color must be a string").ThrowAsJavaScriptException();
+    try {
+        if (this->base_.get_image() != this->image_.get_image()) {
+            jsvips::TraceSpan span("materialize clone base");
+            this->image_ = this->image_.copy_memory();
+            this->base_ = this->image_;
         }
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
     }
 
-    // attribute "width" - optional
-    if (options.Has("width")) {
-        if (options.Get("width").IsNumber()) {
-            cs.width = options.Get("width").As<Napi::Number>().Int32Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute width must be a number").ThrowAsJavaScriptException();
-        }
+    Napi::FunctionReference* constructor = env.GetInstanceData<Napi::FunctionReference>();
+    Napi::Object obj = constructor->New({Napi::External<NativeImage>::New(env, this)});
+    return scope.Escape(napi_value(obj)).ToObject();
+}
+
+Napi::Value NativeImage::CreateText(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
+
+    // Retrieve the instance data we stored during `Init()`. We only stored the
+    // constructor there, so we retrieve it here to create a new instance of the
+    // JS class the constructor represents.
+    Napi::FunctionReference* constructor = env.GetInstanceData<Napi::FunctionReference>();
+    Napi::Object obj = constructor->New({});
+    return scope.Escape(napi_value(obj)).ToObject();
+}
+
+/**
+ * Memory, allocations and open files tracked by libvips. The values are
+ * process-wide, so they also cover instances living in other worker threads.
+ */
+Napi::Value NativeImage::MemoryStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
+
+    Napi::Object stats = Napi::Object::New(env);
+    stats.Set("memory", Napi::Number::New(env, static_cast<double>(vips_tracked_get_mem())));
+    stats.Set("memoryHighwater", Napi::Number::New(env, static_cast<double>(vips_tracked_get_mem_highwater())));
+    stats.Set("allocations", Napi::Number::New(env, vips_tracked_get_allocs()));
+    stats.Set("files", Napi::Number::New(env, vips_tracked_get_files()));
+
+    return scope.Escape(stats);
+}
+
+/**
+ *   configureImageCache(opts: ImageCacheOptions): number;
+ * Images opened by path are decoded once and shared while the file keeps
+ * its size and mtime. maxBytes 0, the default, turns the cache off.
+ */
+Napi::Value NativeImage::ConfigureImageCache(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() == 0 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Missing ImageCacheOptions").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    // attribute "height" - optional
-    if (options.Has("height")) {
-        if (options.Get("height").IsNumber()) {
-            cs.height = options.Get("height").As<Napi::Number>().Int32Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute height must be a number").ThrowAsJavaScriptException();
-        }
+    size_t maxBytes;
+    if (!byte_count(info[0].As<Napi::Object>().Get("maxBytes"), maxBytes)) {
+        Napi::TypeError::New(env, "maxBytes should be a non-negative number").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    if (options.Has("textAlignment")) {
-        if (options.Get("textAlignment").IsString()) {
-            cs.textAlignment = jsvips::to_compass_direction(options.Get("textAlignment").As<Napi::String>().Utf8Value(), VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE);
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute textAlignment must be a string").ThrowAsJavaScriptException();
+    ImageCache::shared().configure(maxBytes);
+
+    return Napi::Number::New(env, 0);
+}
+
+Napi::Value NativeImage::GetImageCacheStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
+
+    ImageCacheStats stats = ImageCache::shared().stats();
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("entries", Napi::Number::New(env, static_cast<double>(stats.entries)));
+    result.Set("bytes", Napi::Number::New(env, static_cast<double>(stats.bytes)));
+    result.Set("maxBytes", Napi::Number::New(env, static_cast<double>(stats.maxBytes)));
+    result.Set("hits", Napi::Number::New(env, static_cast<double>(stats.hits)));
+    result.Set("misses", Napi::Number::New(env, static_cast<double>(stats.misses)));
+    result.Set("evictions", Napi::Number::New(env, static_cast<double>(stats.evictions)));
+
+    return scope.Escape(result);
+}
+
+/**
+ *   invalidateImageCache(path?: string): number;
+ * Drop the decoded image of a path, or of every path
+ */
+Napi::Value NativeImage::InvalidateImageCache(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    std::string path;
+    if (info.Length() > 0 && !info[0].IsUndefined()) {
+        if (!info[0].IsString()) {
+            Napi::TypeError::New(env, "The path should be a string").ThrowAsJavaScriptException();
+            return env.Undefined();
         }
+        path = info[0].As<Napi::String>().Utf8Value();
     }
 
-    if (options.Has("font")) {
-        if (options.Get("font").IsString()) {
-            cs.font = options.Get("font").As<Napi::String>().Utf8Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute font must be a string").ThrowAsJavaScriptException();
-        }
+    ImageCache::shared().invalidate(path);
+
+    return Napi::Number::New(env, 0);
+}
+
+/**
+ *   configureDiskCache(opts: DiskCacheOptions): number;
+ * Countdown buffers are stored in the directory under the hash of what was
+ * rendered and read back as mapped files. An empty directory turns it off.
+ */
+Napi::Value NativeImage::ConfigureDiskCache(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() == 0 || !info[0].IsObject()) {
+        Napi::TypeError::New(env, "Missing DiskCacheOptions").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
+    Napi::Object options = info[0].As<Napi::Object>();
 
-    if (options.Has("fontFile")) {
-        if (options.Get("fontFile").IsString()) {
-            cs.fontFile = options.Get("fontFile").As<Napi::String>().Utf8Value();
-        } else {
-            Napi::TypeError::New(options.Env(), "Attribute fontFile must be a string").ThrowAsJavaScriptException();
-        }
+    Napi::Value directory = options.Get("directory");
+    if (!directory.IsString()) {
+        Napi::TypeError::New(env, "directory should be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    // 1 GB when not given
+    size_t maxBytes = static_cast<size_t>(1024) * 1024 * 1024;
+    if (options.Has("maxBytes") && !byte_count(options.Get("maxBytes"), maxBytes)) {
+        Napi::TypeError::New(env, "maxBytes should be a non-negative number").ThrowAsJavaScriptException();
+        return env.Undefined();
+    }
+
+    try {
+        DiskCache::shared().configure(directory.As<Napi::String>().Utf8Value(), maxBytes);
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
     }
 
-    return cs;
+    return Napi::Number::New(env, 0);
+}
+
+Napi::Value NativeImage::GetDiskCacheStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
+
+    DiskCacheStats stats = DiskCache::shared().stats();
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("hits", Napi::Number::New(env, static_cast<double>(stats.hits)));
+    result.Set("misses", Napi::Number::New(env, static_cast<double>(stats.misses)));
+    result.Set("writes", Napi::Number::New(env, static_cast<double>(stats.writes)));
+    result.Set("evictions", Napi::Number::New(env, static_cast<double>(stats.evictions)));
+    result.Set("bytes", Napi::Number::New(env, static_cast<double>(stats.bytes)));
+    result.Set("maxBytes", Napi::Number::New(env, static_cast<double>(stats.maxBytes)));
+
+    return scope.Escape(result);
 }
 
 /**
- * Parse countdown options
+ *   setBlendKernel(name?: BlendKernel): {kernel: BlendKernel, available: BlendKernel[]};
+ * Select the kernel drawText blends with, without a name only reports it
  */
-CountdownOptions NativeImage::parse_countdown_options(const Napi::Object& options) {
-    CountdownOptions opts;
-
-    CreationOptions creationOpts = parse_creation_options(options);
-    opts.width = creationOpts.width;
-    opts.height = creationOpts.height;
-    opts.bgColor = creationOpts.bgColor;
-
-    // Attribute "labels" - required
-    if (options.Has("labels")) {
-        Napi::Value labels = options.Get("labels");
-        if (labels.IsObject()) {
-            Napi::Object labelsObj = labels.As<Napi::Object>();
-            Napi::Array keys = labelsObj.GetPropertyNames();
-            for (uint32_t i = 0; i < keys.Length(); i++) {
-                std::string key = keys.Get(i).As<Napi::String>().Utf8Value();
-                Napi::Value label = labelsObj.Get(key);
-                if (label.IsObject()) {
-                    Napi::Object labelObj = label.As<Napi::Object>();
-                    CountdownComponent component = parse_countdown_component(labelObj);
-                    opts.labels[key] = component;
-                } else {
-                    Napi::TypeError::New(options.Env(), "Invalid format label object").ThrowAsJavaScriptException();
-                }
-            }
-        } else {
-            Napi::TypeError::New(options.Env(), "Parameter labels should be an object").ThrowAsJavaScriptException();
-        }
-    } else {
-        Napi::TypeError::New(options.Env(), "Missing labels attribute").ThrowAsJavaScriptException();
-    }
-
-    // Attribute "digits" - required
-    if (options.Has("digits")) {
-        Napi::Value digits = options.Get("digits");
-        if (digits.IsObject()) {
-            Napi::Object digitsObj = digits.As<Napi::Object>();
-            
-            if (digitsObj.Has("positions")) {
-                Napi::Value positions = digitsObj.Get("positions");
-                if (positions.IsObject()) {
-                    Napi::Object positionsObj = positions.As<Napi::Object>();
-                    for (int i = 0; i < lengthOfCountdownMomentParts; i++) {
-                        std::string k = countdownMomentPartNames[i];
-                        if (positionsObj.Has(k)) {
-                            if (positionsObj.Get(k).IsObject()) {
-                                CountdownComponentPosition cp = parse_countdown_component_position(positionsObj.Get(k).As<Napi::Object>());
-                                opts.digits.positions[i] = cp;
-                            } else {
-                                Napi::TypeError::New(options.Env(), "Invalid format position object").ThrowAsJavaScriptException();
-                            }
-                        } else {
-                            Napi::TypeError::New(options.Env(), "Missing attribute " + k).ThrowAsJavaScriptException();
-                        }
-                    }
-                } else {
-                    Napi::TypeError::New(options.Env(), "Parameter positions should be an object").ThrowAsJavaScriptException();
-                }
-            } else {
-                Napi::TypeError::New(options.Env(), "Missing positions attribute").ThrowAsJavaScriptException();
-            }
-
-            // Attribute "styles" - optional
-            if (digitsObj.Has("style")) {
-                Napi::Value styles = digitsObj.Get("style");
-                if (styles.IsObject()) {
-                    Napi::Object stylesObj = styles.As<Napi::Object>();
-                    opts.digits.style = parse_countdown_component_style(stylesObj);
-//                    std::cout << "style color: " << opts.digits.style.color << " width: " << opts.width << " height: " << opts.height << std::endl;
-                } else {
-                    Napi::TypeError::New(options.Env(), "Parameter styles should be an object").ThrowAsJavaScriptException();
-                }
-            }
+Napi::Value NativeImage::SetBlendKernel(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
 
-            // Attribute "textTemplate" - optional
-            if (digitsObj.Has("textTemplate")) {
-                Napi::Value textTemplate = digitsObj.Get("textTemplate");
-                if (textTemplate.IsString()) {
-                    opts.digits.textTemplate = textTemplate.As<Napi::String>().Utf8Value();
-                } else {
-                    Napi::TypeError::New(options.Env(), "Parameter textTemplate should be a string").ThrowAsJavaScriptException();
-                }
-            }
-        } else {
-            Napi::TypeError::New(options.Env(), "Parameter digits should be an object").ThrowAsJavaScriptException();
+    if (info.Length() > 0 && !info[0].IsUndefined()) {
+        if (!info[0].IsString()) {
+            Napi::TypeError::New(env, "Invalid blend kernel").ThrowAsJavaScriptException();
+            return env.Undefined();
+        }
+        try {
+            jsvips::set_blend_kernel(info[0].As<Napi::String>().Utf8Value());
+        } catch (const std::exception& e) {
+            throw_error(env, e);
+            return env.Undefined();
         }
-    } else {
-        Napi::TypeError::New(options.Env(), "Missing digits attribute").ThrowAsJavaScriptException();
     }
 
-    return opts;
+    std::vector<std::string> kernels = jsvips::blend_kernels();
+    Napi::Array available = Napi::Array::New(env, kernels.size());
+    for (size_t i = 0; i < kernels.size(); i++) {
+        available.Set(static_cast<uint32_t>(i), Napi::String::New(env, kernels[i]));
+    }
+
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("kernel", Napi::String::New(env, jsvips::blend_kernel()));
+    result.Set("available", available);
+    return scope.Escape(result);
 }
 
-std::vector<int> NativeImage::parse_countdown_moment_with_number(const Napi::Object &options) {
-    std::vector<int> moment;
+/**
+ *   gifStats(): GifStats;
+ * compressionRatio is palette indices per byte written, one index per pixel
+ */
+Napi::Value NativeImage::GetGifStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    Napi::EscapableHandleScope scope(env);
+
+    GifEncoderStats stats = GifEncoder::stats();
 
-    for (int i = 0; i < lengthOfCountdownMomentParts; i++) {
-        std::string k = countdownMomentPartNames[i];
-        if (options.Has(k)) {
-            if (options.Get(k).IsNumber()) {
-                moment.push_back(options.Get(k).As<Napi::Number>().Int32Value());
-            } else {
-                Napi::TypeError::New(options.Env(), "Attribute " + k + " must be a number").ThrowAsJavaScriptException();
-            }
-        } else {
-            Napi::TypeError::New(options.Env(), "Missing attribute " + k).ThrowAsJavaScriptException();
-        }
-    }
+    Napi::Object result = Napi::Object::New(env);
+    result.Set("files", Napi::Number::New(env, static_cast<double>(stats.files)));
+    result.Set("lossyFiles", Napi::Number::New(env, static_cast<double>(stats.lossyFiles)));
+    result.Set("frames", Napi::Number::New(env, static_cast<double>(stats.frames)));
+    result.Set("pixels", Napi::Number::New(env, static_cast<double>(stats.pixels)));
+    result.Set("bytes", Napi::Number::New(env, static_cast<double>(stats.bytes)));
+    result.Set("compressionRatio", Napi::Number::New(env, stats.bytes > 0 ? static_cast<double>(stats.pixels) / stats.bytes : 0));
 
-    return moment;
+    return scope.Escape(result);
 }
 
 /**
- * Convert hex color string to RGB
- * 
- * Allowed formats:
- * [#]RGB
- * [#]ARGB
- * [#]RRGGBB
- * [#]AARRGGBB
- *
- * @param hex color hex string, should be start with "#" and the rest length is 3, 4, 6 or 8 characters
- * @return array a decimal ARGB array, return black if the hex string is invalid
- * 
+ *   startTrace(): void;
+ * Record the rendering stages and the libvips operations of the whole process
  */
-std::vector<u_char> NativeImage::hexadecimal_color_to_argb(const std::string& hex) {
-    const std::vector<u_char> defaultColor = {0, 0, 0, 0};
-    if (hex.length() == 0) {
-        return defaultColor;
+Napi::Value NativeImage::StartTrace(const Napi::CallbackInfo& info) {
+    jsvips::Trace::start();
+    return info.Env().Undefined();
+}
+
+/**
+ *   stopTrace(path: string): number;
+ * Write the trace as Chrome trace JSON, returns the number of events
+ */
+Napi::Value NativeImage::StopTrace(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(env, "The path of the trace file should be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    if (hex.length() != 4 && hex.length() != 5 && hex.length() != 7 && hex.length() != 9) {
-        return defaultColor;
+    try {
+        size_t events = jsvips::Trace::stop(info[0].As<Napi::String>().Utf8Value());
+        return Napi::Number::New(env, static_cast<double>(events));
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
     }
+}
 
-    if (hex.at(0) != '#') {
-        return defaultColor;
+/**
+ *   renderDaemonStats(socketPath: string): RenderDaemonStats;
+ */
+Napi::Value NativeImage::RenderDaemonStats(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(env, "The socket path of the render daemon should be a string").ThrowAsJavaScriptException();
+        return env.Undefined();
     }
 
-    std::string a,r,g,b;
-    int withAlpha = 0;
+    try {
+        jsvips::Json reply = jsvips::DaemonClient::shared(info[0].As<Napi::String>().Utf8Value())->stats();
 
-    if (hex.length() == 4 || hex.length() == 5) {
-        if ( hex.length() == 5 ) {
-            withAlpha = 1;
-            a = hex.substr(1, 1);
-        } else {
-            a = "FF";
+        Napi::Object stats = Napi::Object::New(env);
+        for (const auto& [key, value]: reply.as_object()) {
+            if (value.is_number()) {
+                stats.Set(key, Napi::Number::New(env, value.as_number()));
+            }
         }
+        return stats;
+    } catch (const std::exception& e) {
+        throw_error(env, e);
+        return env.Undefined();
+    }
+}
 
-        r = hex.substr(1 + withAlpha, 1) + hex.substr(1 + withAlpha, 1);
-        g = hex.substr(2 + withAlpha, 1) + hex.substr(2 + withAlpha, 1);
-        b = hex.substr(3 + withAlpha, 1) + hex.substr(3 + withAlpha, 1);
-    } else if (hex.length() == 7 || hex.length() == 9) {
-        if ( hex.length() == 9 ) {
-            withAlpha = 1;
-            a = hex.substr(1, 2);
-        } else {
-            a = "FF";
+/**
+ * Convert JS options to the document model of the rendering core. Functions
+ * and undefined become null, which the parsers treat as missing.
+ */
+jsvips::Json NativeImage::to_json(const Napi::Value& value, int depth) {
+    if (depth > 32) {
+        throw std::invalid_argument("The options are nested too deeply");
+    }
+
+    // Binary data is passed apart from the document
+    if (value.IsBuffer()) {
+        return jsvips::Json();
+    }
+
+    if (value.IsString()) {
+        return jsvips::Json(value.As<Napi::String>().Utf8Value());
+    } else if (value.IsNumber()) {
+        return jsvips::Json(value.As<Napi::Number>().DoubleValue());
+    } else if (value.IsBoolean()) {
+        return jsvips::Json(value.As<Napi::Boolean>().Value());
+    } else if (value.IsArray()) {
+        Napi::Array array = value.As<Napi::Array>();
+        jsvips::Json json {jsvips::Json::Array()};
+        for (uint32_t i = 0; i < array.Length(); i++) {
+            json.push_back(to_json(array.Get(i), depth + 1));
         }
-        r = hex.substr(1 + 2*withAlpha, 2);
-        g = hex.substr(3 + 2*withAlpha, 2);
-        b = hex.substr(5 + 2*withAlpha, 2);
+        return json;
+    } else if (value.IsObject() && !value.IsFunction()) {
+        Napi::Object object = value.As<Napi::Object>();
+        Napi::Array keys = object.GetPropertyNames();
+        jsvips::Json json {jsvips::Json::Object()};
+        for (uint32_t i = 0; i < keys.Length(); i++) {
+            std::string key = keys.Get(i).ToString().Utf8Value();
+            json.set(key, to_json(object.Get(key), depth + 1));
+        }
+        return json;
     }
 
-    // convert hex to decimal
-    u_char alpha = std::stoi(a, nullptr, 16);
-    u_char red = std::stoi(r, nullptr, 16);
-    u_char green = std::stoi(g, nullptr, 16);
-    u_char blue = std::stoi(b, nullptr, 16);
+    return jsvips::Json();
+}
 
-    return {alpha, red, green, blue};
+CountdownOptions NativeImage::parse_countdown_options(const Napi::Value& value) {
+    CountdownOptions options = jsvips::parse_countdown_options(to_json(value));
+
+    Napi::Value background = value.As<Napi::Object>().Get("background");
+    if (background.IsBuffer()) {
+        Napi::Buffer<uint8_t> buffer = background.As<Napi::Buffer<uint8_t>>();
+        jsvips::set_countdown_background(options, std::vector<uint8_t>(buffer.Data(), buffer.Data() + buffer.Length()));
+    }
+    return options;
 }
 
-std::vector<int> NativeImage::minus_one_second_to_duration(const std::vector<int>& duration) {
-    int size = duration.size();
-    if (size != lengthOfCountdownMomentParts) {
-        throw std::invalid_argument("Invalid duration size");
+JobOptions NativeImage::parse_job_options(const Napi::Object& options) {
+    JobOptions opts;
+
+    // attribute "priority" - optional
+    if (options.Has("priority")) {
+        bool valid = false;
+        if (options.Get("priority").IsString()) {
+            std::string priority = options.Get("priority").As<Napi::String>().Utf8Value();
+            for (int i = 0; i < lengthOfJobPriorities; i++) {
+                if (priority == jobPriorityNames[i]) {
+                    opts.priority = static_cast<JobPriority>(i);
+                    valid = true;
+                }
+            }
+        }
+        if (!valid) {
+            Napi::TypeError::New(options.Env(), "Attribute priority must be one of interactive, normal or bulk").ThrowAsJavaScriptException();
+        }
+    }
+
+    // attribute "timeout" - optional
+    if (options.Has("timeout")) {
+        if (options.Get("timeout").IsNumber()) {
+            opts.timeout = options.Get("timeout").As<Napi::Number>().Int32Value();
+        } else {
+            Napi::TypeError::New(options.Env(), "Attribute timeout must be a number").ThrowAsJavaScriptException();
+        }
     }
 
-    std::vector<int> newDuration = duration;
-    newDuration.at(static_cast<int>(CountdownMomentPart::SECONDS)) -= 1;
+    return opts;
+}
 
-    if (newDuration.at(static_cast<int>(CountdownMomentPart::SECONDS)) < 0) {
-        newDuration.at(static_cast<int>(CountdownMomentPart::SECONDS)) += 60;
-        newDuration.at(static_cast<int>(CountdownMomentPart::MINUTES)) -= 1;
+SchedulerOptions NativeImage::parse_scheduler_options(const Napi::Object& options) {
+    SchedulerOptions opts;
 
-        if (newDuration.at(static_cast<int>(CountdownMomentPart::MINUTES)) < 0) {
-            newDuration.at(static_cast<int>(CountdownMomentPart::MINUTES)) += 60;
-            newDuration.at(static_cast<int>(CountdownMomentPart::HOURS)) -= 1;
+    // attribute "workers" - optional
+    if (options.Has("workers")) {
+        if (options.Get("workers").IsNumber()) {
+            opts.workers = options.Get("workers").As<Napi::Number>().Int32Value();
+        } else {
+            Napi::TypeError::New(options.Env(), "Attribute workers must be a number").ThrowAsJavaScriptException();
+        }
+    }
 
-            if (newDuration.at(static_cast<int>(CountdownMomentPart::HOURS)) < 0) {
-                newDuration.at(static_cast<int>(CountdownMomentPart::HOURS)) += 24;
-                newDuration.at(static_cast<int>(CountdownMomentPart::DAYS)) -= 1;
+    // attribute "queueSize" - optional
+    if (options.Has("queueSize")) {
+        if (options.Get("queueSize").IsNumber() && options.Get("queueSize").As<Napi::Number>().Int32Value() > 0) {
+            opts.queueSize = options.Get("queueSize").As<Napi::Number>().Int32Value();
+        } else {
+            Napi::TypeError::New(options.Env(), "Attribute queueSize must be a positive number").ThrowAsJavaScriptException();
+        }
+    }
 
-                if (newDuration.at(static_cast<int>(CountdownMomentPart::DAYS)) < 0) {
-                    // Reset all to 0
-                    newDuration.at(static_cast<int>(CountdownMomentPart::DAYS)) = 0;
-                    newDuration.at(static_cast<int>(CountdownMomentPart::HOURS)) = 0;
-                    newDuration.at(static_cast<int>(CountdownMomentPart::MINUTES)) = 0;
-                    newDuration.at(static_cast<int>(CountdownMomentPart::SECONDS)) = 0;
-                }
-            }
+    // attribute "whenFull" - optional
+    if (options.Has("whenFull")) {
+        std::string whenFull = options.Get("whenFull").IsString() ? options.Get("whenFull").As<Napi::String>().Utf8Value() : "";
+        if (whenFull == "reject") {
+            opts.whenFull = QueueFullPolicy::REJECT;
+        } else if (whenFull == "wait") {
+            opts.whenFull = QueueFullPolicy::WAIT;
+        } else {
+            Napi::TypeError::New(options.Env(), "Attribute whenFull must be reject or wait").ThrowAsJavaScriptException();
         }
     }
 
-    return newDuration;
+    return opts;
 }
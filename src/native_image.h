@@ -1,101 +1,50 @@
 #ifndef NATIVE_IMAGE_H
 #define NATIVE_IMAGE_H
 
-#include <map>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <napi.h>
 #include <vips/vips8>
 
+#include "countdown_renderer.h"
+#include "json.h"
+#include "layered_template.h"
+#include "render_daemon.h"
+#include "render_options.h"
+#include "render_scheduler.h"
+
 enum class ImageMode {
     IMAGE,
-    COUNTDOWN
-};
-
-enum class CountdownMomentPart {
-  DAYS,
-  HOURS,
-  MINUTES,
-  SECONDS
-};
-
-const int lengthOfCountdownMomentParts = static_cast<int>(CountdownMomentPart::SECONDS) + 1;
-const int totalOfDigits = 100;
-
-const std::string countdownMomentPartNames[lengthOfCountdownMomentParts] = {
-  "days",
-  "hours",
-  "minutes",
-  "seconds"
-};
-
-struct CreationOptions {
-    int width {0};
-    int height {0};
-    std::string bgColor {"#ffffff"};
-};
-
-struct ColoredTextOptions {
-    std::vector<u_char> textColor {255, 255, 255};
-    std::string font;
-    std::string fontFile;
-    int width {0};
-    int height {0};
-    VipsCompassDirection textAlignment {VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE};
-    int paddingTop {0};
-    int paddingBottom {0};
-};
-
-template <typename T>
-struct Dimension2D {
-    T width;
-    T height;
-};
-
-template <typename T>
-struct CountdownMoment {
-    T days;
-    T hours;
-    T minutes;
-    T seconds;
-};
-
-struct Position2D : Dimension2D<int> {
-    int x {0};
-    int y {0};
-};
-
-struct CountdownComponentStyle {
-    std::string color {"#ffffff"};
-    std::string font;
-    std::string fontFile;
-    int width {0};
-    int height {0};
-    VipsCompassDirection textAlignment {VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE};
-};
-
-struct CountdownComponentPosition {
-  // Position of the component - required
-  Position2D            position;
+    COUNTDOWN,
+    TEMPLATE
 };
 
-struct CountdownComponent : CountdownComponentPosition, CountdownComponentStyle {
-    // Text to display - required
-    std::string text;
-    int paddingTop {0};
-    int paddingBottom {0};
+struct JobOptions {
+    JobPriority priority {JobPriority::NORMAL};
+    // Milliseconds after submission when the job is abandoned, 0 for no deadline
+    int timeout {0};
 };
 
-struct CountdownDigits {
-    CountdownComponentPosition positions[lengthOfCountdownMomentParts];
-    CountdownComponentStyle style;
-    std::string textTemplate;
-};
+// State of a scheduled job shared between the JS thread and a worker thread
+struct AsyncJobContext;
 
-struct CountdownOptions : CreationOptions {
-    // labels
-    std::map<std::string, CountdownComponent> labels {};
+// The outcome of a queued template edit. The job publishing the edit
+// settles it, the job that submitted it settles its promise with it.
+class EditOutcome {
+  public:
+    // The error of the edit, null when it was published or dropped
+    void settle(std::exception_ptr error);
+    // Run done once settled, right away when it already is
+    void when_settled(std::function<void(std::exception_ptr)> done);
 
-    // digits
-    CountdownDigits digits;
+  private:
+    std::mutex mutex_;
+    bool settled_ {false};
+    std::exception_ptr error_;
+    std::function<void(std::exception_ptr)> done_;
 };
 
 class NativeImage: public Napi::ObjectWrap<NativeImage> {
@@ -103,8 +52,6 @@ class NativeImage: public Napi::ObjectWrap<NativeImage> {
     // Constructor
     explicit NativeImage(const Napi::CallbackInfo& info);
 
-    void init_countdown_animation();
-
     // Init function for setting the export key to JS
     static Napi::Object Init(Napi::Env env, Napi::Object exports);
 
@@ -113,36 +60,129 @@ class NativeImage: public Napi::ObjectWrap<NativeImage> {
     static Napi::Value CreateSRGBImage(const Napi::CallbackInfo& info);
     // Draw text on the image
     Napi::Value DrawText(const Napi::CallbackInfo& info);
+    // A new instance sharing the pixels copy-on-write
+    Napi::Value Clone(const Napi::CallbackInfo& info);
     // Save the image to a file
     Napi::Value Save(const Napi::CallbackInfo& info);
 
+    // Layered templates with text slots
+    static Napi::Value CreateTemplate(const Napi::CallbackInfo& info);
+    Napi::Value Render(const Napi::CallbackInfo& info);
+    Napi::Value RenderAsync(const Napi::CallbackInfo& info);
+    Napi::Value TemplateStats(const Napi::CallbackInfo& info);
+
+    // Reuse of the frame buffers of the countdown template
+    Napi::Value FramePoolStats(const Napi::CallbackInfo& info);
+
+    // Replace the countdown or layered template while renders are in flight
+    Napi::Value UpdateTemplate(const Napi::CallbackInfo& info);
+    // Change one label or the digit style, only that part is rendered again
+    Napi::Value UpdateLabel(const Napi::CallbackInfo& info);
+    Napi::Value UpdateDigitStyle(const Napi::CallbackInfo& info);
+
     static Napi::Value CreateCountdownAnimation(const Napi::CallbackInfo& info);
     Napi::Value RenderCountdownAnimation(const Napi::CallbackInfo& info);
 
-    // Create an text image with color
-    static Napi::Value CreateText(const Napi::CallbackInfo& info);
+    // Render / save on the native job scheduler, both return a Promise
+    Napi::Value RenderCountdownAnimationAsync(const Napi::CallbackInfo& info);
+    Napi::Value SaveAsync(const Napi::CallbackInfo& info);
 
-    // create an empty image
-    static vips::VImage create_rgb_Image(const CreationOptions& options);
+    // Configure the process-wide job scheduler and report its state
+    static Napi::Value ConfigureScheduler(const Napi::CallbackInfo& info);
+    static Napi::Value GetSchedulerStats(const Napi::CallbackInfo& info);
 
-    static vips::VImage colored_text_image(const std::string &text, const ColoredTextOptions& options);
+    // Create an text image with color
+    static Napi::Value CreateText(const Napi::CallbackInfo& info);
 
-    vips::VImage render_countdown_animation(const std::vector<int>& duration, int frames);
+    // Report memory and file handles tracked by libvips
+    static Napi::Value MemoryStats(const Napi::CallbackInfo& info);
+
+    // Process-wide cache of the images opened by path
+    static Napi::Value ConfigureImageCache(const Napi::CallbackInfo& info);
+    static Napi::Value GetImageCacheStats(const Napi::CallbackInfo& info);
+    static Napi::Value InvalidateImageCache(const Napi::CallbackInfo& info);
+
+    // Render cache on disk shared by the processes of a host
+    static Napi::Value ConfigureDiskCache(const Napi::CallbackInfo& info);
+    static Napi::Value GetDiskCacheStats(const Napi::CallbackInfo& info);
+
+    // Files written by the GIF encoder of this library
+    static Napi::Value GetGifStats(const Napi::CallbackInfo& info);
+
+    // SIMD kernel of drawText
+    static Napi::Value SetBlendKernel(const Napi::CallbackInfo& info);
+
+    // Chrome trace of the rendering stages and libvips operations
+    static Napi::Value StartTrace(const Napi::CallbackInfo& info);
+    static Napi::Value StopTrace(const Napi::CallbackInfo& info);
+
+    // Counters of a render daemon
+    static Napi::Value RenderDaemonStats(const Napi::CallbackInfo& info);
+
+    // The current templates. Readers keep the snapshot for the whole render,
+    // updates publish a new template with an atomic store.
+    std::shared_ptr<const CountdownRenderer> countdown_snapshot() const;
+    std::shared_ptr<const LayeredTemplate> template_snapshot() const;
+    std::shared_ptr<const jsvips::DaemonTemplate> daemon_snapshot() const;
+
+    // Schedule an incremental update of the countdown template: update builds
+    // the new template from the current one. A template of the render daemon
+    // is loaded again from its document changed by edit.
+    Napi::Value update_countdown(Napi::Env env, const Napi::Value& jobOptions,
+                                 std::function<std::shared_ptr<const CountdownRenderer>(const CountdownRenderer&)> update,
+                                 std::function<void(jsvips::Json&)> edit);
+
+    // An incremental update, the new template of the one given. The type is
+    // the one of the template slot of the instance.
+    using TemplateEdit = std::function<std::shared_ptr<const void>(const std::shared_ptr<const void>&)>;
+
+    // An edit waiting to be published and the outcome of its submitter
+    struct PendingEdit {
+        TemplateEdit apply;
+        std::shared_ptr<EditOutcome> outcome;
+    };
+
+    // Queue an edit, the outcome is settled once it is published or dropped.
+    // replaces is set to the generation the edit applies to.
+    std::shared_ptr<EditOutcome> queue_edit(TemplateEdit apply, uint64_t& replaces);
+
+    // The updateTemplate of generation failed or was cancelled: the edits
+    // queued after it fail with its error, the next ones apply to the
+    // published template
+    void abandon_template(uint64_t generation, const std::string& error);
+
+    // Publish in slot the template compiled by the updateTemplate of
+    // generation replaces with the edits queued after it. Without compiled,
+    // the queued edits are applied to the published template. Nothing is
+    // published when a later updateTemplate was submitted. Each edit settles
+    // its own outcome, one that fails is left out. then is set to refresh
+    // the image of the instance, on the JS thread, once published.
+    template<class T>
+    void publish_template(std::shared_ptr<const T> NativeImage::*slot, uint64_t replaces,
+                          std::shared_ptr<const T> compiled, std::function<void()>& then);
+
+    // drawText on a countdown template: a job draws the text on its
+    // background frames, key identifies the call in the fingerprint
+    Napi::Value draw_countdown_text(Napi::Env env, const CountdownRenderer::TextMask& mask, int x, int y,
+                                    const std::vector<u_char>& colour, const std::string& key);
+
+    // The image of the published template
+    vips::VImage template_image() const;
+
+    // Submit work to the job scheduler, the returned promise settles when the
+    // job is done. failed runs with the error when the work threw or never ran.
+    Napi::Value schedule(Napi::Env env, const Napi::Value& options, std::function<void(RenderJob&, AsyncJobContext&)> work,
+                         std::function<void(const std::string&)> failed = nullptr);
 
     //
     // Help functions
     //
-    static Position2D                 parse_position_2d(const Napi::Object& options);
-    static CreationOptions            parse_creation_options(const Napi::Object& options);
-
-    static CountdownComponent         parse_countdown_component(const Napi::Object& options, bool ignoreText = false);
-    static CountdownComponentPosition parse_countdown_component_position(const Napi::Object& options);
-    static CountdownComponentStyle    parse_countdown_component_style(const Napi::Object& options);
-    static std::vector<int>           parse_countdown_moment_with_number(const Napi::Object& options);
-    static CountdownOptions           parse_countdown_options(const Napi::Object& options);
-
-    static std::vector<u_char>        hexadecimal_color_to_argb(const std::string& hex);
-    static std::vector<int>           minus_one_second_to_duration(const std::vector<int>& duration);
+    // JS values as a JSON document for the option parsers of the rendering core
+    static jsvips::Json               to_json(const Napi::Value& value, int depth = 0);
+    // Countdown options of a JS object, whose background may be a Buffer
+    static CountdownOptions           parse_countdown_options(const Napi::Value& value);
+    static JobOptions                 parse_job_options(const Napi::Object& options);
+    static SchedulerOptions           parse_scheduler_options(const Napi::Object& options);
 
     //
     // Internal instance of an image object
@@ -151,16 +191,41 @@ class NativeImage: public Napi::ObjectWrap<NativeImage> {
     // Internal image object
     vips::VImage image_;
 
+    // The last image materialized by clone(), shared with the clones
+    vips::VImage base_;
+
     // What the image_ is read from a file, this is the path
     std::string imageOriginalPath_;
 
-    // Image mode, either IMAGE or COUNTDOWN
+    // Image mode, either IMAGE, COUNTDOWN or TEMPLATE
     ImageMode mode_;
 
-    // Countdown animation generation options
-    CountdownOptions countdownOptions_;
-    // Countdown animation cache for performance
-    std::vector<vips::VImage> countdownDigits_;
+    // Compiled countdown template, shared with the jobs rendering it. Only
+    // accessed through std::atomic_load / std::atomic_store.
+    std::shared_ptr<const CountdownRenderer> countdown_;
+
+    // Layered template, shared with the jobs rendering it. Only accessed
+    // through std::atomic_load / std::atomic_store.
+    std::shared_ptr<const LayeredTemplate> layeredTemplate_;
+
+    // Countdown template compiled by the render daemon instead of
+    // countdown_, same access rules
+    std::shared_ptr<const jsvips::DaemonTemplate> daemonTemplate_;
+
+    // Number of template updates submitted
+    std::atomic<uint64_t> templateGeneration_ {0};
+
+    // Held to publish a template and for the fields below
+    std::mutex publishMutex_;
+
+    // Generation of the last updateTemplate submitted, and of the one the
+    // published template was compiled by
+    uint64_t replaceGeneration_ {0};
+    uint64_t publishedGeneration_ {0};
+
+    // Incremental updates submitted since the published template or the
+    // updateTemplate in flight, in order
+    std::vector<PendingEdit> pendingEdits_;
 };
 
 #endif
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "gif_encoder.h"
+#include "quantizer.h"
+#include "trace.h"
+
+using namespace vips;
+
+namespace jsvips {
+
+namespace {
+
+// Colours of a box, bins with pixels
+struct Box {
+    std::vector<int> bins;
+    uint64_t count {0};
+    // Longest side, as a channel and its length in bins
+    int channel {0};
+    int range {0};
+};
+
+int channel_of(int bin, int channel, int bits) {
+    return (bin >> ((2 - channel) * bits)) & ((1 << bits) - 1);
+}
+
+void measure(Box& box, const std::vector<uint32_t>& counts, int bits) {
+    const int top = (1 << bits) - 1;
+    int lo[3] = {top, top, top};
+    int hi[3] = {0, 0, 0};
+    box.count = 0;
+    for (int bin: box.bins) {
+        box.count += counts[bin];
+        for (int c = 0; c < 3; c++) {
+            lo[c] = std::min(lo[c], channel_of(bin, c, bits));
+            hi[c] = std::max(hi[c], channel_of(bin, c, bits));
+        }
+    }
+    box.range = -1;
+    for (int c = 0; c < 3; c++) {
+        if (hi[c] - lo[c] > box.range) {
+            box.range = hi[c] - lo[c];
+            box.channel = c;
+        }
+    }
+}
+
+}
+
+Quantizer::Quantizer(int bits): bits_(std::clamp(bits, 2, 5)), counts_(1 << (3 * bits_)), sums_(counts_.size() * 3), lookup_(counts_.size()) {}
+
+int Quantizer::bits_for_lossy(int lossy) {
+    // A bin spans 256 >> bits per channel, its diagonal about 1.75 times that
+    int bits = 5;
+    while (bits > 2 && (256 >> (bits - 1)) * 7 / 4 <= lossy) {
+        bits--;
+    }
+    return bits;
+}
+
+int Quantizer::colours_for_lossy(int lossy) {
+    return std::max(32, 256 >> std::min(3, std::max(0, lossy) / 32));
+}
+
+void Quantizer::add(const uint8_t* rgb, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++, rgb += 3) {
+        int b = bin(rgb);
+        this->counts_[b]++;
+        this->sums_[b * 3] += rgb[0];
+        this->sums_[b * 3 + 1] += rgb[1];
+        this->sums_[b * 3 + 2] += rgb[2];
+    }
+}
+
+std::vector<uint8_t> Quantizer::palette(int colours) {
+    const int bins = static_cast<int>(this->counts_.size());
+    const int bits = this->bits_;
+    std::vector<Box> boxes(1);
+    for (int b = 0; b < bins; b++) {
+        if (this->counts_[b] > 0) {
+            boxes[0].bins.push_back(b);
+        }
+    }
+    if (boxes[0].bins.empty()) {
+        boxes[0].bins.push_back(0);
+    }
+    measure(boxes[0], this->counts_, bits);
+
+    while (static_cast<int>(boxes.size()) < colours) {
+        // The box with the most pixels times its longest side goes first
+        Box* widest = nullptr;
+        for (Box& box: boxes) {
+            if (box.range > 0 && (!widest || box.count * box.range > widest->count * widest->range)) {
+                widest = &box;
+            }
+        }
+        if (!widest) {
+            break;
+        }
+
+        const int channel = widest->channel;
+        std::sort(widest->bins.begin(), widest->bins.end(), [channel, bits](int a, int b) {
+            return channel_of(a, channel, bits) < channel_of(b, channel, bits);
+        });
+
+        // Split at the median pixel, leaving at least one bin on each side
+        uint64_t seen = 0;
+        size_t split = 1;
+        for (; split < widest->bins.size() - 1; split++) {
+            seen += this->counts_[widest->bins[split - 1]];
+            if (seen * 2 >= widest->count) {
+                break;
+            }
+        }
+
+        Box upper;
+        upper.bins.assign(widest->bins.begin() + split, widest->bins.end());
+        widest->bins.resize(split);
+        measure(*widest, this->counts_, bits);
+        measure(upper, this->counts_, bits);
+        boxes.push_back(std::move(upper));
+    }
+
+    std::vector<uint8_t> palette;
+    for (size_t index = 0; index < boxes.size(); index++) {
+        uint64_t sum[3] = {0, 0, 0};
+        uint64_t count = 0;
+        for (int b: boxes[index].bins) {
+            count += this->counts_[b];
+            for (int c = 0; c < 3; c++) {
+                sum[c] += this->sums_[b * 3 + c];
+            }
+            this->lookup_[b] = static_cast<uint8_t>(index);
+        }
+        for (int c = 0; c < 3; c++) {
+            palette.push_back(count > 0 ? static_cast<uint8_t>((sum[c] + count / 2) / count) : 0);
+        }
+    }
+    return palette;
+}
+
+void Quantizer::map(const uint8_t* rgb, size_t pixels, uint8_t* indices) const {
+    for (size_t i = 0; i < pixels; i++, rgb += 3) {
+        indices[i] = this->lookup_[bin(rgb)];
+    }
+}
+
+std::vector<uint8_t> write_gif(const VImage& image, int lossy) {
+    const int width = image.width();
+    const int pageHeight = image.get_typeof("page-height") ? image.get_int("page-height") : image.height();
+    if (pageHeight <= 0 || image.height() % pageHeight != 0) {
+        throw std::invalid_argument("The page height does not divide the image height");
+    }
+    const int pages = image.height() / pageHeight;
+    std::vector<int> delays = image.get_typeof("delay") ? image.get_array_int("delay") : std::vector<int>();
+    const int loop = image.get_typeof("loop") ? image.get_int("loop") : 0;
+
+    TraceSpan span("encode gif");
+    span.arg("frames", pages).arg("lossy", lossy);
+
+    // Opaque 8-bit sRGB
+    VImage rgb = image.colourspace(VIPS_INTERPRETATION_sRGB);
+    if (rgb.has_alpha()) {
+        rgb = rgb.flatten();
+    }
+    if (rgb.bands() > 3) {
+        rgb = rgb.extract_band(0, VImage::option()->set("n", 3));
+    }
+
+    size_t size;
+    std::unique_ptr<uint8_t, decltype(&g_free)> pixels(static_cast<uint8_t*>(rgb.cast(VIPS_FORMAT_UCHAR).write_to_memory(&size)), &g_free);
+    const size_t framePixels = static_cast<size_t>(width) * pageHeight;
+
+    // A lossy file may be off by the lossy distance anyway, a coarser palette
+    // with fewer colours gives the LZW encoder longer runs
+    Quantizer quantizer(Quantizer::bits_for_lossy(lossy));
+    quantizer.add(pixels.get(), framePixels * pages);
+    GifEncoder encoder(width, pageHeight, quantizer.palette(Quantizer::colours_for_lossy(lossy)), loop, lossy);
+
+    std::vector<uint8_t> indices(framePixels);
+    std::vector<uint8_t> previous(framePixels);
+    for (int page = 0; page < pages; page++) {
+        const int delay = page < static_cast<int>(delays.size()) ? delays[page] : 100;
+        quantizer.map(pixels.get() + framePixels * page * 3, framePixels, indices.data());
+
+        // Rectangle that differs from the previous frame
+        int x0 = 0, y0 = 0, x1 = width, y1 = pageHeight;
+        if (page > 0) {
+            x0 = width;
+            y0 = pageHeight;
+            x1 = 0;
+            y1 = 0;
+            for (int row = 0; row < pageHeight; row++) {
+                const uint8_t* line = indices.data() + static_cast<size_t>(row) * width;
+                const uint8_t* before = previous.data() + static_cast<size_t>(row) * width;
+                if (std::memcmp(line, before, width) == 0) {
+                    continue;
+                }
+                int left = 0;
+                while (line[left] == before[left]) {
+                    left++;
+                }
+                int right = width;
+                while (line[right - 1] == before[right - 1]) {
+                    right--;
+                }
+                x0 = std::min(x0, left);
+                x1 = std::max(x1, right);
+                y0 = std::min(y0, row);
+                y1 = row + 1;
+            }
+        }
+
+        if (x0 >= x1) {
+            encoder.extend_last_frame(delay);
+        } else {
+            encoder.add_frame(indices.data() + static_cast<size_t>(y0) * width + x0, width, x0, y0, x1 - x0, y1 - y0, delay);
+        }
+        std::swap(indices, previous);
+    }
+
+    std::vector<uint8_t> gif = encoder.finish();
+    span.arg("bytes", static_cast<double>(gif.size()));
+    return gif;
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef QUANTIZER_H
+#define QUANTIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <vips/vips8>
+
+namespace jsvips {
+
+    //
+    // Median cut palette for RGB images with too many colours for a GIF.
+    //
+    // Colours are counted in a histogram of 5 bits per channel, or fewer for
+    // a coarser palette, every frame of an animation goes into the same
+    // histogram so the frames share one palette. The busiest box of colours
+    // is split at its median along its longest side until there are enough
+    // boxes, a palette entry is the mean of the colours of a box. A flat
+    // colour that fills a box is kept exact. There is no dithering: it would
+    // break the runs the LZW encoder relies on.
+    //
+    class Quantizer {
+      public:
+        // bits per channel of the histogram, from 2 to 5
+        explicit Quantizer(int bits = 5);
+
+        // Bits per channel for a lossy level of GifEncoder: the bins get as
+        // wide as the RGB distance the level allows
+        static int bits_for_lossy(int lossy);
+
+        // Palette entries for a lossy level, halved every 32 levels down to 32
+        static int colours_for_lossy(int lossy);
+
+        // Count interleaved RGB pixels, before palette()
+        void add(const uint8_t* rgb, size_t pixels);
+
+        // RGB triples, at most colours entries
+        std::vector<uint8_t> palette(int colours = 256);
+
+        // Palette index of each pixel, after palette()
+        void map(const uint8_t* rgb, size_t pixels, uint8_t* indices) const;
+
+      private:
+        int bin(const uint8_t* pixel) const {
+            const int shift = 8 - this->bits_;
+            return ((pixel[0] >> shift) << (2 * this->bits_)) | ((pixel[1] >> shift) << this->bits_) | (pixel[2] >> shift);
+        }
+
+        int bits_;
+
+        std::vector<uint32_t> counts_;
+        // Sum of each channel of the pixels of a bin
+        std::vector<uint64_t> sums_;
+        // Palette index of each bin
+        std::vector<uint8_t> lookup_;
+    };
+
+    // Encode an image or an animation (pages stacked with page-height and
+    // delay metadata) with the GIF encoder of this library. Transparency is
+    // flattened. Frames only store the rectangle that changed since the
+    // previous one. lossy: see GifEncoder, it also coarsens the palette.
+    std::vector<uint8_t> write_gif(const vips::VImage& image, int lossy = 0);
+
+}
+
+#endif
@@ -0,0 +1,427 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "render_daemon.h"
+#include "render_options.h"
+#include "trace.h"
+
+namespace jsvips {
+
+namespace {
+
+// Larger messages are a protocol error, templates are a few kB of JSON
+const uint32_t maxMessageBytes = 64 * 1024 * 1024;
+// Descriptors accepted with one message
+const size_t maxFds = 16;
+
+// The daemon and its client need Linux: memfds and the flags below. The
+// client builds elsewhere and refuses to connect.
+#ifdef __linux__
+const int socketFlags = SOCK_CLOEXEC;
+const int receiveFlags = MSG_CMSG_CLOEXEC;
+const int sendFlags = MSG_NOSIGNAL;
+#else
+const int socketFlags = 0;
+const int receiveFlags = 0;
+const int sendFlags = 0;
+#endif
+
+std::runtime_error system_error(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+// The socket timeout expired
+bool timed_out() {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+void close_all(std::vector<int>& fds) {
+    for (int fd: fds) {
+        close(fd);
+    }
+    fds.clear();
+}
+
+// Read exactly size bytes, collecting the descriptors that come with them
+void receive_exactly(int socket, uint8_t* data, size_t size, std::vector<int>& fds) {
+    while (size > 0) {
+        iovec iov {data, size};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * maxFds)];
+        msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t received = recvmsg(socket, &msg, receiveFlags);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && timed_out()) {
+            close_all(fds);
+            throw DaemonTimeout("The render daemon did not answer in time");
+        }
+        if (received < 0) {
+            throw system_error("Unable to read from the render daemon socket");
+        }
+        if (received == 0) {
+            throw std::runtime_error("The render daemon socket is closed");
+        }
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (size_t i = 0; i < count; i++) {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    fds.push_back(fd);
+                }
+            }
+        }
+        if (msg.msg_flags & MSG_CTRUNC) {
+            close_all(fds);
+            throw std::runtime_error("Too many descriptors in a render daemon message");
+        }
+
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+}
+
+}
+
+void send_message(int socket, const Json& message, const std::vector<int>& fds) {
+    if (fds.size() > maxFds) {
+        throw std::invalid_argument("Too many descriptors in a render daemon message");
+    }
+
+    std::string body = message.dump();
+    std::vector<uint8_t> data(4 + body.size());
+    const uint32_t length = static_cast<uint32_t>(body.size());
+    for (int i = 0; i < 4; i++) {
+        data[i] = static_cast<uint8_t>(length >> (i * 8));
+    }
+    std::memcpy(data.data() + 4, body.data(), body.size());
+
+    // The descriptors go with the first bytes, the rest follows
+    size_t sent = 0;
+    while (sent < data.size()) {
+        iovec iov {data.data() + sent, data.size() - sent};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * maxFds)];
+        msghdr msg {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if (sent == 0 && !fds.empty()) {
+            msg.msg_control = control;
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+            std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+        }
+
+        // No SIGPIPE when the peer is gone, the error is reported instead
+        ssize_t written = sendmsg(socket, &msg, sendFlags);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0 && timed_out()) {
+            throw DaemonTimeout("The render daemon did not read the request in time");
+        }
+        if (written < 0) {
+            throw system_error("Unable to write to the render daemon socket");
+        }
+        sent += static_cast<size_t>(written);
+    }
+}
+
+Json receive_message(int socket, std::vector<int>& fds) {
+    uint8_t header[4];
+    receive_exactly(socket, header, sizeof(header), fds);
+    const uint32_t length = header[0] | (header[1] << 8) | (header[2] << 16) | (static_cast<uint32_t>(header[3]) << 24);
+    if (length > maxMessageBytes) {
+        close_all(fds);
+        throw std::runtime_error("Render daemon message too large");
+    }
+
+    std::string body(length, '\0');
+    receive_exactly(socket, reinterpret_cast<uint8_t*>(body.data()), length, fds);
+    try {
+        return Json::parse(body);
+    } catch (const std::invalid_argument& e) {
+        close_all(fds);
+        throw std::runtime_error(std::string("Invalid render daemon message: ") + e.what());
+    }
+}
+
+int memfd_of(const uint8_t* data, size_t size) {
+#ifndef __linux__
+    throw std::runtime_error("memfds are only available on Linux");
+#else
+    int fd = memfd_create("jsvips-render", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        throw system_error("Unable to create a memfd");
+    }
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            close(fd);
+            throw system_error("Unable to write a memfd");
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    // The client maps it, nobody may change it afterwards
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        std::runtime_error error = system_error("Unable to seal a memfd");
+        close(fd);
+        throw error;
+    }
+    return fd;
+#endif
+}
+
+std::shared_ptr<const MappedFile> map_memfd(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw system_error("Unable to read a memfd");
+    }
+    if (st.st_size == 0) {
+        throw std::runtime_error("The render daemon sent an empty file");
+    }
+
+    // Private writable mapping: JS may write into the buffer, the daemon's copy stays sealed
+    void* data = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        throw system_error("Unable to map a memfd");
+    }
+    return std::make_shared<MappedFile>(static_cast<uint8_t*>(data), static_cast<size_t>(st.st_size));
+}
+
+DaemonClient::DaemonClient(const std::string& path, int timeout): path_(path), timeout_(timeout) {
+#ifndef __linux__
+    throw std::invalid_argument("The render daemon is only available on Linux");
+#endif
+    sockaddr_un address;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Invalid render daemon socket path " + path);
+    }
+    if (timeout <= 0) {
+        throw std::invalid_argument("The render daemon timeout must be a positive number of milliseconds");
+    }
+}
+
+DaemonClient::~DaemonClient() {
+    close_all(this->idle_);
+}
+
+std::shared_ptr<DaemonClient> DaemonClient::shared(const std::string& path, int timeout) {
+    static std::mutex mutex;
+    static std::map<std::pair<std::string, int>, std::weak_ptr<DaemonClient>> clients;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::weak_ptr<DaemonClient>& entry = clients[{path, timeout}];
+    std::shared_ptr<DaemonClient> client = entry.lock();
+    if (!client) {
+        client = std::make_shared<DaemonClient>(path, timeout);
+        entry = client;
+    }
+    return client;
+}
+
+int DaemonClient::connect_socket() const {
+    int fd = socket(AF_UNIX, SOCK_STREAM | socketFlags, 0);
+    if (fd < 0) {
+        throw system_error("Unable to create a socket");
+    }
+
+    // Bounds connect too, when the daemon does not accept connections
+    timeval timeout {this->timeout_ / 1000, (this->timeout_ % 1000) * 1000};
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0) {
+        std::runtime_error error = system_error("Unable to set the render daemon socket timeout");
+        close(fd);
+        throw error;
+    }
+
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, this->path_.c_str(), sizeof(address.sun_path) - 1);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        if (timed_out() || errno == EINPROGRESS) {
+            close(fd);
+            throw DaemonTimeout("The render daemon at " + this->path_ + " did not accept the connection in time");
+        }
+        std::runtime_error error = system_error("Unable to connect to the render daemon at " + this->path_);
+        close(fd);
+        throw error;
+    }
+    return fd;
+}
+
+Json DaemonClient::request(const Json& message, std::vector<int>& fds, std::string* code) {
+    for (int attempt = 0;; attempt++) {
+        int socket = -1;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (!this->idle_.empty()) {
+                socket = this->idle_.back();
+                this->idle_.pop_back();
+            }
+        }
+        const bool reused = socket >= 0;
+        if (!reused) {
+            socket = connect_socket();
+        }
+
+        Json reply;
+        try {
+            send_message(socket, message);
+            reply = receive_message(socket, fds);
+        } catch (const DaemonTimeout&) {
+            // The late reply would answer the next request of the connection
+            close(socket);
+            close_all(fds);
+            throw;
+        } catch (const std::runtime_error&) {
+            close(socket);
+            close_all(fds);
+            // An idle connection may belong to a daemon that has restarted since
+            if (reused && attempt == 0) {
+                continue;
+            }
+            throw;
+        }
+
+        const std::string replyCode = reply["code"].is_string() ? reply["code"].as_string() : "";
+        // The daemon closes a connection it refuses
+        if (replyCode == "EBUSY") {
+            close(socket);
+        } else {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->idle_.push_back(socket);
+        }
+
+        if (reply["ok"].is_bool() && reply["ok"].as_bool()) {
+            return reply;
+        }
+        close_all(fds);
+
+        const std::string error = reply["error"].is_string() ? reply["error"].as_string() : "Render daemon error";
+        if (code != nullptr && replyCode == "ENOENT") {
+            *code = replyCode;
+            return reply;
+        }
+        if (replyCode == "EINVAL") {
+            throw std::invalid_argument(error);
+        }
+        throw std::runtime_error(error);
+    }
+}
+
+std::string DaemonClient::load(const Json& document) {
+    Json message(Json::Object{});
+    message.set("op", "load");
+    message.set("template", document);
+
+    std::vector<int> fds;
+    Json reply = request(message, fds);
+    close_all(fds);
+    return reply["id"].as_string();
+}
+
+MappedOutputs DaemonClient::render(const std::string& id, const Json& document, const Json& job) {
+    TraceSpan span("render on daemon");
+
+    Json message = job;
+    message.set("op", "render");
+    message.set("id", id);
+
+    std::vector<int> fds;
+    std::string code;
+    Json reply = request(message, fds, &code);
+    if (code == "ENOENT") {
+        message.set("id", load(document));
+        reply = request(message, fds);
+    }
+
+    MappedOutputs outputs;
+    const Json& files = reply["files"];
+    if (!files.is_array() || files.as_array().size() != fds.size()) {
+        close_all(fds);
+        throw std::runtime_error("The render daemon sent an invalid reply");
+    }
+    try {
+        for (size_t i = 0; i < fds.size(); i++) {
+            outputs[files.as_array()[i].as_string()] = map_memfd(fds[i]);
+        }
+    } catch (...) {
+        close_all(fds);
+        throw;
+    }
+    close_all(fds);
+    return outputs;
+}
+
+std::shared_ptr<const DaemonTemplate> DaemonTemplate::load(const std::shared_ptr<DaemonClient>& client, const Json& document) {
+    auto remote = std::make_shared<DaemonTemplate>();
+    remote->client = client;
+    remote->document = absolute_countdown_paths(document);
+    remote->id = remote->client->load(remote->document);
+    return remote;
+}
+
+MappedOutputs DaemonTemplate::render(const std::vector<int>& start, int frames, const CountdownRenderOptions& options) const {
+    Json moment(Json::Object{});
+    for (int i = 0; i < lengthOfCountdownMomentParts; i++) {
+        moment.set(countdownMomentPartNames[i], static_cast<double>(start.at(i)));
+    }
+
+    Json renderOptions(Json::Object{});
+    if (!options.lang.empty()) {
+        renderOptions.set("lang", options.lang);
+    }
+    if (!options.outputs.empty()) {
+        Json outputs(Json::Array{});
+        for (const std::string& output: options.outputs) {
+            outputs.push_back(output);
+        }
+        renderOptions.set("outputs", outputs);
+    }
+    renderOptions.set("posterFormat", options.posterFormat);
+    renderOptions.set("scale", options.scale);
+    renderOptions.set("lossy", static_cast<double>(options.lossy));
+
+    Json job(Json::Object{});
+    job.set("start", moment);
+    job.set("frames", static_cast<double>(frames));
+    job.set("options", renderOptions);
+    return this->client->render(this->id, this->document, job);
+}
+
+Json DaemonClient::stats() {
+    Json message(Json::Object{});
+    message.set("op", "stats");
+
+    std::vector<int> fds;
+    Json reply = request(message, fds);
+    close_all(fds);
+    return reply;
+}
+
+}
@@ -0,0 +1,124 @@
+#ifndef RENDER_DAEMON_H
+#define RENDER_DAEMON_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "countdown_renderer.h"
+#include "disk_cache.h"
+#include "json.h"
+
+namespace jsvips {
+
+    //
+    // Protocol of vips-render-daemon, the process that owns the compiled
+    // templates, the disk cache and the render threads of a host, and its client.
+    //
+    // A message is a 4 byte little-endian length followed by a JSON document,
+    // on a Unix stream socket. The files of a render reply are passed with
+    // SCM_RIGHTS and mapped by the client, the bytes never go through the
+    // socket. A file of the disk cache is sent as it is, without a copy,
+    // other files are copied once into a sealed memfd.
+    //
+    //   {"op": "load", "template": {...}}     -> {"ok": true, "id": "..."}
+    //   {"op": "render", "id": "...", "start": {...}, "frames": 60, "options": {...}}
+    //                                         -> {"ok": true, "files": ["gif"]} and one descriptor per file
+    //   {"op": "stats"}                       -> {"ok": true, "templates": 2, "renders": 120, ...}
+    //
+    // A failed request is answered {"ok": false, "error": "...", "code": "..."}
+    // with EINVAL for invalid options, ENOENT for an unknown template id.
+    //
+    // Linux only: elsewhere the client builds and rejects every daemon path.
+    //
+
+    // The daemon did not read or answer a request in time
+    class DaemonTimeout: public std::runtime_error {
+      public:
+        using std::runtime_error::runtime_error;
+    };
+
+    // Send a message and file descriptors, throws std::runtime_error, or
+    // DaemonTimeout past the send timeout of the socket
+    void send_message(int socket, const Json& message, const std::vector<int>& fds = {});
+
+    // Receive a message and the file descriptors sent with it, which the
+    // caller closes. Throws std::runtime_error, also when the peer is gone,
+    // or DaemonTimeout past the receive timeout of the socket.
+    Json receive_message(int socket, std::vector<int>& fds);
+
+    // A memfd holding a copy of data, sealed against writes and resizing.
+    // Throws std::runtime_error when it cannot be created or sealed.
+    int memfd_of(const uint8_t* data, size_t size);
+
+    // Map a received file, a memfd or a file of the disk cache, copy-on-write.
+    // The descriptor can be closed afterwards.
+    std::shared_ptr<const MappedFile> map_memfd(int fd);
+
+    // Connections to the daemon listening on a socket path. Requests may come
+    // from several threads, each one takes an idle connection or opens one.
+    // A request the daemon does not answer within timeout milliseconds throws
+    // DaemonTimeout, its connection is closed.
+    class DaemonClient {
+      public:
+        static const int defaultTimeout = 60000;
+
+        explicit DaemonClient(const std::string& path, int timeout = defaultTimeout);
+        ~DaemonClient();
+
+        DaemonClient(const DaemonClient&) = delete;
+        DaemonClient& operator=(const DaemonClient&) = delete;
+
+        // The client of a socket path and timeout shared by the instances of the process
+        static std::shared_ptr<DaemonClient> shared(const std::string& path, int timeout = defaultTimeout);
+
+        const std::string& path() const { return path_; }
+        int timeout() const { return timeout_; }
+
+        // Compile a countdown template document in the daemon, returns its id.
+        // The daemon compiles a document once for all its clients.
+        std::string load(const Json& document);
+
+        // Render a countdown: job has start, frames and options. A template
+        // the daemon does not know, after a restart, is loaded again from its
+        // document.
+        MappedOutputs render(const std::string& id, const Json& document, const Json& job);
+
+        Json stats();
+
+      private:
+        // Reply of the daemon, an error reply is thrown: std::invalid_argument
+        // for EINVAL, std::runtime_error otherwise. code is set for errors
+        // the caller handles itself.
+        Json request(const Json& message, std::vector<int>& fds, std::string* code = nullptr);
+        int connect_socket() const;
+
+        std::string path_;
+        int timeout_;
+        std::mutex mutex_;
+        std::vector<int> idle_;
+    };
+
+    // A countdown template compiled by the daemon, as a client sees it
+    struct DaemonTemplate {
+        std::shared_ptr<DaemonClient> client;
+        // The document it is compiled from, loaded again after a daemon restart
+        Json document;
+        std::string id;
+
+        // Load document through client. Its relative file paths are made
+        // absolute first: the daemon does not share the working directory.
+        static std::shared_ptr<const DaemonTemplate> load(const std::shared_ptr<DaemonClient>& client, const Json& document);
+
+        // The outputs of options, a GIF without outputs. toFile and scales
+        // are left to the caller, scale selects the density.
+        MappedOutputs render(const std::vector<int>& start, int frames, const CountdownRenderOptions& options) const;
+    };
+
+}
+
+#endif
@@ -0,0 +1,624 @@
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/stat.h>
+
+#include "render_options.h"
+#include "utils.h"
+
+namespace jsvips {
+
+namespace {
+
+// Densities above 4x are rather a mistake in the template
+const double maxScale = 4;
+
+void require(const Json& options, const std::string& key) {
+    if (!options.has(key)) {
+        throw std::invalid_argument("Missing " + key + " attribute");
+    }
+}
+
+// Size and modification time of a file read by the template: the fingerprint
+// changes with the file, not only with the document naming it
+std::string file_stamp(const std::string& path) {
+    struct stat st;
+    if (path.empty() || stat(path.c_str(), &st) != 0) {
+        return path + "\n";
+    }
+    return path + " " + std::to_string(st.st_size) + " " + std::to_string(st.st_mtim.tv_sec) + "." +
+           std::to_string(st.st_mtim.tv_nsec) + "\n";
+}
+
+std::string files_stamp(const CountdownOptions& opts) {
+    std::string stamp = file_stamp(opts.background.file);
+    for (const auto& [key, label]: opts.labels) {
+        stamp += file_stamp(label.fontFile);
+    }
+    return stamp + file_stamp(opts.digits.style.fontFile);
+}
+
+// Optional number attribute, value is left alone when missing
+void read_int(const Json& options, const std::string& key, int& value) {
+    if (options.has(key)) {
+        if (!options[key].is_number()) {
+            throw std::invalid_argument("Attribute " + key + " must be a number");
+        }
+        value = options[key].as_int();
+    }
+}
+
+// Optional string attribute, value is left alone when missing
+void read_string(const Json& options, const std::string& key, std::string& value) {
+    if (options.has(key)) {
+        if (!options[key].is_string()) {
+            throw std::invalid_argument("Attribute " + key + " must be a string");
+        }
+        value = options[key].as_string();
+    }
+}
+
+void read_lossy(const Json& options, int& lossy) {
+    if (options.has("lossy")) {
+        if (!options["lossy"].is_number()) {
+            throw std::invalid_argument("Attribute lossy must be a number");
+        }
+        lossy = options["lossy"].as_int();
+        if (lossy < 0 || lossy > 255) {
+            throw std::invalid_argument("Attribute lossy should be between 0 and 255");
+        }
+    }
+}
+
+void read_color(const Json& options, std::string& color) {
+    read_string(options, "color", color);
+    if (color.empty() || color.at(0) != '#') {
+        throw std::invalid_argument("Attribute color should be a valid hexadecimal string");
+    }
+}
+
+void read_alignment(const Json& options, VipsCompassDirection& alignment) {
+    std::string textAlignment;
+    read_string(options, "textAlignment", textAlignment);
+    if (!textAlignment.empty()) {
+        alignment = to_compass_direction(textAlignment, VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE);
+    }
+}
+
+// Array of densities, each one positive and at most maxScale
+std::vector<double> read_scales(const Json& options, const std::string& key) {
+    if (!options[key].is_array() || options[key].as_array().empty()) {
+        throw std::invalid_argument("Attribute " + key + " must be an array of numbers");
+    }
+
+    std::vector<double> scales;
+    for (const Json& scale: options[key].as_array()) {
+        if (!scale.is_number() || scale.as_number() <= 0 || scale.as_number() > maxScale) {
+            throw std::invalid_argument("Attribute " + key + " must be an array of numbers between 0 and 4");
+        }
+        if (std::find(scales.begin(), scales.end(), scale.as_number()) == scales.end()) {
+            scales.push_back(scale.as_number());
+        }
+    }
+    return scales;
+}
+
+int scaled(int value, double scale) {
+    return static_cast<int>(value * scale + 0.5);
+}
+
+void scale_position(Position2D& position, double scale) {
+    position.x = scaled(position.x, scale);
+    position.y = scaled(position.y, scale);
+    position.width = scaled(position.width, scale);
+    position.height = scaled(position.height, scale);
+}
+
+void scale_style(CountdownComponentStyle& style, double scale) {
+    style.width = scaled(style.width, scale);
+    style.height = scaled(style.height, scale);
+}
+
+const Json& object_attribute(const Json& options, const std::string& key) {
+    require(options, key);
+    if (!options[key].is_object()) {
+        throw std::invalid_argument("Attribute " + key + " must be an object");
+    }
+    return options[key];
+}
+
+}
+
+CreationOptions parse_creation_options(const Json& options) {
+    CreationOptions opts;
+
+    if (!options["width"].is_number()) {
+        throw std::invalid_argument("The value of the width should be a number");
+    }
+    opts.width = options["width"].as_int();
+
+    if (!options["height"].is_number()) {
+        throw std::invalid_argument("The value of the height should be a number");
+    }
+    opts.height = options["height"].as_int();
+
+    if (!options["bgColor"].is_string()) {
+        throw std::invalid_argument("bgColor should be a string");
+    }
+    opts.bgColor = options["bgColor"].as_string();
+    if (opts.bgColor.empty() || opts.bgColor.at(0) != '#') {
+        throw std::invalid_argument("bgColor should be a valid hexadecimal string");
+    }
+
+    return opts;
+}
+
+/**
+ * Parse position options
+ */
+Position2D parse_position_2d(const Json& options) {
+    Position2D position;
+    position.width = 0;
+    position.height = 0;
+
+    // attribute "x" and "y" - required
+    require(options, "x");
+    read_int(options, "x", position.x);
+    require(options, "y");
+    read_int(options, "y", position.y);
+
+    // attribute "width" and "height" - optional
+    read_int(options, "width", position.width);
+    read_int(options, "height", position.height);
+
+    return position;
+}
+
+/**
+ * Parse countdown component options
+ */
+CountdownComponent parse_countdown_component(const Json& options, bool ignoreText) {
+    CountdownComponent component;
+
+    // attribute "text" - required / optional
+    if (!ignoreText) {
+        require(options, "text");
+    }
+    read_string(options, "text", component.text);
+
+    // attribute "texts" - optional, text per language
+    if (options.has("texts")) {
+        if (!options["texts"].is_object()) {
+            throw std::invalid_argument("Attribute texts must be an object");
+        }
+        for (const auto& [lang, text]: options["texts"].as_object()) {
+            if (!text.is_string()) {
+                throw std::invalid_argument("Text of language " + lang + " must be a string");
+            }
+            component.texts[lang] = text.as_string();
+        }
+    }
+
+    read_int(options, "paddingTop", component.paddingTop);
+    read_int(options, "paddingBottom", component.paddingBottom);
+
+    // attribute "position" - required
+    component.position = parse_position_2d(object_attribute(options, "position"));
+
+    static_cast<CountdownComponentStyle&>(component) = parse_countdown_component_style(options);
+
+    return component;
+}
+
+CountdownComponentPosition parse_countdown_component_position(const Json& options) {
+    CountdownComponentPosition cp;
+    cp.position = parse_position_2d(object_attribute(options, "position"));
+    return cp;
+}
+
+CountdownComponentStyle parse_countdown_component_style(const Json& options) {
+    CountdownComponentStyle cs;
+
+    read_color(options, cs.color);
+    read_int(options, "width", cs.width);
+    read_int(options, "height", cs.height);
+    read_alignment(options, cs.textAlignment);
+    read_string(options, "font", cs.font);
+    read_string(options, "fontFile", cs.fontFile);
+
+    return cs;
+}
+
+/**
+ * Parse countdown options
+ */
+CountdownOptions parse_countdown_options(const Json& options) {
+    CountdownOptions opts;
+    static_cast<CreationOptions&>(opts) = parse_creation_options(options);
+
+    // Attribute "name" - optional
+    read_string(options, "name", opts.name);
+
+    // Attribute "langs" - optional, the first one is the default language
+    if (options.has("langs")) {
+        if (!options["langs"].is_array()) {
+            throw std::invalid_argument("Parameter langs should be an array of strings");
+        }
+        for (const Json& lang: options["langs"].as_array()) {
+            if (!lang.is_string()) {
+                throw std::invalid_argument("Parameter langs should be an array of strings");
+            }
+            opts.langs.push_back(lang.as_string());
+        }
+    }
+
+    // Attribute "labels" - required
+    require(options, "labels");
+    if (!options["labels"].is_object()) {
+        throw std::invalid_argument("Parameter labels should be an object");
+    }
+    for (const auto& [key, label]: options["labels"].as_object()) {
+        if (!label.is_object()) {
+            throw std::invalid_argument("Invalid format label object");
+        }
+        opts.labels[key] = parse_countdown_component(label);
+    }
+
+    // Attribute "digits" - required
+    require(options, "digits");
+    const Json& digits = options["digits"];
+    if (!digits.is_object()) {
+        throw std::invalid_argument("Parameter digits should be an object");
+    }
+
+    require(digits, "positions");
+    const Json& positions = digits["positions"];
+    if (!positions.is_object()) {
+        throw std::invalid_argument("Parameter positions should be an object");
+    }
+    for (int i = 0; i < lengthOfCountdownMomentParts; i++) {
+        const std::string& k = countdownMomentPartNames[i];
+        if (!positions.has(k)) {
+            throw std::invalid_argument("Missing attribute " + k);
+        }
+        if (!positions[k].is_object()) {
+            throw std::invalid_argument("Invalid format position object");
+        }
+        opts.digits.positions[i] = parse_countdown_component_position(positions[k]);
+    }
+
+    // Attribute "style" - optional
+    if (digits.has("style")) {
+        if (!digits["style"].is_object()) {
+            throw std::invalid_argument("Parameter styles should be an object");
+        }
+        opts.digits.style = parse_countdown_component_style(digits["style"]);
+    }
+
+    // Attribute "textTemplate" - optional
+    read_string(digits, "textTemplate", opts.digits.textTemplate);
+
+    // Attribute "scales" - optional
+    if (options.has("scales")) {
+        opts.scales = read_scales(options, "scales");
+    }
+
+    // Attribute "background" - optional, the path of an image or animation
+    read_string(options, "background", opts.background.file);
+
+    opts.fingerprint = content_hash(options.canonical() + "\n" + files_stamp(opts));
+
+    return opts;
+}
+
+CountdownRenderOptions parse_countdown_render_options(const Json& options) {
+    CountdownRenderOptions opts;
+
+    read_string(options, "toFile", opts.toFile);
+    read_string(options, "lang", opts.lang);
+
+    // attribute "outputs" - optional
+    if (options.has("outputs")) {
+        if (!options["outputs"].is_array()) {
+            throw std::invalid_argument("Attribute outputs must be an array of formats");
+        }
+        for (const Json& output: options["outputs"].as_array()) {
+            if (!output.is_string() || (output.as_string() != "gif" && output.as_string() != "webp" && output.as_string() != "poster")) {
+                throw std::invalid_argument("Attribute outputs accepts gif, webp and poster");
+            }
+            if (std::find(opts.outputs.begin(), opts.outputs.end(), output.as_string()) != opts.outputs.end()) {
+                throw std::invalid_argument("Output " + output.as_string() + " is given twice");
+            }
+            opts.outputs.push_back(output.as_string());
+        }
+        if (!opts.toFile.empty() && !opts.outputs.empty()) {
+            throw std::invalid_argument("Attribute toFile cannot be combined with outputs");
+        }
+    }
+
+    read_string(options, "posterFormat", opts.posterFormat);
+    if (opts.posterFormat != "png" && opts.posterFormat != "jpg") {
+        throw std::invalid_argument("Attribute posterFormat should be png or jpg");
+    }
+
+    // attribute "scale" and "scales" - optional
+    if (options.has("scale")) {
+        if (!options["scale"].is_number()) {
+            throw std::invalid_argument("Attribute scale must be a number");
+        }
+        opts.scale = options["scale"].as_number();
+    }
+    if (options.has("scales")) {
+        opts.scales = read_scales(options, "scales");
+        if (!opts.toFile.empty()) {
+            throw std::invalid_argument("Attribute toFile cannot be combined with scales");
+        }
+    }
+
+    read_lossy(options, opts.lossy);
+
+    return opts;
+}
+
+std::vector<int> parse_countdown_moment_with_number(const Json& options) {
+    // Days have the two digits of the template
+    static const int maxValues[lengthOfCountdownMomentParts] = {totalOfDigits - 1, 23, 59, 59};
+    std::vector<int> moment;
+
+    for (int i = 0; i < lengthOfCountdownMomentParts; i++) {
+        const std::string& k = countdownMomentPartNames[i];
+        if (!options.has(k)) {
+            throw std::invalid_argument("Missing attribute " + k);
+        }
+        int value = 0;
+        read_int(options, k, value);
+        if (value < 0 || value > maxValues[i]) {
+            throw std::invalid_argument("Attribute " + k + " must be between 0 and " + std::to_string(maxValues[i]));
+        }
+        moment.push_back(value);
+    }
+
+    return moment;
+}
+
+int parse_countdown_frames(const Json& frames) {
+    if (!frames.is_number()) {
+        throw std::invalid_argument("Invalid frames number");
+    }
+    return countdown_frames(frames.as_int(), 1);
+}
+
+int countdown_frames(int frames, int pageHeight) {
+    if (frames > maxCountdownFrames) {
+        throw std::invalid_argument("A countdown has at most " + std::to_string(maxCountdownFrames) + " frames");
+    }
+    const int numFrames = std::max(frames, 1);
+    if (static_cast<int64_t>(pageHeight) * numFrames > VIPS_MAX_COORD) {
+        throw std::invalid_argument("A countdown of " + std::to_string(numFrames) + " frames is too tall, at most " +
+                                    std::to_string(VIPS_MAX_COORD / std::max(pageHeight, 1)) + " frames");
+    }
+    return numFrames;
+}
+
+/**
+ * Parse a template slot: a style, a box and the allowed values
+ */
+TemplateSlot parse_template_slot(const Json& options) {
+    TemplateSlot slot;
+    static_cast<CountdownComponentStyle&>(slot) = parse_countdown_component_style(options);
+
+    // attribute "position" - required, with width and height
+    slot.position = parse_position_2d(object_attribute(options, "position"));
+    if (slot.position.width <= 0 || slot.position.height <= 0) {
+        throw std::invalid_argument("The position of a slot needs a width and a height");
+    }
+
+    read_int(options, "paddingTop", slot.paddingTop);
+    read_int(options, "paddingBottom", slot.paddingBottom);
+    read_string(options, "textTemplate", slot.textTemplate);
+
+    // attribute "values" - optional, free text when missing
+    if (options.has("values")) {
+        if (!options["values"].is_array()) {
+            throw std::invalid_argument("Attribute values must be an array of strings or numbers");
+        }
+        for (const Json& value: options["values"].as_array()) {
+            if (!value.is_string() && !value.is_number()) {
+                throw std::invalid_argument("Attribute values must be an array of strings or numbers");
+            }
+            slot.values.push_back(value.to_string());
+        }
+    }
+
+    return slot;
+}
+
+/**
+ * Parse template options
+ */
+TemplateOptions parse_template_options(const Json& options) {
+    TemplateOptions opts;
+    static_cast<CreationOptions&>(opts) = parse_creation_options(options);
+
+    // Attribute "layers" - optional
+    if (options.has("layers")) {
+        if (!options["layers"].is_array()) {
+            throw std::invalid_argument("Parameter layers should be an array");
+        }
+        for (const Json& layer: options["layers"].as_array()) {
+            if (!layer.is_object()) {
+                throw std::invalid_argument("Invalid format layer object");
+            }
+            opts.layers.push_back(parse_countdown_component(layer));
+        }
+    }
+
+    // Attribute "slots" - required
+    require(options, "slots");
+    if (!options["slots"].is_object()) {
+        throw std::invalid_argument("Parameter slots should be an object");
+    }
+    for (const auto& [key, slot]: options["slots"].as_object()) {
+        if (!slot.is_object()) {
+            throw std::invalid_argument("Invalid format slot object");
+        }
+        opts.slots[key] = parse_template_slot(slot);
+    }
+
+    // Attribute "cacheSize" - optional
+    if (options.has("cacheSize")) {
+        if (!options["cacheSize"].is_number() || options["cacheSize"].as_int() < 0) {
+            throw std::invalid_argument("Parameter cacheSize should be a positive number");
+        }
+        opts.cacheSize = options["cacheSize"].as_int();
+    }
+
+    return opts;
+}
+
+TemplateRenderOptions parse_template_render_options(const Json& options) {
+    TemplateRenderOptions opts;
+
+    read_string(options, "toFile", opts.toFile);
+    read_string(options, "format", opts.format);
+    read_lossy(options, opts.lossy);
+
+    return opts;
+}
+
+SaveOptions parse_save_options(const Json& options) {
+    SaveOptions opts;
+    read_lossy(options, opts.lossy);
+    return opts;
+}
+
+std::map<std::string, std::string> parse_template_values(const Json& values) {
+    std::map<std::string, std::string> result;
+
+    for (const auto& [key, value]: values.as_object()) {
+        if (value.is_string() || value.is_number()) {
+            result[key] = value.to_string();
+        } else if (!value.is_null()) {
+            throw std::invalid_argument("Value of slot " + key + " must be a string or a number");
+        }
+    }
+
+    return result;
+}
+
+CountdownOptions scale_countdown_options(const CountdownOptions& options, double scale) {
+    CountdownOptions opts = options;
+    opts.width = scaled(options.width, scale);
+    opts.height = scaled(options.height, scale);
+
+    for (auto& [key, label]: opts.labels) {
+        scale_position(label.position, scale);
+        scale_style(label, scale);
+        label.paddingTop = scaled(label.paddingTop, scale);
+        label.paddingBottom = scaled(label.paddingBottom, scale);
+    }
+    for (CountdownComponentPosition& cp: opts.digits.positions) {
+        scale_position(cp.position, scale);
+    }
+    scale_style(opts.digits.style, scale);
+
+    opts.scales = {scale};
+    opts.scale = scale;
+    opts.fingerprint = options.fingerprint + "@" + scale_name(scale);
+    return opts;
+}
+
+std::string scale_name(double scale) {
+    return Json(scale).to_string() + "x";
+}
+
+void set_countdown_background(CountdownOptions& options, std::vector<uint8_t> data) {
+    if (data.empty()) {
+        throw std::invalid_argument("The background buffer is empty");
+    }
+    std::string hash = content_hash(std::string(data.begin(), data.end()));
+    options.background.file.clear();
+    options.background.data = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+    options.fingerprint = content_hash(options.fingerprint + "\n" + hash);
+}
+
+void set_countdown_label(CountdownOptions& options, const std::string& key, const Json& label) {
+    if (key.empty()) {
+        throw std::invalid_argument("Missing label key");
+    }
+    if (!label.is_object()) {
+        throw std::invalid_argument("Invalid format label object");
+    }
+    options.labels[key] = parse_countdown_component(label);
+    options.fingerprint = content_hash(options.fingerprint + "\nlabel " + key + "\n" + label.canonical() + "\n" +
+                                       file_stamp(options.labels[key].fontFile));
+}
+
+void set_countdown_digit_style(CountdownOptions& options, const Json& style) {
+    if (!style.is_object()) {
+        throw std::invalid_argument("Parameter styles should be an object");
+    }
+    options.digits.style = parse_countdown_component_style(style);
+    options.fingerprint = content_hash(options.fingerprint + "\ndigits\n" + style.canonical() + "\n" +
+                                       file_stamp(options.digits.style.fontFile));
+}
+
+Json absolute_countdown_paths(const Json& document) {
+    auto make_absolute = [](Json& object, const std::string& key) {
+        if (object[key].is_string() && !object[key].as_string().empty()) {
+            object.set(key, std::filesystem::absolute(object[key].as_string()).string());
+        }
+    };
+
+    Json absolute = document;
+    make_absolute(absolute, "background");
+    if (absolute["labels"].is_object()) {
+        Json labels(Json::Object{});
+        for (const auto& [key, value]: absolute["labels"].as_object()) {
+            Json label = value;
+            if (label.is_object()) {
+                make_absolute(label, "fontFile");
+            }
+            labels.set(key, label);
+        }
+        absolute.set("labels", labels);
+    }
+    if (absolute["digits"].is_object() && absolute["digits"]["style"].is_object()) {
+        Json digits = absolute["digits"];
+        Json style = digits["style"];
+        make_absolute(style, "fontFile");
+        digits.set("style", style);
+        absolute.set("digits", digits);
+    }
+    return absolute;
+}
+
+void countdown_minus_one_second(std::vector<int>& moment) {
+    if (moment.size() != lengthOfCountdownMomentParts) {
+        throw std::invalid_argument("Invalid duration size");
+    }
+
+    int& days = moment[static_cast<int>(CountdownMomentPart::DAYS)];
+    int& hours = moment[static_cast<int>(CountdownMomentPart::HOURS)];
+    int& minutes = moment[static_cast<int>(CountdownMomentPart::MINUTES)];
+    int& seconds = moment[static_cast<int>(CountdownMomentPart::SECONDS)];
+
+    if (--seconds >= 0) {
+        return;
+    }
+    seconds += 60;
+    if (--minutes >= 0) {
+        return;
+    }
+    minutes += 60;
+    if (--hours >= 0) {
+        return;
+    }
+    hours += 24;
+    if (--days < 0) {
+        // Reset all to 0
+        days = hours = minutes = seconds = 0;
+    }
+}
+
+}
@@ -0,0 +1,244 @@
+#ifndef RENDER_OPTIONS_H
+#define RENDER_OPTIONS_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <vips/vips8>
+
+#include "json.h"
+
+//
+// Options of the rendering core. They are read from a JSON document, the
+// addon converts its JS arguments first and the command line tool reads
+// files. Parse errors are reported with std::invalid_argument.
+//
+
+enum class CountdownMomentPart {
+  DAYS,
+  HOURS,
+  MINUTES,
+  SECONDS
+};
+
+const int lengthOfCountdownMomentParts = static_cast<int>(CountdownMomentPart::SECONDS) + 1;
+const int totalOfDigits = 100;
+// Display time of a countdown frame in milliseconds
+const int countdownFrameDelay = 1000;
+// Frames kept of an animated background, each one is a layer of the template
+const int maxBackgroundFrames = 120;
+// Frames of a countdown render, an hour
+const int maxCountdownFrames = 3600;
+
+const std::string countdownMomentPartNames[lengthOfCountdownMomentParts] = {
+  "days",
+  "hours",
+  "minutes",
+  "seconds"
+};
+
+struct CreationOptions {
+    int width {0};
+    int height {0};
+    std::string bgColor {"#ffffff"};
+};
+
+struct ColoredTextOptions {
+    std::vector<u_char> textColor {255, 255, 255};
+    std::string font;
+    std::string fontFile;
+    int width {0};
+    int height {0};
+    VipsCompassDirection textAlignment {VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE};
+    int paddingTop {0};
+    int paddingBottom {0};
+    // Resolution of the text, 0 for the libvips default of 72
+    int dpi {0};
+};
+
+template <typename T>
+struct Dimension2D {
+    T width;
+    T height;
+};
+
+template <typename T>
+struct CountdownMoment {
+    T days;
+    T hours;
+    T minutes;
+    T seconds;
+};
+
+struct Position2D : Dimension2D<int> {
+    int x {0};
+    int y {0};
+};
+
+struct CountdownComponentStyle {
+    std::string color {"#ffffff"};
+    std::string font;
+    std::string fontFile;
+    int width {0};
+    int height {0};
+    VipsCompassDirection textAlignment {VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE};
+};
+
+struct CountdownComponentPosition {
+  // Position of the component - required
+  Position2D            position;
+};
+
+struct CountdownComponent : CountdownComponentPosition, CountdownComponentStyle {
+    // Text to display - required
+    std::string text;
+    // Text per language, text is used for the other languages
+    std::map<std::string, std::string> texts;
+    int paddingTop {0};
+    int paddingBottom {0};
+};
+
+struct CountdownDigits {
+    CountdownComponentPosition positions[lengthOfCountdownMomentParts];
+    CountdownComponentStyle style;
+    std::string textTemplate;
+};
+
+// Image or animation behind a countdown, a file or an encoded buffer
+struct CountdownBackground {
+    std::string file;
+    std::shared_ptr<const std::vector<uint8_t>> data;
+
+    bool empty() const { return file.empty() && !data; }
+};
+
+struct CountdownOptions : CreationOptions {
+    std::string name;
+    // Languages of the labels, the first one is the default
+    std::vector<std::string> langs;
+
+    // labels
+    std::map<std::string, CountdownComponent> labels {};
+
+    // digits
+    CountdownDigits digits;
+
+    // Covers the canvas instead of bgColor, which shows through its
+    // transparent parts. The frames of an animation loop, one per second.
+    CountdownBackground background;
+
+    // Densities to compile the template at, e.g. {1, 2} for retina clients.
+    // The document describes the 1x template.
+    std::vector<double> scales {1};
+    // Density of these options, see scale_countdown_options
+    double scale {1};
+
+    // Hash of the document the options were read from, with its members in
+    // key order, and of the size and mtime of the files it reads. Names the
+    // renders of the template in the disk cache.
+    std::string fingerprint;
+};
+
+struct TemplateSlot : CountdownComponentStyle {
+    // Box of the slot, width and height are required
+    Position2D position;
+    int paddingTop {0};
+    int paddingBottom {0};
+    // Pango markup, %s is replaced by the value
+    std::string textTemplate;
+    // Allowed values, pre-rendered at init. Empty for free text.
+    std::vector<std::string> values;
+    // Part of the box inside the image, set at init
+    Position2D area;
+};
+
+struct TemplateOptions : CreationOptions {
+    // Static text layers, flattened into the background
+    std::vector<CountdownComponent> layers;
+    std::map<std::string, TemplateSlot> slots;
+    // Number of free text values kept rendered
+    size_t cacheSize {256};
+};
+
+struct TemplateRenderOptions {
+    std::string toFile;
+    // Output format when rendering to a buffer
+    std::string format {"png"};
+    // Colour error allowed to the GIF encoder, 0 for a lossless GIF
+    int lossy {0};
+};
+
+struct SaveOptions {
+    // Colour error allowed to the GIF encoder, 0 for a lossless GIF
+    int lossy {0};
+};
+
+struct CountdownRenderOptions {
+    std::string toFile;
+    // Language of the labels, the default language when empty
+    std::string lang;
+    // Formats encoded from one composition: gif, webp and poster. Empty for
+    // the single GIF or toFile output.
+    std::vector<std::string> outputs;
+    // Format of the poster, the first frame: png or jpg
+    std::string posterFormat {"png"};
+    // Density to render, one of the scales of the template
+    double scale {1};
+    // Render these densities at once instead of scale
+    std::vector<double> scales;
+    // Colour error allowed to the GIF encoder, 0 for a lossless GIF
+    int lossy {0};
+};
+
+namespace jsvips {
+
+    CreationOptions                  parse_creation_options(const Json& options);
+    Position2D                       parse_position_2d(const Json& options);
+    CountdownComponent               parse_countdown_component(const Json& options, bool ignoreText = false);
+    CountdownComponentPosition       parse_countdown_component_position(const Json& options);
+    CountdownComponentStyle          parse_countdown_component_style(const Json& options);
+    CountdownOptions                 parse_countdown_options(const Json& options);
+    CountdownRenderOptions           parse_countdown_render_options(const Json& options);
+    std::vector<int>                 parse_countdown_moment_with_number(const Json& options);
+    int                              parse_countdown_frames(const Json& frames);
+
+    // The frames of a render with pages of pageHeight: one below 1, throws
+    // std::invalid_argument past maxCountdownFrames or when the animation is
+    // taller than libvips images may be
+    int countdown_frames(int frames, int pageHeight);
+    TemplateSlot                     parse_template_slot(const Json& options);
+    TemplateOptions                  parse_template_options(const Json& options);
+    TemplateRenderOptions            parse_template_render_options(const Json& options);
+    SaveOptions                      parse_save_options(const Json& options);
+    // Slot values given to render(), numbers are converted to strings
+    std::map<std::string, std::string> parse_template_values(const Json& values);
+
+    // The options with every size and position multiplied by scale, the text
+    // is rendered at 72 * scale dpi
+    CountdownOptions scale_countdown_options(const CountdownOptions& options, double scale);
+    // Name of a density in results, e.g. "2x"
+    std::string scale_name(double scale);
+
+    // Use an encoded image or animation as the background, its bytes are part
+    // of the fingerprint
+    void set_countdown_background(CountdownOptions& options, std::vector<uint8_t> data);
+
+    // Replace or add the label key, or replace the style of the digits. The
+    // document of the change and its font file are part of the fingerprint.
+    void set_countdown_label(CountdownOptions& options, const std::string& key, const Json& label);
+    void set_countdown_digit_style(CountdownOptions& options, const Json& style);
+
+    // The countdown document with the paths of its background and font files
+    // made absolute against the working directory of this process, for a
+    // process that does not share it
+    Json absolute_countdown_paths(const Json& document);
+
+    // Take one second off a countdown moment in place, it stops at zero
+    void countdown_minus_one_second(std::vector<int>& moment);
+
+}
+
+#endif
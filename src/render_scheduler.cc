@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <thread>
+#include <vips/vips8>
+
+#include "render_scheduler.h"
+#include "trace.h"
+
+using namespace vips;
+
+RenderJob::~RenderJob() {
+    unwatch();
+}
+
+void RenderJob::cancel() {
+    this->cancelled_ = true;
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    for (auto& [image, handler]: this->watched_) {
+        vips_image_set_kill(image.get_image(), TRUE);
+    }
+}
+
+bool RenderJob::cancelled() const {
+    return this->cancelled_;
+}
+
+bool RenderJob::expired() const {
+    return this->deadline != Clock::time_point::max() && Clock::now() >= this->deadline;
+}
+
+void RenderJob::watch(const VImage& image) {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+
+    VipsImage* im = image.get_image();
+    // "eval" is only emitted for images with progress reporting enabled, it
+    // is then emitted for every pipeline built on top of this image. The
+    // handler goes first: stopping a trace leaves progress on when it is there.
+    unsigned long handler = g_signal_connect(im, "eval", G_CALLBACK(on_eval), this);
+    vips_image_set_progress(im, TRUE);
+    this->watched_.emplace_back(image, handler);
+
+    if (this->cancelled_) {
+        vips_image_set_kill(im, TRUE);
+    }
+}
+
+void RenderJob::unwatch() {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    for (auto& [image, handler]: this->watched_) {
+        g_signal_handler_disconnect(image.get_image(), handler);
+        vips_image_set_kill(image.get_image(), FALSE);
+    }
+    this->watched_.clear();
+}
+
+void RenderJob::on_eval(VipsImage* image, VipsProgress* progress, RenderJob* job) {
+    if (job->cancelled() || job->expired()) {
+        vips_image_set_kill(image, TRUE);
+    }
+}
+
+RenderScheduler::RenderScheduler(const SchedulerOptions& options) {
+    configure(options);
+}
+
+RenderScheduler::~RenderScheduler() {
+    std::vector<std::shared_ptr<RenderJob>> dropped;
+    {
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->stopping_ = true;
+        for (int i = 0; i < lengthOfJobPriorities; i++) {
+            dropped.insert(dropped.end(), this->queues_[i].begin(), this->queues_[i].end());
+            dropped.insert(dropped.end(), this->waiting_[i].begin(), this->waiting_[i].end());
+            this->queues_[i].clear();
+            this->waiting_[i].clear();
+        }
+        this->available_.notify_all();
+        this->finished_.wait(lock, [this] { return this->live_ == 0; });
+    }
+
+    for (const auto& job: dropped) {
+        job->done(JobStatus::CANCELLED, "The scheduler has been stopped");
+    }
+}
+
+RenderScheduler& RenderScheduler::shared() {
+    // Never destroyed: worker threads may still be finishing jobs while the
+    // process exits
+    static RenderScheduler* scheduler = new RenderScheduler();
+    return *scheduler;
+}
+
+void RenderScheduler::configure(const SchedulerOptions& options) {
+    int workers = options.workers > 0 ? options.workers : static_cast<int>(std::thread::hardware_concurrency());
+    workers = std::max(workers, 1);
+
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->options_ = options;
+        this->options_.workers = workers;
+        this->options_.queueSize = std::max<size_t>(options.queueSize, 1);
+        this->stats_.workers = workers;
+
+        // Workers of the previous generation exit after their current job
+        generation = ++this->generation_;
+        admit_waiting_locked();
+    }
+    this->available_.notify_all();
+
+    spawn_workers(workers, generation);
+}
+
+RenderScheduler::Admission RenderScheduler::submit(const std::shared_ptr<RenderJob>& job) {
+    int priority = static_cast<int>(job->priority);
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        if (this->stopping_) {
+            this->stats_.rejected++;
+            return Admission::REJECTED;
+        }
+
+        // Each priority class has its own bound, so bulk work cannot take the
+        // queue slots of interactive requests
+        if (this->waiting_[priority].empty() && this->queues_[priority].size() < this->options_.queueSize) {
+            this->queues_[priority].push_back(job);
+        } else if (this->options_.whenFull == QueueFullPolicy::WAIT) {
+            this->waiting_[priority].push_back(job);
+            return Admission::WAITING;
+        } else {
+            this->stats_.rejected++;
+            return Admission::REJECTED;
+        }
+    }
+    this->available_.notify_one();
+
+    return Admission::QUEUED;
+}
+
+void RenderScheduler::cancel(const std::shared_ptr<RenderJob>& job) {
+    bool dropped = false;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        for (auto* list: {&this->queues_, &this->waiting_}) {
+            for (auto& queue: *list) {
+                auto it = std::find(queue.begin(), queue.end(), job);
+                if (it != queue.end()) {
+                    queue.erase(it);
+                    dropped = true;
+                }
+            }
+        }
+
+        if (dropped) {
+            this->stats_.cancelled++;
+            admit_waiting_locked();
+        }
+    }
+
+    job->cancel();
+
+    if (dropped) {
+        job->done(JobStatus::CANCELLED, "The job was cancelled");
+    }
+}
+
+SchedulerStats RenderScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(this->mutex_);
+
+    SchedulerStats stats = this->stats_;
+    stats.waiting = 0;
+    for (int i = 0; i < lengthOfJobPriorities; i++) {
+        stats.queued[i] = this->queues_[i].size();
+        stats.waiting += this->waiting_[i].size();
+    }
+    return stats;
+}
+
+void RenderScheduler::spawn_workers(int count, uint64_t generation) {
+    for (int i = 0; i < count; i++) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->live_++;
+        }
+        std::thread(&RenderScheduler::worker, this, generation).detach();
+    }
+}
+
+void RenderScheduler::worker(uint64_t generation) {
+    for (;;) {
+        std::shared_ptr<RenderJob> job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->available_.wait(lock, [this, generation] {
+                return this->stopping_ || generation != this->generation_ || queued_locked() > 0;
+            });
+
+            if (this->stopping_ || generation != this->generation_) {
+                break;
+            }
+
+            job = pop_locked();
+            admit_waiting_locked();
+            this->stats_.running++;
+        }
+
+        run(job);
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stats_.running--;
+    }
+
+    // Free the per-thread buffers libvips keeps for this thread
+    vips_thread_shutdown();
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->live_--;
+    this->finished_.notify_all();
+}
+
+void RenderScheduler::run(const std::shared_ptr<RenderJob>& job) {
+    JobStatus status = JobStatus::DONE;
+    std::string error;
+
+    if (job->cancelled()) {
+        status = JobStatus::CANCELLED;
+    } else if (job->expired()) {
+        status = JobStatus::TIMED_OUT;
+    } else {
+        jsvips::TraceSpan span("job", "scheduler");
+        span.arg("priority", static_cast<int>(job->priority));
+        try {
+            job->work(*job);
+        } catch (const std::exception& e) {
+            status = JobStatus::FAILED;
+            error = e.what();
+        }
+        job->unwatch();
+
+        // A killed pipeline reports a generic error, tell why it was killed
+        if (status == JobStatus::FAILED && job->cancelled()) {
+            status = JobStatus::CANCELLED;
+        } else if (status == JobStatus::FAILED && job->expired()) {
+            status = JobStatus::TIMED_OUT;
+        }
+    }
+
+    if (status == JobStatus::CANCELLED) {
+        error = "The job was cancelled";
+    } else if (status == JobStatus::TIMED_OUT) {
+        error = "The job deadline has passed";
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        switch (status) {
+            case JobStatus::DONE: this->stats_.completed++; break;
+            case JobStatus::FAILED: this->stats_.failed++; break;
+            case JobStatus::CANCELLED: this->stats_.cancelled++; break;
+            case JobStatus::TIMED_OUT: this->stats_.timedOut++; break;
+        }
+    }
+
+    job->done(status, error);
+}
+
+std::shared_ptr<RenderJob> RenderScheduler::pop_locked() {
+    for (auto& queue: this->queues_) {
+        if (!queue.empty()) {
+            std::shared_ptr<RenderJob> job = queue.front();
+            queue.pop_front();
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void RenderScheduler::admit_waiting_locked() {
+    for (int i = 0; i < lengthOfJobPriorities; i++) {
+        while (!this->waiting_[i].empty() && this->queues_[i].size() < this->options_.queueSize) {
+            this->queues_[i].push_back(this->waiting_[i].front());
+            this->waiting_[i].pop_front();
+        }
+    }
+    this->available_.notify_all();
+}
+
+size_t RenderScheduler::queued_locked() const {
+    size_t total = 0;
+    for (const auto& queue: this->queues_) {
+        total += queue.size();
+    }
+    return total;
+}
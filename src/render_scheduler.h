@@ -0,0 +1,141 @@
+#ifndef RENDER_SCHEDULER_H
+#define RENDER_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vips/vips8>
+
+enum class JobPriority {
+  INTERACTIVE,
+  NORMAL,
+  BULK
+};
+
+const int lengthOfJobPriorities = static_cast<int>(JobPriority::BULK) + 1;
+
+const std::string jobPriorityNames[lengthOfJobPriorities] = {
+  "interactive",
+  "normal",
+  "bulk"
+};
+
+// What to do with a job when the queue is full
+enum class QueueFullPolicy {
+  REJECT,
+  WAIT
+};
+
+enum class JobStatus {
+  DONE,
+  FAILED,
+  CANCELLED,
+  TIMED_OUT
+};
+
+struct SchedulerOptions {
+    // Number of worker threads, 0 means one per hardware thread
+    int workers {0};
+    // Maximum number of jobs waiting for a worker
+    size_t queueSize {64};
+    QueueFullPolicy whenFull {QueueFullPolicy::REJECT};
+};
+
+struct SchedulerStats {
+    int workers {0};
+    int running {0};
+    size_t queued[lengthOfJobPriorities] {};
+    size_t waiting {0};
+    uint64_t completed {0};
+    uint64_t failed {0};
+    uint64_t cancelled {0};
+    uint64_t timedOut {0};
+    uint64_t rejected {0};
+};
+
+class RenderJob {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // The work itself, runs on a worker thread. Errors are reported by throwing.
+    std::function<void(RenderJob&)> work;
+    // Called exactly once for every admitted job, from a worker thread or from
+    // the thread cancelling a queued job
+    std::function<void(JobStatus, const std::string&)> done;
+
+    JobPriority priority {JobPriority::NORMAL};
+    Clock::time_point deadline {Clock::time_point::max()};
+
+    ~RenderJob();
+
+    // Stop the job. A queued job is dropped, a running libvips pipeline is killed.
+    void cancel();
+    bool cancelled() const;
+    bool expired() const;
+
+    // Watch the progress of an image pipeline so it can be killed on cancel or
+    // when the deadline passes
+    void watch(const vips::VImage& image);
+    void unwatch();
+
+  private:
+    static void on_eval(VipsImage* image, VipsProgress* progress, RenderJob* job);
+
+    std::atomic<bool> cancelled_ {false};
+    std::mutex mutex_;
+    std::vector<std::pair<vips::VImage, unsigned long>> watched_;
+};
+
+class RenderScheduler {
+  public:
+    enum class Admission {
+      QUEUED,
+      WAITING,
+      REJECTED
+    };
+
+    explicit RenderScheduler(const SchedulerOptions& options = SchedulerOptions());
+    ~RenderScheduler();
+
+    // The process-wide scheduler shared by all instances and worker threads
+    static RenderScheduler& shared();
+
+    // Change the worker count and queue limits, running jobs are not affected
+    void configure(const SchedulerOptions& options);
+
+    Admission submit(const std::shared_ptr<RenderJob>& job);
+    // Drop a job that is still queued or cancel it while it runs
+    void cancel(const std::shared_ptr<RenderJob>& job);
+
+    SchedulerStats stats() const;
+
+  private:
+    void spawn_workers(int count, uint64_t generation);
+    void worker(uint64_t generation);
+    void run(const std::shared_ptr<RenderJob>& job);
+    std::shared_ptr<RenderJob> pop_locked();
+    void admit_waiting_locked();
+    size_t queued_locked() const;
+
+    mutable std::mutex mutex_;
+    std::condition_variable available_;
+    std::condition_variable finished_;
+
+    SchedulerOptions options_;
+    uint64_t generation_ {0};
+    bool stopping_ {false};
+    int live_ {0};
+
+    std::deque<std::shared_ptr<RenderJob>> queues_[lengthOfJobPriorities];
+    std::deque<std::shared_ptr<RenderJob>> waiting_[lengthOfJobPriorities];
+
+    SchedulerStats stats_;
+};
+
+#endif
@@ -0,0 +1,317 @@
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+#include <vips/vips8>
+
+#include "json.h"
+#include "trace.h"
+#include "utils.h"
+
+namespace jsvips {
+
+namespace {
+
+// About 100 MB of JSON, enough for minutes of a busy process
+const size_t maxEvents = 1 << 20;
+
+struct Event {
+    const char* name;
+    const char* category;
+    char phase;
+    int64_t ts;
+    int64_t dur;
+    int tid;
+    Trace::Args args;
+};
+
+struct Recorder {
+    std::mutex mutex;
+    std::vector<Event> events;
+    size_t dropped {0};
+
+    // Operation that built an image, to name the evaluation of the image.
+    // Progress signals are on for these images until the trace stops, an
+    // image is forgotten when libvips closes it.
+    struct Producer {
+        const char* nickname;
+        gulong closeHandler;
+        // Progress was on before the trace, for a job watching the image
+        bool progress;
+    };
+    std::map<VipsImage*, Producer> producers;
+    // Start of the evaluations in progress
+    std::map<VipsProgress*, int64_t> evaluations;
+
+    guint postbuild {0};
+    guint preeval {0};
+    guint posteval {0};
+    gulong postbuildHook {0};
+    gulong preevalHook {0};
+    gulong postevalHook {0};
+};
+
+Recorder& recorder() {
+    // Never destroyed: libvips threads may still emit signals at exit
+    static Recorder* instance = new Recorder();
+    return *instance;
+}
+
+// Small sequential ids read better than system thread ids in the viewer
+int thread_id() {
+    static std::atomic<int> next {1};
+    thread_local int id = next++;
+    return id;
+}
+
+void record(Event event) {
+    Recorder& r = recorder();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    if (r.events.size() >= maxEvents) {
+        r.dropped++;
+        return;
+    }
+    r.events.push_back(std::move(event));
+}
+
+void on_close(VipsImage* image, gpointer) {
+    Recorder& r = recorder();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.producers.erase(image);
+}
+
+// Progress signals back as they were and close handlers gone, with the
+// mutex held. A job may have started watching the image since: its "eval"
+// handler kills the pipeline on cancellation, progress stays on for it.
+void forget_producers(Recorder& r) {
+    const guint eval = g_signal_lookup("eval", VIPS_TYPE_IMAGE);
+    for (const auto& [image, producer]: r.producers) {
+        if (!producer.progress && !g_signal_has_handler_pending(image, eval, 0, FALSE)) {
+            vips_image_set_progress(image, FALSE);
+        }
+        g_signal_handler_disconnect(image, producer.closeHandler);
+    }
+    r.producers.clear();
+}
+
+gboolean on_postbuild(GSignalInvocationHint*, guint count, const GValue* values, gpointer) {
+    if (!Trace::enabled() || count < 1) {
+        return TRUE;
+    }
+
+    GObject* object = static_cast<GObject*>(g_value_get_object(&values[0]));
+    if (!VIPS_IS_OPERATION(object)) {
+        return TRUE;
+    }
+    const char* nickname = VIPS_OBJECT_GET_CLASS(object)->nickname;
+
+    Trace::Args args;
+    GParamSpec* out = g_object_class_find_property(G_OBJECT_GET_CLASS(object), "out");
+    if (out != nullptr && G_IS_PARAM_SPEC_OBJECT(out) && g_type_is_a(out->value_type, VIPS_TYPE_IMAGE)) {
+        VipsImage* image = nullptr;
+        g_object_get(object, "out", &image, NULL);
+        if (image != nullptr) {
+            args.emplace_back("width", vips_image_get_width(image));
+            args.emplace_back("height", vips_image_get_height(image));
+            args.emplace_back("bands", vips_image_get_bands(image));
+
+            // Evaluations of pipelines built on this image emit preeval and posteval
+            {
+                Recorder& r = recorder();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                if (r.producers.find(image) == r.producers.end()) {
+                    const bool progress = image->progress_signal != nullptr;
+                    vips_image_set_progress(image, TRUE);
+                    r.producers[image] = {nickname, g_signal_connect(image, "close", G_CALLBACK(on_close), nullptr), progress};
+                }
+            }
+            g_object_unref(image);
+        }
+    }
+
+    Trace::instant(nickname, "vips build", std::move(args));
+    return TRUE;
+}
+
+gboolean on_preeval(GSignalInvocationHint*, guint count, const GValue* values, gpointer) {
+    if (!Trace::enabled() || count < 2) {
+        return TRUE;
+    }
+
+    auto* progress = static_cast<VipsProgress*>(g_value_get_pointer(&values[1]));
+    Recorder& r = recorder();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.evaluations[progress] = Trace::now();
+    return TRUE;
+}
+
+gboolean on_posteval(GSignalInvocationHint*, guint count, const GValue* values, gpointer) {
+    if (count < 2) {
+        return TRUE;
+    }
+
+    auto* progress = static_cast<VipsProgress*>(g_value_get_pointer(&values[1]));
+    const char* name = "eval";
+    int64_t start;
+    {
+        Recorder& r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        auto it = r.evaluations.find(progress);
+        if (it == r.evaluations.end()) {
+            return TRUE;
+        }
+        start = it->second;
+        r.evaluations.erase(it);
+
+        auto producer = r.producers.find(progress->im);
+        if (producer != r.producers.end()) {
+            name = producer->second.nickname;
+        }
+    }
+
+    if (Trace::enabled()) {
+        Trace::complete(name, "vips eval", start, Trace::now(), {
+            {"width", vips_image_get_width(progress->im)},
+            {"height", vips_image_get_height(progress->im)},
+            {"pixels", static_cast<double>(progress->npels)},
+        });
+    }
+    return TRUE;
+}
+
+guint lookup_signal(GType type, const char* name) {
+    gpointer klass = g_type_class_ref(type);
+    guint id = g_signal_lookup(name, type);
+    g_type_class_unref(klass);
+    return id;
+}
+
+Json to_json(const Event& event, int pid) {
+    Json json {Json::Object()};
+    json.set("name", event.name);
+    json.set("cat", event.category);
+    json.set("ph", std::string(1, event.phase));
+    json.set("ts", static_cast<double>(event.ts));
+    if (event.phase == 'X') {
+        json.set("dur", static_cast<double>(event.dur));
+    } else if (event.phase == 'i') {
+        json.set("s", "t");
+    }
+    json.set("pid", static_cast<double>(pid));
+    json.set("tid", static_cast<double>(event.tid));
+
+    Json args {Json::Object()};
+    for (const auto& [key, value]: event.args) {
+        args.set(key, value);
+    }
+    json.set("args", std::move(args));
+    return json;
+}
+
+}
+
+std::atomic<bool> Trace::active_ {false};
+
+void Trace::start() {
+    Recorder& r = recorder();
+    {
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.events.clear();
+        r.dropped = 0;
+        forget_producers(r);
+        r.evaluations.clear();
+
+        if (r.postbuildHook == 0) {
+            r.postbuild = lookup_signal(VIPS_TYPE_OBJECT, "postbuild");
+            r.preeval = lookup_signal(VIPS_TYPE_IMAGE, "preeval");
+            r.posteval = lookup_signal(VIPS_TYPE_IMAGE, "posteval");
+            r.postbuildHook = g_signal_add_emission_hook(r.postbuild, 0, on_postbuild, nullptr, nullptr);
+            r.preevalHook = g_signal_add_emission_hook(r.preeval, 0, on_preeval, nullptr, nullptr);
+            r.postevalHook = g_signal_add_emission_hook(r.posteval, 0, on_posteval, nullptr, nullptr);
+        }
+    }
+    active_ = true;
+}
+
+size_t Trace::stop(const std::string& path) {
+    if (!active_.exchange(false)) {
+        throw std::logic_error("Tracing has not been started");
+    }
+
+    std::vector<Event> events;
+    size_t dropped;
+    {
+        Recorder& r = recorder();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        g_signal_remove_emission_hook(r.postbuild, r.postbuildHook);
+        g_signal_remove_emission_hook(r.preeval, r.preevalHook);
+        g_signal_remove_emission_hook(r.posteval, r.postevalHook);
+        r.postbuildHook = r.preevalHook = r.postevalHook = 0;
+
+        events.swap(r.events);
+        dropped = r.dropped;
+        forget_producers(r);
+        r.evaluations.clear();
+    }
+
+    const int pid = static_cast<int>(getpid());
+    Json traceEvents {Json::Array()};
+
+    Json processName {Json::Object()};
+    processName.set("name", "process_name");
+    processName.set("ph", "M");
+    processName.set("pid", static_cast<double>(pid));
+    Json processArgs {Json::Object()};
+    processArgs.set("name", "jsvips");
+    processName.set("args", std::move(processArgs));
+    traceEvents.push_back(std::move(processName));
+
+    for (const Event& event: events) {
+        traceEvents.push_back(to_json(event, pid));
+    }
+
+    Json document {Json::Object()};
+    document.set("traceEvents", std::move(traceEvents));
+    document.set("displayTimeUnit", "ms");
+    Json otherData {Json::Object()};
+    otherData.set("droppedEvents", static_cast<double>(dropped));
+    document.set("otherData", std::move(otherData));
+
+    std::string text = document.dump();
+    write_file(path, std::vector<uint8_t>(text.begin(), text.end()));
+    return events.size();
+}
+
+int64_t Trace::now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::complete(const char* name, const char* category, int64_t start, int64_t end, Args args) {
+    record({name, category, 'X', start, end - start, thread_id(), std::move(args)});
+}
+
+void Trace::instant(const char* name, const char* category, Args args) {
+    record({name, category, 'i', now(), 0, thread_id(), std::move(args)});
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category): name_(name), category_(category), active_(Trace::enabled()) {
+    if (this->active_) {
+        this->start_ = Trace::now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if (this->active_ && Trace::enabled()) {
+        Trace::complete(this->name_, this->category_, this->start_, Trace::now(), std::move(this->args_));
+    }
+}
+
+TraceSpan& TraceSpan::arg(const char* key, double value) {
+    if (this->active_) {
+        this->args_.emplace_back(key, value);
+    }
+    return *this;
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jsvips {
+
+    //
+    // Process-wide trace in the Chrome trace event format, opened by
+    // Perfetto and chrome://tracing. While tracing is on it records the spans
+    // of the rendering stages and, through glib emission hooks, the libvips
+    // operations built (postbuild) and the pipelines evaluated (preeval to
+    // posteval, with their pixel counts). When tracing is off a span costs
+    // one relaxed atomic load.
+    //
+    class Trace {
+      public:
+        using Args = std::vector<std::pair<const char*, double>>;
+
+        static bool enabled() { return active_.load(std::memory_order_relaxed); }
+
+        // Drop the events of an earlier trace and start recording
+        static void start();
+        // Stop recording and write the trace, returns the number of events.
+        // Throws std::logic_error when tracing is off, std::runtime_error
+        // when the file cannot be written.
+        static size_t stop(const std::string& path);
+
+        // Microseconds on the trace clock
+        static int64_t now();
+
+        // name and category must outlive the trace, e.g. string literals
+        static void complete(const char* name, const char* category, int64_t start, int64_t end, Args args = {});
+        static void instant(const char* name, const char* category, Args args = {});
+
+      private:
+        static std::atomic<bool> active_;
+    };
+
+    // A complete event from construction to destruction
+    class TraceSpan {
+      public:
+        explicit TraceSpan(const char* name, const char* category = "jsvips");
+        ~TraceSpan();
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+        // Numeric argument shown with the span, ignored when tracing is off
+        TraceSpan& arg(const char* key, double value);
+
+      private:
+        const char* name_;
+        const char* category_;
+        bool active_;
+        int64_t start_ {0};
+        Trace::Args args_;
+    };
+
+}
+
+#endif
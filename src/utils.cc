@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
 #include <memory>
 #include <string>
 #include <stdexcept>
 #include <cstdio>
+#include <unistd.h>
 #include <vips/vips8>
 
 #include "utils.h"
@@ -17,3 +22,60 @@ VipsCompassDirection jsvips::to_compass_direction(const std::string& position, c
     }
     return default_position;
 }
+
+void jsvips::write_file(const std::string& path, const std::vector<uint8_t>& data) {
+    // Written next to the file and renamed over it: an interrupted write
+    // leaves the old file, never a truncated one
+    static std::atomic<uint64_t> counter {0};
+    const std::string tmp = path + ".tmp-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        file.close();
+        if (!file) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("Unable to write " + path);
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Unable to write " + path);
+    }
+}
+
+std::string jsvips::content_hash(const std::string& data) {
+    gchar* checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA256, reinterpret_cast<const unsigned char*>(data.data()), data.size());
+    std::string hash = checksum;
+    g_free(checksum);
+    return hash;
+}
+
+bool jsvips::has_extension(const std::string& path, const std::string& extension) {
+    if (path.size() < extension.size()) {
+        return false;
+    }
+    return std::equal(extension.begin(), extension.end(), path.end() - extension.size(), [](char a, char b) {
+        return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    });
+}
+
+std::string jsvips::expand_template(const std::string& textTemplate, const std::string& value) {
+    std::string text;
+    text.reserve(textTemplate.size() + value.size());
+    for (size_t i = 0; i < textTemplate.size(); i++) {
+        if (textTemplate[i] == '%' && i + 1 < textTemplate.size()) {
+            if (textTemplate[i + 1] == 's') {
+                text += value;
+                i++;
+                continue;
+            }
+            if (textTemplate[i + 1] == '%') {
+                text += '%';
+                i++;
+                continue;
+            }
+        }
+        text += textTemplate[i];
+    }
+    return text;
+}
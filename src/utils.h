@@ -1,4 +1,10 @@
+#ifndef UTILS_H
+#define UTILS_H
+
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 #include <vips/vips8>
 
 namespace jsvips {
@@ -14,9 +20,27 @@ namespace jsvips {
         return std::string( buf.get(), buf.get() + size - 1 ); // We don't want the '\0' inside
     };
 
+    // textTemplate with every "%s" replaced by value and "%%" by "%". Any other
+    // character, a lone "%" included, is kept as is: the template comes from
+    // the user and is never given to printf.
+    std::string expand_template(const std::string& textTemplate, const std::string& value);
+
+    // Write bytes to a file through a temporary file renamed over it, throws
+    // std::runtime_error on failure
+    void write_file(const std::string& path, const std::vector<uint8_t>& data);
+
+    // SHA-256 of data as 64 hex digits, names templates and the files of the
+    // disk cache
+    std::string content_hash(const std::string& data);
+
+    // Case insensitive check of the file name extension, e.g. ".gif"
+    bool has_extension(const std::string& path, const std::string& extension);
+
     VipsCompassDirection to_compass_direction(const std::string &position, const VipsCompassDirection default_position = VipsCompassDirection::VIPS_COMPASS_DIRECTION_CENTRE);
 
     template<class T, std::size_t n>
     std::size_t array_size(T (&)[n])
     { return n; }
-}
\ No newline at end of file
+}
+
+#endif
@@ -0,0 +1,66 @@
+//
+// drawText with every blend kernel of this CPU, against the generic libvips
+// composite. Captions are drawn on a large image and saved in the vips format,
+// so the time is the blend and not a compressor.
+//
+//   ts-node test/ts/blendbench.ts --width 6000 --height 4000 --captions 20
+//
+import fs from 'node:fs';
+import path from 'node:path';
+import {BlendKernel, NativeImage} from '../../index';
+import {fontBoldFile} from './fixtures';
+
+function option(name: string, fallback: number): number {
+  const index = process.argv.indexOf(`--${name}`);
+  return index >= 0 ? Number(process.argv[index + 1]) : fallback;
+}
+
+const width = option("width", 6000);
+const height = option("height", 4000);
+const captions = option("captions", 20);
+const rounds = option("rounds", 3);
+
+const outputFolderPath = path.resolve(__dirname, "../../output");
+if (!fs.existsSync(outputFolderPath)) {
+  fs.mkdirSync(outputFolderPath);
+}
+
+function render(kernel: BlendKernel): {ms: number, file: string} {
+  NativeImage.setBlendKernel(kernel);
+  const file = path.resolve(outputFolderPath, `blend-${kernel}.v`);
+
+  let best = Infinity;
+  for (let round = 0; round < rounds; round++) {
+    const start = process.hrtime.bigint();
+    const image = NativeImage.createSRGBImage({width, height, bgColor: "#0058a3"});
+    for (let i = 0; i < captions; i++) {
+      image.drawText(`Caption ${i} ÅÄÖ 0123456789`, 40 + (i % 4) * 1400, 40 + Math.floor(i / 4) * 700, {
+        font: "sans bold 160",
+        fontFile: fontBoldFile,
+        color: "#ffdb00",
+      });
+    }
+    image.save(file);
+    best = Math.min(best, Number(process.hrtime.bigint() - start) / 1e6);
+  }
+  return {ms: best, file};
+}
+
+const {available} = NativeImage.setBlendKernel();
+console.log(`Image ${width}x${height}, ${captions} captions, kernels: ${available.join(", ")}`);
+
+const results = available.map(kernel => ({kernel, ...render(kernel)}));
+const generic = results.find(result => result.kernel === "vips")!;
+for (const result of results) {
+  console.log(`${result.kernel.padEnd(6)} ${result.ms.toFixed(1).padStart(8)} ms  x${(generic.ms / result.ms).toFixed(2)}`);
+}
+
+// Every SIMD kernel blends to the same bytes as the scalar one
+const scalar = fs.readFileSync(results.find(result => result.kernel === "scalar")!.file);
+for (const result of results.filter(result => result.kernel !== "vips" && result.kernel !== "scalar")) {
+  if (!fs.readFileSync(result.file).equals(scalar)) {
+    throw new Error(`The ${result.kernel} kernel differs from the scalar one`);
+  }
+}
+
+NativeImage.setBlendKernel("auto");
@@ -1,6 +1,7 @@
 import fs from 'node:fs';
 import path from 'node:path';
-import {CountdownOptions, HexadecimalColor, NativeImage} from '../../index';
+import {NativeImage} from '../../index';
+import {countdownOptions, countdownVariant, fontBoldFile, fontRegularFile, framePixels, pixelError} from './fixtures';
 
 // Prepare output folder
 const outputFolder = "../../output";
@@ -12,84 +13,10 @@ if (!fs.existsSync(outputFolderPath)) {
 const outputFileName = "countdown-3.gif";
 const outputFilePath: string = path.resolve(outputFolderPath, outputFileName);
 
-const labelColor: HexadecimalColor = "#ffffff";
-const digitColor: HexadecimalColor = "#ffffff";
-const labelFont = "Noto IKEA Latin Regular 16pt";
-const digitFont = "Noto IKEA Latin Bold 32pt";
-const fontRegularFile = path.resolve(__dirname, "../../output/fonts/NotoIKEALatin-Regular.ttf");
-const fontBoldFile = path.resolve(__dirname, "../../output/fonts/NotoIKEALatin-Bold.ttf");
 console.log(`Bold font: ${fontBoldFile} - Regular font: ${fontRegularFile}`)
 
-const countdownOptions: CountdownOptions = {
-    name: "red-v1-en",
-    width: 273,
-    height: 71,
-    bgColor: "#cc0008",
-    langs: ["en"],
-    labels: {
-        days: {
-            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >days</span>",
-            position: {x: 0, y: 40, width: 60, height: 31},
-            color: labelColor,
-            textAlignment: "center",
-            fontFile: fontRegularFile
-        },
-        hours: {
-            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >hrs</span>",
-            paddingBottom: 3,
-            position: {x: 71, y: 40, width: 60, height: 31},
-            color: labelColor,
-            textAlignment: "center",
-            fontFile: fontRegularFile
-        },
-        minutes: {
-            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >min</span>",
-            paddingTop: 1,
-            paddingBottom: 4,
-            position: {x: 142, y: 40, width: 60, height: 31},
-            color: labelColor,
-            textAlignment: "center",
-            fontFile: fontRegularFile
-        },
-        seconds: {
-            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >sec</span>",
-            paddingTop: 4,
-            paddingBottom: 3,
-            position: {x: 213, y: 40, width: 60, height: 31},
-            color: labelColor,
-            textAlignment: "center",
-            fontFile: fontRegularFile
-        }
-    },
-    digits: {
-      positions: {
-        days: {
-          position: {x: 0, y: 5},
-        },
-        hours: {
-          position: {x: 71, y: 5},
-        },
-        minutes: {
-          position: {x: 142, y: 5},
-        },
-        seconds: {
-          position: {x: 213, y: 5},
-        }
-      },
-      style: {
-
-        color: digitColor,
-        width: 60,
-        height: 40,
-        textAlignment: "center",
-        fontFile: fontBoldFile
-      },
-      textTemplate: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='bold' size='32pt' >%s</span>",
-
-    }
-}
-
 // const image = new NativeImage();
+NativeImage.startTrace();
 const template = NativeImage.createCountdownAnimation(countdownOptions);
 const start = Date.now();
 template.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 60, outputFilePath);
@@ -98,3 +25,152 @@ const pt = Date.now() - start;
 //emptyImage.save(outputFilePath);
 console.log(`Processing time ${pt}`);
 
+// Same template, labels of the second language
+template.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 60, {
+  toFile: path.resolve(outputFolderPath, "countdown-3-sv.gif"),
+  lang: "sv",
+});
+const traceEvents = NativeImage.stopTrace(path.resolve(outputFolderPath, "countdown-3-trace.json"));
+console.log(`Trace: ${traceEvents} events`);
+
+// GIF, WebP and a poster from one composition
+const outputs = template.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 60, {
+  outputs: ["gif", "webp", "poster"],
+  posterFormat: "jpg",
+});
+for (const [format, data] of Object.entries(outputs)) {
+  fs.writeFileSync(path.resolve(outputFolderPath, `countdown-3-outputs-${format}.${format === "poster" ? "jpg" : format}`), data);
+}
+if (!outputs.gif || !outputs.webp || !outputs.poster) {
+  throw new Error("Every requested output should be encoded");
+}
+
+// The first countdown as the animated background of another one
+const animated = NativeImage.createCountdownAnimation({...countdownOptions, background: fs.readFileSync(outputFilePath)});
+const animatedGif = animated.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 10) as Buffer;
+fs.writeFileSync(path.resolve(outputFolderPath, "countdown-3-background.gif"), animatedGif);
+if (animatedGif.toString("ascii", 0, 3) !== "GIF") {
+  throw new Error("A template with an animated background should render a GIF");
+}
+
+// 1x and 2x from one template, the 2x GIF is twice as wide
+const hidpi = NativeImage.createCountdownAnimation({...countdownOptions, scales: [1, 2]});
+const densities = hidpi.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 10, {scales: [1, 2]});
+for (const [density, data] of Object.entries(densities)) {
+  fs.writeFileSync(path.resolve(outputFolderPath, `countdown-3-${density}.gif`), data);
+}
+if (densities["2x"].readUInt16LE(6) !== 2 * densities["1x"].readUInt16LE(6)) {
+  throw new Error("The 2x render should be twice as wide as the 1x one");
+}
+
+// Lossy LZW trades colour accuracy for size
+const lossless = template.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 30) as Buffer;
+const lossy = template.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 30, {lossy: 40}) as Buffer;
+fs.writeFileSync(path.resolve(outputFolderPath, "countdown-3-lossy.gif"), lossy);
+fs.writeFileSync(path.resolve(outputFolderPath, "countdown-3-lossless.gif"), lossless);
+const gifStats = NativeImage.gifStats();
+console.log(`Lossless ${lossless.length} bytes, lossy ${lossy.length} bytes`, gifStats);
+if (lossy.length > lossless.length * 0.95 || gifStats.lossyFiles < 1) {
+  throw new Error("The lossy GIF should be at least 5% smaller than the lossless one");
+}
+const lossyPixels = framePixels(path.resolve(outputFolderPath, "countdown-3-lossy.gif"));
+const losslessPixels = framePixels(path.resolve(outputFolderPath, "countdown-3-lossless.gif"));
+const lossyError = pixelError(lossyPixels, losslessPixels, lossyPixels.length / (countdownOptions.width * countdownOptions.height));
+console.log("Lossy pixel error", lossyError);
+if (lossyError.max > 40) {
+  throw new Error("No pixel of the lossy GIF should be further than the lossy level from the lossless one");
+}
+
+// Saving a lossy GIF quantizes the image, coarser with the level
+const frame = new NativeImage(outputFilePath);
+frame.save(path.resolve(outputFolderPath, "countdown-3-frame.gif"));
+frame.save(path.resolve(outputFolderPath, "countdown-3-frame-lossy.gif"), {lossy: 60});
+const frameSizes = ["countdown-3-frame.gif", "countdown-3-frame-lossy.gif"].map((name) => fs.statSync(path.resolve(outputFolderPath, name)).size);
+const quantizedError = pixelError(framePixels(path.resolve(outputFolderPath, "countdown-3-frame-lossy.gif")),
+                                  framePixels(path.resolve(outputFolderPath, "countdown-3-frame.gif")), lossyPixels.length / (countdownOptions.width * countdownOptions.height));
+console.log(`Saved frame ${frameSizes[0]} bytes, lossy ${frameSizes[1]} bytes`, quantizedError);
+if (frameSizes[1] > frameSizes[0] * 0.95 || quantizedError.rms > 24) {
+  throw new Error("A lossy GIF save should be smaller with a bounded error");
+}
+
+// The second render of the same moment is read back from the disk cache
+NativeImage.configureDiskCache({directory: path.resolve(outputFolderPath, "cache"), maxBytes: 64 * 1024 * 1024});
+const fresh = template.renderCountdownAnimation({days: 5, hours: 4, minutes: 3, seconds: 2}, 10) as Buffer;
+const cached = template.renderCountdownAnimation({days: 5, hours: 4, minutes: 3, seconds: 2}, 10) as Buffer;
+const diskCacheStats = NativeImage.diskCacheStats();
+console.log("Disk cache", diskCacheStats);
+if (diskCacheStats.hits < 1 || !fresh.equals(cached)) {
+  throw new Error("The second render should be served by the disk cache");
+}
+NativeImage.configureDiskCache({directory: ""});
+
+// Non-GIF outputs assemble their pages in pooled buffers, the second render reuses the first one's
+for (let i = 0; i < 2; i++) {
+  template.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 60, path.resolve(outputFolderPath, "countdown-3.webp"));
+}
+const poolStats = template.framePoolStats();
+console.log("Frame pool", poolStats);
+if (poolStats.reused < 1) {
+  throw new Error("The frame pool did not reuse a buffer");
+}
+
+// Swap in a new version while a render is in flight, the render keeps the old one
+(async () => {
+  const inFlight = template.renderCountdownAnimationAsync({days: 1, hours: 2, minutes: 3, seconds: 4}, 60);
+  await template.updateTemplate(countdownVariant("blue-v1-en", "#0058a3"));
+  const [before, after] = await Promise.all([
+    inFlight,
+    template.renderCountdownAnimationAsync({days: 1, hours: 2, minutes: 3, seconds: 4}, 60),
+  ]);
+  fs.writeFileSync(path.resolve(outputFolderPath, "countdown-3-updated.gif"), after);
+  console.log(`Template updated: ${before.length} bytes before, ${after.length} bytes after`);
+  const oldVersion = NativeImage.createCountdownAnimation(countdownOptions);
+  const newVersion = NativeImage.createCountdownAnimation(countdownVariant("blue-v1-en", "#0058a3"));
+  if (!before.equals(oldVersion.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 60) as Buffer)) {
+    throw new Error("The render in flight should finish on the template it started with");
+  }
+  if (!after.equals(newVersion.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 60) as Buffer)) {
+    throw new Error("A render submitted after the update should use the new template");
+  }
+
+  // A rejected update leaves the update in flight and the template as they were
+  const pending = template.updateTemplate(countdownOptions);
+  let rejected = false;
+  try {
+    await template.updateTemplate({...countdownOptions, width: "wide" as unknown as number});
+  } catch (e) {
+    rejected = true;
+  }
+  await pending;
+  if (!rejected || !(await template.renderCountdownAnimationAsync({days: 1, hours: 2, minutes: 3, seconds: 4}, 60)).equals(before)) {
+    throw new Error("An invalid update should not cancel the valid one in flight");
+  }
+
+  // Incremental updates render the same frames as a template compiled with the change
+  const days = {...countdownOptions.labels.days, text: countdownOptions.labels.days.text.replace(">days<", ">DAYS<")};
+  const style = {...countdownOptions.digits.style, color: "#ffdb00"};
+  const incremental = NativeImage.createCountdownAnimation(countdownOptions);
+  await incremental.updateLabel("days", days);
+  await incremental.updateDigitStyle(style);
+  const compiled = NativeImage.createCountdownAnimation({
+    ...countdownOptions,
+    labels: {...countdownOptions.labels, days},
+    digits: {...countdownOptions.digits, style},
+  });
+  const updated = incremental.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 10) as Buffer;
+  fs.writeFileSync(path.resolve(outputFolderPath, "countdown-3-incremental.gif"), updated);
+  if (!updated.equals(compiled.renderCountdownAnimation({days: 1, hours: 2, minutes: 3, seconds: 4}, 10) as Buffer)) {
+    throw new Error("The incremental updates should render like a template compiled with them");
+  }
+
+  // drawText on a clone of a countdown shows in the renders of that clone only
+  const moment = {days: 1, hours: 2, minutes: 3, seconds: 4};
+  const plain = compiled.renderCountdownAnimation(moment, 2) as Buffer;
+  const banner = compiled.clone();
+  await banner.drawText("SALE", 10, 10, {color: "#cc0008"});
+  const withText = banner.renderCountdownAnimation(moment, 2) as Buffer;
+  fs.writeFileSync(path.resolve(outputFolderPath, "countdown-3-text.gif"), withText);
+  if (withText.equals(plain) || !plain.equals(compiled.renderCountdownAnimation(moment, 2) as Buffer)) {
+    throw new Error("drawText should change the renders of the clone and leave the original as it was");
+  }
+})();
@@ -0,0 +1,97 @@
+//
+// Countdowns rendered by vips-render-daemon against the same template
+// rendered in this process. Build the daemon first:
+//
+//   cmake -S . -B build && cmake --build build --target vips-render-daemon
+//   ts-node test/ts/daemon.ts
+//
+import {spawn} from 'node:child_process';
+import fs from 'node:fs';
+import net from 'node:net';
+import os from 'node:os';
+import path from 'node:path';
+import {NativeImage} from '../../index';
+import {countdownOptions, fontBoldFile} from './fixtures';
+
+const daemonPath = path.resolve(__dirname, "../../build/vips-render-daemon");
+const socketPath = path.resolve(os.tmpdir(), `jsvips-${process.pid}.sock`);
+const start = {days: 1, hours: 2, minutes: 3, seconds: 4};
+
+if (!fs.existsSync(daemonPath)) {
+  console.log(`${daemonPath} is not built, skipped`);
+  process.exit(0);
+}
+
+// Another working directory than this process: relative paths are resolved by the client
+const daemon = spawn(daemonPath, ["--socket", socketPath, "--jobs", "2"], {stdio: "inherit", cwd: os.tmpdir()});
+
+async function waitForSocket(): Promise<void> {
+  for (let i = 0; i < 100 && !fs.existsSync(socketPath); i++) {
+    await new Promise(resolve => setTimeout(resolve, 50));
+  }
+}
+
+(async () => {
+  try {
+    await waitForSocket();
+
+    // Two instances of the same document share one compiled template
+    const remote = NativeImage.createCountdownAnimation(countdownOptions, {daemon: socketPath});
+    const twin = NativeImage.createCountdownAnimation(countdownOptions, {daemon: socketPath});
+    const local = NativeImage.createCountdownAnimation(countdownOptions);
+
+    const [gif, sv] = await Promise.all([
+      remote.renderCountdownAnimationAsync(start, 10),
+      twin.renderCountdownAnimationAsync(start, 10, {lang: "sv"}),
+    ]);
+    if (!(gif as Buffer).equals(local.renderCountdownAnimation(start, 10) as Buffer) ||
+        !(sv as Buffer).equals(local.renderCountdownAnimation(start, 10, {lang: "sv"}) as Buffer)) {
+      throw new Error("The daemon should render the same GIF as this process");
+    }
+
+    const outputs = remote.renderCountdownAnimation(start, 10, {outputs: ["gif", "webp"]});
+    if (!outputs.gif || !outputs.webp) {
+      throw new Error("Every requested output should come back from the daemon");
+    }
+
+    await remote.updateLabel("days", {...countdownOptions.labels.days, text: "DAYS"});
+    fs.mkdirSync(path.resolve(__dirname, "../../output"), {recursive: true});
+    remote.renderCountdownAnimation(start, 10, path.resolve(__dirname, "../../output/countdown-daemon.gif"));
+
+    const stats = NativeImage.renderDaemonStats(socketPath);
+    console.log("Render daemon", stats);
+    if (stats.templates !== 2 || stats.renders < 4) {
+      throw new Error("The daemon should compile one template per document");
+    }
+
+    // A font file relative to the working directory of this process
+    const relative = {
+      ...countdownOptions,
+      labels: {...countdownOptions.labels, days: {...countdownOptions.labels.days, fontFile: path.relative(process.cwd(), fontBoldFile)}},
+    };
+    const relativeGif = NativeImage.createCountdownAnimation(relative, {daemon: socketPath}).renderCountdownAnimation(start, 10) as Buffer;
+    if (!relativeGif.equals(NativeImage.createCountdownAnimation(relative).renderCountdownAnimation(start, 10) as Buffer)) {
+      throw new Error("The daemon should read the files of relative paths of the client");
+    }
+
+    // A daemon that never answers fails the request after the timeout
+    const hungPath = path.resolve(os.tmpdir(), `jsvips-hung-${process.pid}.sock`);
+    const hung = net.createServer(() => {}).listen(hungPath);
+    await new Promise(resolve => hung.once("listening", resolve));
+    let code = "";
+    try {
+      NativeImage.createCountdownAnimation(countdownOptions, {daemon: hungPath, daemonTimeout: 200});
+    } catch (e) {
+      code = (e as NodeJS.ErrnoException).code ?? "";
+    }
+    hung.close();
+    if (code !== "ETIMEDOUT") {
+      throw new Error("A request the daemon does not answer should fail with ETIMEDOUT");
+    }
+  } finally {
+    daemon.kill("SIGTERM");
+  }
+})().catch(error => {
+  console.error(error);
+  process.exitCode = 1;
+});
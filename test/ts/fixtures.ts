@@ -0,0 +1,121 @@
+import fs from 'node:fs';
+import path from 'node:path';
+import {CountdownOptions, HexadecimalColor, NativeImage} from '../../index';
+
+const labelColor: HexadecimalColor = "#ffffff";
+const digitColor: HexadecimalColor = "#ffffff";
+export const fontRegularFile = path.resolve(__dirname, "../../output/fonts/NotoIKEALatin-Regular.ttf");
+export const fontBoldFile = path.resolve(__dirname, "../../output/fonts/NotoIKEALatin-Bold.ttf");
+
+export const countdownOptions: CountdownOptions = {
+    name: "red-v1-en",
+    width: 273,
+    height: 71,
+    bgColor: "#cc0008",
+    langs: ["en", "sv"],
+    labels: {
+        days: {
+            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >days</span>",
+            texts: {
+                sv: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >dagar</span>",
+            },
+            position: {x: 0, y: 40, width: 60, height: 31},
+            color: labelColor,
+            textAlignment: "center",
+            fontFile: fontRegularFile
+        },
+        hours: {
+            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >hrs</span>",
+            texts: {
+                sv: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >tim</span>",
+            },
+            paddingBottom: 3,
+            position: {x: 71, y: 40, width: 60, height: 31},
+            color: labelColor,
+            textAlignment: "center",
+            fontFile: fontRegularFile
+        },
+        minutes: {
+            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >min</span>",
+            texts: {
+                sv: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >min</span>",
+            },
+            paddingTop: 1,
+            paddingBottom: 4,
+            position: {x: 142, y: 40, width: 60, height: 31},
+            color: labelColor,
+            textAlignment: "center",
+            fontFile: fontRegularFile
+        },
+        seconds: {
+            text: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >sec</span>",
+            texts: {
+                sv: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='normal' size='16pt' >sek</span>",
+            },
+            paddingTop: 4,
+            paddingBottom: 3,
+            position: {x: 213, y: 40, width: 60, height: 31},
+            color: labelColor,
+            textAlignment: "center",
+            fontFile: fontRegularFile
+        }
+    },
+    digits: {
+      positions: {
+        days: {
+          position: {x: 0, y: 5},
+        },
+        hours: {
+          position: {x: 71, y: 5},
+        },
+        minutes: {
+          position: {x: 142, y: 5},
+        },
+        seconds: {
+          position: {x: 213, y: 5},
+        }
+      },
+      style: {
+
+        color: digitColor,
+        width: 60,
+        height: 40,
+        textAlignment: "center",
+        fontFile: fontBoldFile
+      },
+      textTemplate: "<span foreground='#ffffff' face='Noto IKEA Latin' weight='bold' size='32pt' >%s</span>",
+
+    }
+};
+
+// Same layout with a different background, used where several templates are needed
+export function countdownVariant(name: string, bgColor: HexadecimalColor): CountdownOptions {
+    return {...countdownOptions, name, bgColor};
+}
+
+// Pixels of an image file, the first frame of an animation, as libvips
+// writes them to a .raw file: interleaved bands, rows top to bottom
+export function framePixels(file: string): Buffer {
+    const raw = `${file}.raw`;
+    new NativeImage(file).save(raw);
+    return fs.readFileSync(raw);
+}
+
+// Largest and root mean square RGB distance between the pixels of two images
+// of the same size, with bands bands each
+export function pixelError(a: Buffer, b: Buffer, bands: number): {max: number, rms: number} {
+    if (a.length !== b.length) {
+        throw new Error(`The images differ in size: ${a.length} and ${b.length} bytes`);
+    }
+    let max = 0;
+    let sum = 0;
+    for (let i = 0; i < a.length; i += bands) {
+        let squared = 0;
+        for (let band = 0; band < 3; band++) {
+            squared += (a[i + band] - b[i + band]) ** 2;
+        }
+        max = Math.max(max, Math.sqrt(squared));
+        sum += squared;
+    }
+    return {max, rms: Math.sqrt(sum / (a.length / bands))};
+}
@@ -0,0 +1,351 @@
+//
+// Concurrent load test and thread-safety stress harness.
+//
+// Drives N worker threads x M in-flight renders against a set of countdown
+// templates, plus image-mode drawText/save jobs, through the native job
+// scheduler. Reports throughput, latency percentiles, RSS and libvips tracked
+// memory over time.
+//
+// Fails (exit code 1) when a worker crashes, an output differs from the
+// reference rendered on the main thread, or memory keeps growing after warm-up.
+//
+//   ts-node test/ts/loadtest.ts --workers 4 --inflight 2 --duration 60
+//
+import crypto from 'node:crypto';
+import fs from 'node:fs';
+import os from 'node:os';
+import path from 'node:path';
+import {isMainThread, parentPort, Worker, workerData} from 'node:worker_threads';
+import {CountdownMoment, HexadecimalColor, NativeImage} from '../../index';
+import {countdownVariant, fontRegularFile} from './fixtures';
+
+type Config = {
+    workers: number;
+    inflight: number;
+    templates: number;
+    moments: number;
+    frames: number;
+    duration: number;
+    warmup: number;
+    interval: number;
+    saveEvery: number;
+    maxGrowthMb: number;
+    schedulerWorkers: number;
+    json: string;
+};
+
+type Reference = {
+    renders: Record<string, string>;
+    save: string;
+};
+
+type WorkerMessage =
+    | { type: "batch", latencies: number[], saves: number }
+    | { type: "failure", message: string }
+    | { type: "done" };
+
+type Sample = {
+    elapsed: number;
+    rss: number;
+    vipsMemory: number;
+    vipsFiles: number;
+    renders: number;
+};
+
+const bgColors: HexadecimalColor[] = ["#cc0008", "#0058a3", "#ffdb00", "#111111", "#2a7a3b", "#6f2da8", "#f28c28", "#000000"];
+
+function parseConfig(argv: string[]): Config {
+    const config: Config = {
+        workers: Math.max(1, os.cpus().length),
+        inflight: 2,
+        templates: 4,
+        moments: 8,
+        frames: 60,
+        duration: 30,
+        warmup: 5,
+        interval: 1,
+        saveEvery: 10,
+        maxGrowthMb: 64,
+        schedulerWorkers: 0,
+        json: "",
+    };
+
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+        if (!arg.startsWith("--")) {
+            continue;
+        }
+        const key = arg.slice(2).replace(/-([a-z])/g, (_, c: string) => c.toUpperCase()) as keyof Config;
+        if (!(key in config)) {
+            throw new Error(`Unknown option ${arg}`);
+        }
+        const value = argv[++i];
+        if (typeof config[key] === "number") {
+            (config as any)[key] = Number(value);
+        } else {
+            (config as any)[key] = value;
+        }
+    }
+
+    return config;
+}
+
+function templateOptions(index: number) {
+    return countdownVariant(`loadtest-${index}`, bgColors[index % bgColors.length]);
+}
+
+function moment(index: number): CountdownMoment<number> {
+    // Spread the moments so that every digit position changes between them
+    return {days: (index * 7) % 100, hours: (index * 5) % 24, minutes: (index * 13) % 60, seconds: (index * 17) % 60};
+}
+
+function digest(data: Buffer): string {
+    return crypto.createHash("sha256").update(data).digest("hex");
+}
+
+function isGif(data: Buffer): boolean {
+    return data.length > 13 && data.toString("latin1", 0, 6) === "GIF89a" && data[data.length - 1] === 0x3b;
+}
+
+async function render(template: NativeImage, start: CountdownMoment<number>, frames: number): Promise<Buffer> {
+    return await template.renderCountdownAnimationAsync(start, frames) as Buffer;
+}
+
+async function saveImage(outFilePath: string): Promise<Buffer> {
+    const image = NativeImage.createSRGBImage({width: 640, height: 360, bgColor: "#0058a3"});
+    image.drawText("Load test", 40, 40, {fontFile: fontRegularFile, color: "#ffffff"});
+    await image.saveAsync(outFilePath);
+    return fs.readFileSync(outFilePath);
+}
+
+function percentile(sorted: number[], p: number): number {
+    if (sorted.length === 0) {
+        return 0;
+    }
+    const index = Math.min(sorted.length - 1, Math.ceil(p / 100 * sorted.length) - 1);
+    return sorted[Math.max(0, index)];
+}
+
+function mb(bytes: number): string {
+    return (bytes / 1024 / 1024).toFixed(1);
+}
+
+function mean(values: number[]): number {
+    return values.reduce((a, b) => a + b, 0) / Math.max(1, values.length);
+}
+
+async function buildReference(config: Config): Promise<Reference> {
+    const renders: Record<string, string> = {};
+    for (let t = 0; t < config.templates; t++) {
+        const template = NativeImage.createCountdownAnimation(templateOptions(t));
+        for (let m = 0; m < config.moments; m++) {
+            const data = await render(template, moment(m), config.frames);
+            if (!isGif(data)) {
+                throw new Error(`Reference render ${t}:${m} is not a GIF`);
+            }
+            renders[`${t}:${m}`] = digest(data);
+        }
+    }
+
+    const savePath = path.join(os.tmpdir(), `jslibvips-loadtest-${process.pid}-ref.png`);
+    const save = digest(await saveImage(savePath));
+    fs.rmSync(savePath, {force: true});
+
+    return {renders, save};
+}
+
+//
+// Worker thread: creates its own templates, then keeps `inflight` render
+// loops busy until the deadline.
+//
+async function runWorker(): Promise<void> {
+    const {config, reference, id} = workerData as {config: Config, reference: Reference, id: number};
+    const port = parentPort!;
+    const deadline = Date.now() + config.duration * 1000;
+
+    const templates: NativeImage[] = [];
+    for (let t = 0; t < config.templates; t++) {
+        templates.push(NativeImage.createCountdownAnimation(templateOptions(t)));
+    }
+
+    let latencies: number[] = [];
+    let saves = 0;
+    let sequence = 0;
+    const flush = () => {
+        port.postMessage({type: "batch", latencies, saves} as WorkerMessage);
+        latencies = [];
+        saves = 0;
+    };
+    const timer = setInterval(flush, config.interval * 1000);
+
+    const loop = async (slot: number) => {
+        while (Date.now() < deadline) {
+            const n = sequence++;
+            const t = n % config.templates;
+            const m = (n * 31 + id) % config.moments;
+
+            const begin = process.hrtime.bigint();
+            const data = await render(templates[t], moment(m), config.frames);
+            latencies.push(Number(process.hrtime.bigint() - begin) / 1e6);
+
+            if (!isGif(data) || digest(data) !== reference.renders[`${t}:${m}`]) {
+                port.postMessage({type: "failure", message: `worker ${id} slot ${slot}: corrupted render for template ${t} moment ${m}`} as WorkerMessage);
+            }
+
+            if (config.saveEvery > 0 && n % config.saveEvery === 0) {
+                const savePath = path.join(os.tmpdir(), `jslibvips-loadtest-${process.pid}-${id}-${slot}.png`);
+                if (digest(await saveImage(savePath)) !== reference.save) {
+                    port.postMessage({type: "failure", message: `worker ${id} slot ${slot}: corrupted save output`} as WorkerMessage);
+                }
+                fs.rmSync(savePath, {force: true});
+                saves++;
+            }
+        }
+    };
+
+    const slots = [];
+    for (let s = 0; s < config.inflight; s++) {
+        slots.push(loop(s));
+    }
+    await Promise.all(slots);
+
+    clearInterval(timer);
+    flush();
+    port.postMessage({type: "done"} as WorkerMessage);
+}
+
+//
+// Main thread: spawns the workers, samples memory and evaluates the run.
+//
+async function runMain(): Promise<number> {
+    const config = parseConfig(process.argv.slice(2));
+    if (config.schedulerWorkers > 0) {
+        NativeImage.configureScheduler({workers: config.schedulerWorkers, whenFull: "wait"});
+    }
+    console.log(`Load test: ${config.workers} workers x ${config.inflight} in-flight, ${config.templates} templates, ${config.frames} frames, ${config.duration}s`);
+
+    const reference = await buildReference(config);
+
+    const failures: string[] = [];
+    const latencies: number[] = [];
+    const samples: Sample[] = [];
+    let windowLatencies: number[] = [];
+    let renders = 0;
+    let saves = 0;
+
+    const began = Date.now();
+    const workers = [];
+    for (let id = 0; id < config.workers; id++) {
+        workers.push(new Promise<void>((resolve) => {
+            const worker = new Worker(__filename, {
+                workerData: {config, reference, id},
+                execArgv: __filename.endsWith(".ts") ? ["--require", "ts-node/register"] : [],
+            });
+            worker.on("message", (message: WorkerMessage) => {
+                if (message.type === "batch") {
+                    latencies.push(...message.latencies);
+                    windowLatencies.push(...message.latencies);
+                    renders += message.latencies.length;
+                    saves += message.saves;
+                } else if (message.type === "failure") {
+                    failures.push(message.message);
+                }
+            });
+            worker.on("error", (error) => {
+                failures.push(`worker ${id} crashed: ${error.stack ?? error}`);
+            });
+            worker.on("exit", (code) => {
+                if (code !== 0) {
+                    failures.push(`worker ${id} exited with code ${code}`);
+                }
+                resolve();
+            });
+        }));
+    }
+
+    const sampler = setInterval(() => {
+        const stats = NativeImage.memoryStats();
+        const sample: Sample = {
+            elapsed: (Date.now() - began) / 1000,
+            rss: process.memoryUsage().rss,
+            vipsMemory: stats.memory,
+            vipsFiles: stats.files,
+            renders,
+        };
+        samples.push(sample);
+
+        const sorted = windowLatencies.sort((a, b) => a - b);
+        const previous = samples.length > 1 ? samples[samples.length - 2].renders : 0;
+        console.log(`[${sample.elapsed.toFixed(0).padStart(4)}s] ${((renders - previous) / config.interval).toFixed(1)} renders/s`
+            + ` p50 ${percentile(sorted, 50).toFixed(1)}ms p95 ${percentile(sorted, 95).toFixed(1)}ms p99 ${percentile(sorted, 99).toFixed(1)}ms`
+            + ` rss ${mb(sample.rss)}MB vips ${mb(sample.vipsMemory)}MB files ${sample.vipsFiles}`
+            + ` running ${NativeImage.schedulerStats().running}`);
+        windowLatencies = [];
+    }, config.interval * 1000);
+
+    await Promise.all(workers);
+    clearInterval(sampler);
+
+    const elapsed = (Date.now() - began) / 1000;
+    const sorted = latencies.sort((a, b) => a - b);
+
+    // Leak check: compare the start and the end of the post warm-up samples
+    const steady = samples.filter(s => s.elapsed >= config.warmup);
+    const quarter = Math.max(1, Math.floor(steady.length / 4));
+    const rssGrowth = mean(steady.slice(-quarter).map(s => s.rss)) - mean(steady.slice(0, quarter).map(s => s.rss));
+    const vipsGrowth = mean(steady.slice(-quarter).map(s => s.vipsMemory)) - mean(steady.slice(0, quarter).map(s => s.vipsMemory));
+    if (steady.length >= 4) {
+        if (rssGrowth > config.maxGrowthMb * 1024 * 1024) {
+            failures.push(`RSS grew by ${mb(rssGrowth)}MB after warm-up`);
+        }
+        if (vipsGrowth > config.maxGrowthMb * 1024 * 1024) {
+            failures.push(`libvips tracked memory grew by ${mb(vipsGrowth)}MB after warm-up`);
+        }
+    }
+    if (renders === 0) {
+        failures.push("no render completed");
+    }
+
+    const report = {
+        config,
+        elapsed,
+        renders,
+        saves,
+        throughput: renders / elapsed,
+        latency: {
+            p50: percentile(sorted, 50),
+            p95: percentile(sorted, 95),
+            p99: percentile(sorted, 99),
+            max: sorted.length > 0 ? sorted[sorted.length - 1] : 0,
+        },
+        rssGrowth,
+        vipsGrowth,
+        samples,
+        failures,
+    };
+
+    console.log(`\n${renders} renders and ${saves} saves in ${elapsed.toFixed(1)}s: ${report.throughput.toFixed(1)} renders/s`);
+    console.log(`latency p50 ${report.latency.p50.toFixed(1)}ms p95 ${report.latency.p95.toFixed(1)}ms p99 ${report.latency.p99.toFixed(1)}ms max ${report.latency.max.toFixed(1)}ms`);
+    console.log(`memory growth after warm-up: rss ${mb(rssGrowth)}MB vips ${mb(vipsGrowth)}MB`);
+
+    if (config.json) {
+        fs.writeFileSync(config.json, JSON.stringify(report, null, 2));
+    }
+
+    for (const failure of failures) {
+        console.error(`FAIL ${failure}`);
+    }
+    return failures.length === 0 ? 0 : 1;
+}
+
+if (isMainThread) {
+    runMain().then(code => process.exit(code), error => {
+        console.error(error);
+        process.exit(1);
+    });
+} else {
+    runWorker().catch(error => {
+        parentPort!.postMessage({type: "failure", message: `worker ${workerData.id}: ${error.stack ?? error}`} as WorkerMessage);
+        process.exit(1);
+    });
+}
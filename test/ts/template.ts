@@ -0,0 +1,117 @@
+import fs from 'node:fs';
+import path from 'node:path';
+import {NativeImage, TemplateOptions} from '../../index';
+import {fontBoldFile, fontRegularFile} from './fixtures';
+
+// Prepare output folder
+const outputFolderPath = path.resolve(__dirname, "../../output");
+if (!fs.existsSync(outputFolderPath)) {
+  fs.mkdirSync(outputFolderPath);
+}
+
+// Price tag: static title, a free text name, an enumerable stock counter and a price
+const priceTag: TemplateOptions = {
+  width: 240,
+  height: 120,
+  bgColor: "#ffdb00",
+  layers: [{
+    text: "<span foreground='#0058a3' size='12pt'>Only today</span>",
+    position: {x: 0, y: 4, width: 240, height: 20},
+    color: "#0058a3",
+    textAlignment: "center",
+    fontFile: fontRegularFile,
+  }],
+  slots: {
+    name: {
+      position: {x: 10, y: 28, width: 220, height: 30},
+      color: "#111111",
+      textAlignment: "left",
+      fontFile: fontBoldFile,
+      textTemplate: "<span foreground='#111111' weight='bold' size='16pt'>%s</span>",
+    },
+    price: {
+      position: {x: 10, y: 60, width: 220, height: 36},
+      color: "#cc0008",
+      textAlignment: "right",
+      fontFile: fontBoldFile,
+      textTemplate: "<span foreground='#cc0008' weight='bold' size='24pt'>%s</span>",
+    },
+    stock: {
+      position: {x: 10, y: 96, width: 220, height: 20},
+      color: "#111111",
+      textAlignment: "left",
+      fontFile: fontRegularFile,
+      textTemplate: "<span foreground='#111111' size='10pt'>%s left</span>",
+      values: Array.from({length: 21}, (_, i) => i),
+    },
+  },
+  cacheSize: 64,
+};
+
+const template = NativeImage.createTemplate(priceTag);
+
+const start = Date.now();
+for (let i = 0; i < 100; i++) {
+  template.render({name: `Article ${i % 10}`, price: `${(i % 10) * 10 + 9}.99 €`, stock: i % 21});
+}
+console.log(`100 renders in ${Date.now() - start} ms`, template.templateStats());
+
+template.render({name: "BILLY & friends", price: "59.99 €", stock: 3}, {toFile: path.resolve(outputFolderPath, "price-tag.png")});
+
+// Opening the rendered tag twice decodes it once
+NativeImage.configureImageCache({maxBytes: 16 * 1024 * 1024});
+new NativeImage(path.resolve(outputFolderPath, "price-tag.png"));
+new NativeImage(path.resolve(outputFolderPath, "price-tag.png"));
+const imageCacheStats = NativeImage.imageCacheStats();
+console.log("Image cache", imageCacheStats);
+if (imageCacheStats.hits < 1) {
+  throw new Error("The second open should be served by the image cache");
+}
+NativeImage.invalidateImageCache();
+NativeImage.configureImageCache({maxBytes: 0});
+
+// Caption variants of one base image, each clone draws on the shared pixels
+const base = new NativeImage(path.resolve(outputFolderPath, "price-tag.png"));
+for (const caption of ["Sale", "New", "Last chance"]) {
+  const variant = base.clone();
+  variant.drawText(caption, 20, 20, {color: "#cc0008"});
+  variant.save(path.resolve(outputFolderPath, `price-tag-${caption.toLowerCase().replace(" ", "-")}.png`));
+}
+base.save(path.resolve(outputFolderPath, "price-tag-base.png"));
+new NativeImage(path.resolve(outputFolderPath, "price-tag.png")).save(path.resolve(outputFolderPath, "price-tag-reference.png"));
+if (!fs.readFileSync(path.resolve(outputFolderPath, "price-tag-base.png")).equals(fs.readFileSync(path.resolve(outputFolderPath, "price-tag-reference.png")))) {
+  throw new Error("Drawing on a clone should leave the base image as it was");
+}
+
+// Without the image cache a path is loaded for sequential access, drawing on it
+// twice before saving must not read it out of order
+const sequential = new NativeImage(path.resolve(outputFolderPath, "price-tag.png"));
+sequential.drawText("Sale", 20, 20, {color: "#cc0008"});
+sequential.drawText("Last chance", 20, 60, {color: "#cc0008"});
+sequential.save(path.resolve(outputFolderPath, "price-tag-sequential.png"));
+
+// Values outside the domain of an enumerable slot are rejected
+let rejected = false;
+try {
+  template.render({stock: 99});
+} catch (e) {
+  rejected = true;
+}
+if (!rejected) {
+  throw new Error("stock 99 should be rejected");
+}
+
+// printf conversions in a text template are plain text, only %s is replaced
+const percentTemplate = NativeImage.createTemplate({
+  ...priceTag,
+  layers: [],
+  slots: {
+    discount: {...priceTag.slots.price, textTemplate: "<span size='12pt'>%s%% off %n%d%p</span>"},
+  },
+});
+percentTemplate.render({discount: "30"}, {toFile: path.resolve(outputFolderPath, "price-tag-percent.png")});
+
+(async () => {
+  const png = await template.renderAsync({name: "LACK", price: "9.99 €", stock: 20}, {priority: "interactive"});
+  fs.writeFileSync(path.resolve(outputFolderPath, "price-tag-async.png"), png);
+})();
@@ -0,0 +1,270 @@
+//
+// vips-countdown-gen: render countdown GIFs in bulk without Node.
+//
+//   vips-countdown-gen --template template.json --jobs jobs.json [--out dir] [--threads n] [--force]
+//
+// The template file has the format of the createCountdownAnimation options.
+// The jobs file is an array of
+//
+//   {"output": "a.gif", "start": {"days": 1, "hours": 2, "minutes": 3, "seconds": 4}, "frames": 60, "lang": "sv"}
+//   {"output": "b.gif", "deadline": "2026-12-24T00:00:00Z"}
+//
+// A deadline is an ISO 8601 UTC time or seconds since the epoch, the start is
+// the time left at render time. Each output is written with the fingerprint
+// of its template next to it, in <output>.fingerprint: outputs newer than the
+// jobs file and rendered by a template with the same fingerprint, which
+// covers the background and font files, are skipped. Deadline outputs are
+// rendered again once their animation has run out.
+//
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vips/vips8>
+
+#include "countdown_renderer.h"
+#include "json.h"
+#include "render_options.h"
+#include "utils.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct Arguments {
+    std::string templatePath;
+    std::string jobsPath;
+    std::string outputDir {"."};
+    int threads {0};
+    bool force {false};
+};
+
+struct Job {
+    std::string output;
+    std::vector<int> start;
+    // Seconds since the epoch, none when the start is given
+    std::optional<int64_t> deadline;
+    int frames {60};
+    std::string lang;
+};
+
+void usage() {
+    std::cerr << "Usage: vips-countdown-gen --template <file> --jobs <file> [--out <dir>] [--threads <n>] [--force]" << std::endl;
+}
+
+Arguments parse_arguments(int argc, char** argv) {
+    Arguments args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value of " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--template") {
+            args.templatePath = value();
+        } else if (arg == "--jobs") {
+            args.jobsPath = value();
+        } else if (arg == "--out") {
+            args.outputDir = value();
+        } else if (arg == "--threads") {
+            args.threads = std::stoi(value());
+        } else if (arg == "--force") {
+            args.force = true;
+        } else {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    if (args.templatePath.empty() || args.jobsPath.empty()) {
+        throw std::invalid_argument("--template and --jobs are required");
+    }
+    return args;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot read " + path);
+    }
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+// ISO 8601 UTC time, e.g. 2026-12-24T00:00:00Z, or seconds since the epoch
+int64_t parse_deadline(const jsvips::Json& deadline) {
+    if (deadline.is_number()) {
+        const double seconds = deadline.as_number();
+        // Past year 9999, and out of the range of int64_t
+        if (!std::isfinite(seconds) || std::abs(seconds) > 253402300799.0) {
+            throw std::invalid_argument("Invalid deadline " + std::to_string(seconds));
+        }
+        return static_cast<int64_t>(seconds);
+    }
+
+    std::tm tm {};
+    const std::string& text = deadline.as_string();
+    if (std::sscanf(text.c_str(), "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        throw std::invalid_argument("Invalid deadline " + text);
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return static_cast<int64_t>(timegm(&tm));
+}
+
+std::vector<Job> parse_jobs(const jsvips::Json& document) {
+    std::vector<Job> jobs;
+    for (const jsvips::Json& item: document.as_array()) {
+        Job job;
+        if (!item["output"].is_string()) {
+            throw std::invalid_argument("Every job needs an output");
+        }
+        job.output = item["output"].as_string();
+
+        if (item.has("deadline")) {
+            job.deadline = parse_deadline(item["deadline"]);
+        } else if (item.has("start")) {
+            job.start = jsvips::parse_countdown_moment_with_number(item["start"]);
+        } else {
+            throw std::invalid_argument("Job " + job.output + " needs a start or a deadline");
+        }
+
+        if (item.has("frames")) {
+            job.frames = jsvips::parse_countdown_frames(item["frames"]);
+        }
+        if (item.has("lang")) {
+            job.lang = item["lang"].as_string();
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// Time left until the deadline, days are capped to the two digits of the template
+std::vector<int> moment_until(int64_t deadline, int64_t now) {
+    int64_t left = std::max<int64_t>(0, deadline - now);
+    int days = static_cast<int>(std::min<int64_t>(left / 86400, totalOfDigits - 1));
+    return {days, static_cast<int>(left % 86400 / 3600), static_cast<int>(left % 3600 / 60), static_cast<int>(left % 60)};
+}
+
+fs::path fingerprint_path(const fs::path& output) {
+    return output.string() + ".fingerprint";
+}
+
+bool up_to_date(const fs::path& output, const Job& job, fs::file_time_type jobsTime, const std::string& fingerprint) {
+    std::error_code ec;
+    fs::file_time_type outputTime = fs::last_write_time(output, ec);
+    if (ec || outputTime < jobsTime) {
+        return false;
+    }
+    try {
+        if (read_file(fingerprint_path(output).string()) != fingerprint) {
+            return false;
+        }
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    // A deadline animation is stale once it has been played to its end
+    if (job.deadline) {
+        return fs::file_time_type::clock::now() - outputTime < std::chrono::seconds(job.frames);
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (VIPS_INIT(argv[0])) {
+        vips_error_exit(nullptr);
+    }
+
+    Arguments args;
+    std::vector<Job> jobs;
+    std::unique_ptr<CountdownRenderer> countdown;
+    fs::file_time_type jobsTime;
+    try {
+        args = parse_arguments(argc, argv);
+        jobs = parse_jobs(jsvips::Json::parse(read_file(args.jobsPath)));
+        countdown = std::make_unique<CountdownRenderer>(jsvips::parse_countdown_options(jsvips::Json::parse(read_file(args.templatePath))));
+        jobsTime = fs::last_write_time(args.jobsPath);
+        fs::create_directories(args.outputDir);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage();
+        return 2;
+    }
+
+    // Jobs run in parallel, each one on a single libvips thread
+    int threads = args.threads > 0 ? args.threads : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    vips_concurrency_set(1);
+
+    const std::string& fingerprint = countdown->options().fingerprint;
+    std::atomic<size_t> next {0};
+    std::atomic<int> rendered {0};
+    std::atomic<int> skipped {0};
+    std::atomic<int> failed {0};
+    std::atomic<int64_t> frames {0};
+    const int64_t now = static_cast<int64_t>(std::time(nullptr));
+    auto started = std::chrono::steady_clock::now();
+
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            const Job& job = jobs[i];
+            fs::path output = fs::path(args.outputDir) / job.output;
+            try {
+                if (!args.force && up_to_date(output, job, jobsTime, fingerprint)) {
+                    skipped++;
+                    continue;
+                }
+
+                const CountdownLocale* locale = countdown->find_locale(job.lang);
+                if (locale == nullptr) {
+                    throw std::invalid_argument("Unknown language " + job.lang);
+                }
+
+                std::vector<int> start = job.deadline ? moment_until(*job.deadline, now) : job.start;
+                jsvips::write_file(output.string(), countdown->render_gif(start, job.frames, *locale));
+                // Written last, an interrupted run renders the output again
+                jsvips::write_file(fingerprint_path(output).string(), std::vector<uint8_t>(fingerprint.begin(), fingerprint.end()));
+                rendered++;
+                frames += job.frames;
+            } catch (const std::exception& e) {
+                std::cerr << job.output << ": " << e.what() << std::endl;
+                failed++;
+            }
+        }
+        vips_thread_shutdown();
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) {
+        pool.emplace_back(worker);
+    }
+    for (std::thread& thread: pool) {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::printf("%d rendered, %d skipped, %d failed in %.2f s with %d threads: %.1f files/s, %.0f frames/s\n",
+                rendered.load(), skipped.load(), failed.load(), seconds, threads,
+                seconds > 0 ? rendered / seconds : 0.0, seconds > 0 ? frames / seconds : 0.0);
+
+    vips_shutdown();
+    return failed > 0 ? 1 : 0;
+}
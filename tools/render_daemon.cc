@@ -0,0 +1,520 @@
+//
+// vips-render-daemon: one warm rendering engine for every Node process of a host.
+//
+//   vips-render-daemon --socket /run/jsvips.sock [--jobs n] [--threads n] [--cache dir] [--cache-bytes n]
+//                      [--max-templates n] [--max-connections n]
+//
+// The daemon compiles each countdown template document once, whichever
+// process sends it, and keeps libvips, fontconfig and the disk cache warm.
+// Processes create their templates with the daemon option of
+// createCountdownAnimation and render through the socket, see
+// render_daemon.h for the protocol.
+//
+// --jobs is the number of renders run at once, one per hardware thread by
+// default, and --threads the libvips threads of each render. The least
+// recently used templates past --max-templates are dropped, a client loads
+// them again. Connections past --max-connections are refused.
+//
+// The socket is only open to the user running the daemon: it is created with
+// mode 0600 and peers of another user are disconnected.
+//
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore>
+#include <stdexcept>
+#include <string>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <vips/vips8>
+
+#include "countdown_renderer.h"
+#include "disk_cache.h"
+#include "json.h"
+#include "render_daemon.h"
+#include "render_options.h"
+
+namespace {
+
+struct Arguments {
+    std::string socketPath;
+    int jobs {0};
+    int threads {0};
+    std::string cacheDir;
+    size_t cacheBytes {256 * 1024 * 1024};
+    size_t maxTemplates {64};
+    int maxConnections {256};
+};
+
+void usage() {
+    std::cerr << "Usage: vips-render-daemon --socket <path> [--jobs <n>] [--threads <n>] [--cache <dir>] [--cache-bytes <n>]"
+                 " [--max-templates <n>] [--max-connections <n>]" << std::endl;
+}
+
+Arguments parse_arguments(int argc, char** argv) {
+    Arguments args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("Missing value of " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--socket") {
+            args.socketPath = value();
+        } else if (arg == "--jobs") {
+            args.jobs = std::stoi(value());
+        } else if (arg == "--threads") {
+            args.threads = std::stoi(value());
+        } else if (arg == "--cache") {
+            args.cacheDir = value();
+        } else if (arg == "--cache-bytes") {
+            args.cacheBytes = std::stoull(value());
+        } else if (arg == "--max-templates") {
+            args.maxTemplates = std::stoull(value());
+        } else if (arg == "--max-connections") {
+            args.maxConnections = std::stoi(value());
+        } else {
+            throw std::invalid_argument("Unknown argument " + arg);
+        }
+    }
+
+    if (args.socketPath.empty()) {
+        throw std::invalid_argument("--socket is required");
+    }
+    if (args.maxTemplates < 1 || args.maxConnections < 1) {
+        throw std::invalid_argument("--max-templates and --max-connections must be at least 1");
+    }
+    return args;
+}
+
+using Compiled = std::shared_future<std::shared_ptr<const CountdownRenderer>>;
+
+//
+// Templates by fingerprint, shared by the connections. A template being
+// compiled is a pending future, the other loads of the same document wait
+// for it instead of compiling it again. Past maxTemplates the least recently
+// used one is dropped, the renders holding it finish with it.
+//
+class Daemon {
+  public:
+    Daemon(int jobs, size_t maxTemplates): maxTemplates_(maxTemplates), slots_(jobs) {}
+
+    jsvips::Json handle(const jsvips::Json& message, std::vector<int>& fds) {
+        const std::string op = message["op"].is_string() ? message["op"].as_string() : "";
+        if (op == "load") {
+            return load(message);
+        }
+        if (op == "render") {
+            return render(message, fds);
+        }
+        if (op == "stats") {
+            return stats();
+        }
+        throw std::invalid_argument("Unknown request " + op);
+    }
+
+    static jsvips::Json error(const std::string& message, const std::string& code) {
+        jsvips::Json reply(jsvips::Json::Object{});
+        reply.set("ok", false);
+        reply.set("error", message);
+        reply.set("code", code);
+        return reply;
+    }
+
+    std::atomic<int> connections {0};
+    std::atomic<uint64_t> failures {0};
+
+  private:
+    jsvips::Json load(const jsvips::Json& message) {
+        CountdownOptions options = jsvips::parse_countdown_options(message["template"]);
+        const std::string id = options.fingerprint;
+
+        std::promise<std::shared_ptr<const CountdownRenderer>> promise;
+        Compiled compiled;
+        bool compile = false;
+        uint64_t loaded = 0;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            auto it = this->templates_.find(id);
+            if (it == this->templates_.end()) {
+                compiled = promise.get_future().share();
+                this->recent_.push_front(id);
+                loaded = ++this->loads_;
+                this->templates_.emplace(id, Entry{compiled, this->recent_.begin(), loaded});
+                compile = true;
+                evict_locked();
+            } else {
+                touch_locked(it->second);
+                compiled = it->second.compiled;
+            }
+        }
+
+        if (compile) {
+            try {
+                promise.set_value(std::make_shared<const CountdownRenderer>(options));
+            } catch (...) {
+                promise.set_exception(std::current_exception());
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                // Unless it was evicted and loaded again meanwhile
+                auto it = this->templates_.find(id);
+                if (it != this->templates_.end() && it->second.loaded == loaded) {
+                    this->recent_.erase(it->second.recent);
+                    this->templates_.erase(it);
+                }
+            }
+        }
+        // Rethrows the error of the compile
+        compiled.get();
+
+        jsvips::Json reply(jsvips::Json::Object{});
+        reply.set("ok", true);
+        reply.set("id", id);
+        return reply;
+    }
+
+    jsvips::Json render(const jsvips::Json& message, std::vector<int>& fds) {
+        std::shared_ptr<const CountdownRenderer> countdown = find(message["id"].is_string() ? message["id"].as_string() : "");
+        if (!countdown) {
+            return error("Unknown template", "ENOENT");
+        }
+
+        std::vector<int> start = jsvips::parse_countdown_moment_with_number(message["start"]);
+        const int frames = message.has("frames") ? jsvips::parse_countdown_frames(message["frames"]) : 1;
+        CountdownRenderOptions options;
+        if (message["options"].is_object()) {
+            options = jsvips::parse_countdown_render_options(message["options"]);
+        }
+        // The client writes the files, one density per request
+        if (!options.toFile.empty() || !options.scales.empty()) {
+            throw std::invalid_argument("toFile and scales are handled by the client of the render daemon");
+        }
+        if (options.outputs.empty()) {
+            options.outputs = {"gif"};
+        }
+
+        const CountdownRenderer* renderer = countdown->at_scale(options.scale);
+        if (renderer == nullptr) {
+            throw std::invalid_argument("The template has no scale " + jsvips::scale_name(options.scale));
+        }
+        const CountdownLocale* locale = renderer->find_locale(options.lang);
+        if (locale == nullptr) {
+            throw std::invalid_argument("Unknown language " + options.lang);
+        }
+
+        CountdownOutputs rendered;
+        MappedOutputs mapped;
+        this->slots_.acquire();
+        try {
+            renderer->render_cached_outputs(start, frames, *locale, options, rendered, mapped);
+        } catch (...) {
+            this->slots_.release();
+            throw;
+        }
+        this->slots_.release();
+        this->renders_++;
+
+        // The files of the disk cache, where the new renders were stored too,
+        // go as they are. The others are copied into a memfd.
+        jsvips::Json files(jsvips::Json::Array{});
+        for (const std::string& output: options.outputs) {
+            int fd = DiskCache::shared().open_file(renderer->cache_key(start, frames, *locale, options, output));
+            if (fd < 0) {
+                auto file = rendered.find(output);
+                if (file != rendered.end()) {
+                    fd = jsvips::memfd_of(file->second.data(), file->second.size());
+                } else {
+                    const MappedFile& cached = *mapped.at(output);
+                    fd = jsvips::memfd_of(cached.data(), cached.size());
+                }
+            }
+            fds.push_back(fd);
+            files.push_back(output);
+        }
+
+        jsvips::Json reply(jsvips::Json::Object{});
+        reply.set("ok", true);
+        reply.set("files", files);
+        return reply;
+    }
+
+    jsvips::Json stats() {
+        size_t templates = 0;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            templates = this->templates_.size();
+        }
+
+        jsvips::Json reply(jsvips::Json::Object{});
+        reply.set("ok", true);
+        reply.set("templates", static_cast<double>(templates));
+        reply.set("renders", static_cast<double>(this->renders_.load()));
+        reply.set("failures", static_cast<double>(this->failures.load()));
+        reply.set("connections", static_cast<double>(this->connections.load()));
+        return reply;
+    }
+
+    // A compiled template, waiting for a compile in progress. nullptr when unknown or failed.
+    std::shared_ptr<const CountdownRenderer> find(const std::string& id) {
+        Compiled compiled;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            auto it = this->templates_.find(id);
+            if (it == this->templates_.end()) {
+                return nullptr;
+            }
+            touch_locked(it->second);
+            compiled = it->second.compiled;
+        }
+        try {
+            return compiled.get();
+        } catch (const std::exception&) {
+            return nullptr;
+        }
+    }
+
+    struct Entry {
+        Compiled compiled;
+        // Position in recent_
+        std::list<std::string>::iterator recent;
+        // Which compile of the id it is
+        uint64_t loaded {0};
+    };
+
+    // Most recently used first
+    void touch_locked(Entry& entry) {
+        this->recent_.splice(this->recent_.begin(), this->recent_, entry.recent);
+    }
+
+    void evict_locked() {
+        while (this->templates_.size() > this->maxTemplates_) {
+            this->templates_.erase(this->recent_.back());
+            this->recent_.pop_back();
+        }
+    }
+
+    const size_t maxTemplates_;
+    std::mutex mutex_;
+    std::map<std::string, Entry> templates_;
+    // Template ids, the most recently used first
+    std::list<std::string> recent_;
+    uint64_t loads_ {0};
+    // Renders running at once
+    std::counting_semaphore<> slots_;
+    std::atomic<uint64_t> renders_ {0};
+};
+
+// Requests of one connection, answered in order. The connection is
+// counted by the caller.
+void serve(Daemon& daemon, int connection) {
+    for (;;) {
+        std::vector<int> received;
+        jsvips::Json message;
+        try {
+            message = jsvips::receive_message(connection, received);
+        } catch (const std::exception&) {
+            break;
+        }
+        // Clients send no descriptors
+        for (int fd: received) {
+            close(fd);
+        }
+
+        std::vector<int> fds;
+        jsvips::Json reply;
+        try {
+            reply = daemon.handle(message, fds);
+        } catch (const std::exception& e) {
+            for (int fd: fds) {
+                close(fd);
+            }
+            fds.clear();
+            daemon.failures++;
+            const bool invalid = dynamic_cast<const std::invalid_argument*>(&e) != nullptr;
+            reply = Daemon::error(e.what(), invalid ? "EINVAL" : "EIO");
+        }
+
+        bool sent = true;
+        try {
+            jsvips::send_message(connection, reply, fds);
+        } catch (const std::exception&) {
+            sent = false;
+        }
+        // The client holds its own references now
+        for (int fd: fds) {
+            close(fd);
+        }
+        if (!sent) {
+            break;
+        }
+    }
+    close(connection);
+    daemon.connections--;
+    vips_thread_shutdown();
+}
+
+// Only the user running the daemon, or root, may use it
+bool trusted_peer(int connection) {
+    ucred credentials {};
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0) {
+        return false;
+    }
+    return credentials.uid == geteuid() || credentials.uid == 0;
+}
+
+// Remove a socket left by a daemon that did not stop cleanly. Fails when
+// another daemon listens on it, or when the path is not a socket.
+bool remove_stale_socket(const std::string& path, const sockaddr_un& address) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        return errno == ENOENT;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        std::cerr << path << " exists and is not a socket" << std::endl;
+        return false;
+    }
+
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    const bool listening = probe >= 0 && connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+    const bool refused = !listening && errno == ECONNREFUSED;
+    if (probe >= 0) {
+        close(probe);
+    }
+    if (listening) {
+        std::cerr << "Another daemon listens on " << path << std::endl;
+        return false;
+    }
+    if (!refused) {
+        std::cerr << "Unable to probe " << path << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return unlink(path.c_str()) == 0 || errno == ENOENT;
+}
+
+}
+
+int main(int argc, char** argv) {
+    // SIGINT and SIGTERM are blocked in every thread, libvips ones included,
+    // and read from a signalfd polled with the listener
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (VIPS_INIT(argv[0])) {
+        vips_error_exit(nullptr);
+    }
+
+    Arguments args;
+    try {
+        args = parse_arguments(argc, argv);
+        if (!args.cacheDir.empty()) {
+            DiskCache::shared().configure(args.cacheDir, args.cacheBytes);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        usage();
+        return 2;
+    }
+
+    const int jobs = args.jobs > 0 ? args.jobs : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    if (args.threads > 0) {
+        vips_concurrency_set(args.threads);
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (args.socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "The socket path is too long" << std::endl;
+        return 2;
+    }
+    std::strncpy(address.sun_path, args.socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    if (!remove_stale_socket(args.socketPath, address)) {
+        return 1;
+    }
+    // Created 0600, there is no window where another user may connect
+    const mode_t mask = umask(0177);
+    const bool bound = listener >= 0 && bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(listener, 128) != 0) {
+        std::cerr << "Unable to listen on " << args.socketPath << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    const int signals = signalfd(-1, &stopSignals, SFD_CLOEXEC);
+    if (signals < 0) {
+        std::cerr << "signalfd: " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    std::cout << "Listening on " << args.socketPath << " with " << jobs << " render slots" << std::endl;
+
+    Daemon daemon(jobs, args.maxTemplates);
+    for (;;) {
+        pollfd fds[] = {{listener, POLLIN, 0}, {signals, POLLIN, 0}};
+        if (poll(fds, 2, -1) < 0) {
+            if (errno != EINTR) {
+                std::cerr << "poll: " << std::strerror(errno) << std::endl;
+                break;
+            }
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            break;
+        }
+        if (!(fds[0].revents & POLLIN)) {
+            continue;
+        }
+
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+                std::cerr << "accept: " << std::strerror(errno) << std::endl;
+            }
+            continue;
+        }
+        if (!trusted_peer(connection)) {
+            close(connection);
+            continue;
+        }
+        // The client reads this as the reply to its first request
+        if (daemon.connections >= args.maxConnections) {
+            try {
+                jsvips::send_message(connection, Daemon::error("Too many connections to the render daemon", "EBUSY"));
+            } catch (const std::exception&) {
+            }
+            close(connection);
+            continue;
+        }
+        daemon.connections++;
+        std::thread(serve, std::ref(daemon), connection).detach();
+    }
+
+    close(signals);
+    close(listener);
+    unlink(args.socketPath.c_str());
+    std::cout << "Stopped" << std::endl;
+    // Connections still open end with the process
+    return 0;
+}